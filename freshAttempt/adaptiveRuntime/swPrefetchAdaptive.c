@@ -0,0 +1,287 @@
+// Runtime of the adaptive mode of the prefetch pass. Every loop with prefetches has a descriptor
+// holding the look-ahead of each of its prefetch sites, which the loop reads whenever it is entered,
+// and a flag that selects between the loop and a copy of it without prefetches. The loop calls
+// __swpf_loop_enter and __swpf_loop_exit around every run, and the runtime times those runs with the
+// time stamp counter.
+//
+// The runs of a loop are grouped in epochs of at least SWPF_EPOCH_CYCLES cycles, and each epoch tries
+// one setting. The tuner first times the copy without prefetches and the compiler's look-ahead, then
+// hill climbs: it scales every look-ahead of the loop up by half while that gets faster, otherwise
+// down by a third while that gets faster. It settles on the best scale, or on the copy without
+// prefetches when prefetching doesn't beat it by SWPF_MARGIN, and stops timing. After SWPF_RETUNE
+// runs it starts over from the scale it settled on, so it follows the program into phases with
+// different behaviour.
+//
+// Environment:
+//   SWPF_EPOCH_CYCLES  cycles timed per setting (default 4000000)
+//   SWPF_RETUNE        runs of a settled loop before it is tuned again (default 1000000, 0 never)
+//   SWPF_REPORT        file the settings of every loop are written to on exit
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define SWPF_MIN_SCALE 10
+#define SWPF_MAX_SCALE 1600
+#define SWPF_MAX_NESTING 32
+
+// Share of its time prefetching has to save before a loop keeps it, so timing noise doesn't make
+// the tuner keep prefetches that only cost instructions.
+#define SWPF_MARGIN 0.02
+
+// Emitted by the pass for every loop, see createAdaptiveLoop.
+struct swpf_loop
+{
+  int32_t prefetch;       // 1 runs the loop with prefetches, 0 the copy without them
+  uint32_t sites;
+  int32_t* offsets;       // look-ahead of every site, in iterations
+  const int32_t* initial; // look-ahead the compiler chose for every site
+  const char* name;
+  void* state;            // struct swpf_state, allocated on the first run
+};
+
+enum swpf_phase
+{
+  TIME_OFF,     // timing the copy without prefetches
+  TIME_CURRENT, // timing the scale the tuner is at
+  TRY_UP,       // timing a larger scale
+  TRY_DOWN,     // timing a smaller scale
+  SETTLED,      // not timing
+};
+
+struct swpf_state
+{
+  pthread_mutex_t lock;
+  struct swpf_loop* loop;
+  struct swpf_state* next;
+
+  enum swpf_phase phase;
+  int direction;     // the direction that made the last move faster, 0 for none yet
+  uint32_t scale;    // percentage of the compiler's look-ahead the loop is at
+  uint32_t trying;   // scale of TRY_UP and TRY_DOWN
+  double offCost;
+  double cost;       // of `scale`
+
+  uint64_t cycles;   // of the epoch so far
+  uint64_t iterations;
+  uint64_t runs;
+  uint64_t settledRuns;
+};
+
+static pthread_mutex_t registry = PTHREAD_MUTEX_INITIALIZER;
+static struct swpf_state* states = NULL;
+static uint64_t epochCycles = 4000000;
+static uint64_t retune = 1000000;
+
+// Start of every loop the thread is in, innermost last.
+static __thread uint64_t started[SWPF_MAX_NESTING];
+static __thread uint32_t nesting = 0;
+
+static uint64_t readCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static void writeReport(void)
+{
+  const char* path = getenv("SWPF_REPORT");
+  FILE* file = path ? fopen(path, "w") : NULL;
+  if (!file)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&registry);
+  for (struct swpf_state* state = states; state; state = state->next)
+  {
+    const char* setting = state->phase != SETTLED ? "tuning" : state->loop->prefetch ? "prefetch" : "off";
+    fprintf(file, "%s %s %u%% off=%.3f on=%.3f\n", state->loop->name, setting, state->scale, state->offCost, state->cost);
+  }
+  pthread_mutex_unlock(&registry);
+  fclose(file);
+}
+
+static void apply(struct swpf_loop* loop, int prefetch, uint32_t scale)
+{
+  for (uint32_t site = 0; site < loop->sites; site++)
+  {
+    int64_t offset = (int64_t)loop->initial[site] * scale / 100;
+    __atomic_store_n(&loop->offsets[site], (int32_t)(offset > 0 ? offset : 1), __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&loop->prefetch, prefetch, __ATOMIC_RELAXED);
+}
+
+static struct swpf_state* createState(struct swpf_loop* loop)
+{
+  pthread_mutex_lock(&registry);
+
+  struct swpf_state* state = __atomic_load_n((struct swpf_state**)&loop->state, __ATOMIC_ACQUIRE);
+  if (!state && (state = calloc(1, sizeof(*state))))
+  {
+    if (!states)
+    {
+      const char* cycles = getenv("SWPF_EPOCH_CYCLES");
+      const char* runs = getenv("SWPF_RETUNE");
+      epochCycles = cycles ? strtoull(cycles, NULL, 10) : epochCycles;
+      retune = runs ? strtoull(runs, NULL, 10) : retune;
+      atexit(writeReport);
+    }
+
+    pthread_mutex_init(&state->lock, NULL);
+    state->loop = loop;
+    state->scale = 100;
+    state->phase = TIME_OFF;
+    state->next = states;
+    states = state;
+    apply(loop, 0, state->scale);
+    __atomic_store_n((struct swpf_state**)&loop->state, state, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&registry);
+  return state;
+}
+
+static void settle(struct swpf_state* state)
+{
+  state->phase = SETTLED;
+  state->settledRuns = 0;
+  apply(state->loop, state->cost < state->offCost * (1.0 - SWPF_MARGIN), state->scale);
+}
+
+static void tryScale(struct swpf_state* state, enum swpf_phase phase, uint32_t scale)
+{
+  if (scale < SWPF_MIN_SCALE || scale > SWPF_MAX_SCALE || scale == state->scale)
+  {
+    if (phase == TRY_UP && state->direction == 0)
+    {
+      tryScale(state, TRY_DOWN, state->scale * 2 / 3);
+      return;
+    }
+    settle(state);
+    return;
+  }
+
+  state->phase = phase;
+  state->trying = scale;
+  apply(state->loop, 1, scale);
+}
+
+// Moves the tuner on once an epoch has been timed, with the cost per iteration (per run when the
+// compiler couldn't count the iterations) of the setting that was timed.
+static void endEpoch(struct swpf_state* state, double cost)
+{
+  switch (state->phase)
+  {
+    case TIME_OFF:
+      state->offCost = cost;
+      state->phase = TIME_CURRENT;
+      apply(state->loop, 1, state->scale);
+      break;
+
+    case TIME_CURRENT:
+      state->cost = cost;
+      state->direction = 0;
+      tryScale(state, TRY_UP, state->scale * 3 / 2);
+      break;
+
+    case TRY_UP:
+    case TRY_DOWN:
+      if (cost < state->cost)
+      {
+        state->direction = state->phase == TRY_UP ? 1 : -1;
+        state->scale = state->trying;
+        state->cost = cost;
+        tryScale(state, state->phase, state->direction > 0 ? state->scale * 3 / 2 : state->scale * 2 / 3);
+      }
+      else if (state->phase == TRY_UP && state->direction == 0)
+      {
+        tryScale(state, TRY_DOWN, state->scale * 2 / 3);
+      }
+      else
+      {
+        settle(state);
+      }
+      break;
+
+    case SETTLED:
+      break;
+  }
+}
+
+void __swpf_loop_enter(struct swpf_loop* loop, uint64_t iterations)
+{
+  struct swpf_state* state = __atomic_load_n((struct swpf_state**)&loop->state, __ATOMIC_ACQUIRE);
+  if (!state && !(state = createState(loop)))
+  {
+    return;
+  }
+
+  if (__atomic_load_n(&state->phase, __ATOMIC_RELAXED) == SETTLED)
+  {
+    // Settled loops aren't timed, so their runs only cost the calls.
+    uint64_t runs = __atomic_add_fetch(&state->settledRuns, 1, __ATOMIC_RELAXED);
+    if (retune && runs == retune)
+    {
+      pthread_mutex_lock(&state->lock);
+      state->cycles = state->iterations = state->runs = 0;
+      state->phase = TIME_OFF;
+      apply(loop, 0, state->scale);
+      pthread_mutex_unlock(&state->lock);
+    }
+  }
+  else
+  {
+    __atomic_add_fetch(&state->iterations, iterations, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&state->runs, 1, __ATOMIC_RELAXED);
+  }
+
+  if (nesting < SWPF_MAX_NESTING)
+  {
+    started[nesting] = readCycles();
+  }
+  nesting++;
+}
+
+void __swpf_loop_exit(struct swpf_loop* loop)
+{
+  if (nesting == 0)
+  {
+    return;
+  }
+  nesting--;
+
+  struct swpf_state* state = loop->state;
+  if (nesting >= SWPF_MAX_NESTING || !state || __atomic_load_n(&state->phase, __ATOMIC_RELAXED) == SETTLED)
+  {
+    return;
+  }
+
+  uint64_t cycles = __atomic_add_fetch(&state->cycles, readCycles() - started[nesting], __ATOMIC_RELAXED);
+  if (cycles < epochCycles || pthread_mutex_trylock(&state->lock) != 0)
+  {
+    return;
+  }
+
+  // Runs that were in flight when the setting changed are counted in the next epoch, which is
+  // noise the length of an epoch keeps small.
+  if (state->cycles >= epochCycles && state->phase != SETTLED)
+  {
+    double cost = state->iterations ? (double)state->cycles / state->iterations
+                                    : (double)state->cycles / (state->runs ? state->runs : 1);
+    state->cycles = state->iterations = state->runs = 0;
+    endEpoch(state, cost);
+  }
+  pthread_mutex_unlock(&state->lock);
+}
@@ -0,0 +1,75 @@
+// swpf-analyze: runs the candidate discovery of the prefetch pass over .ll/.bc files and prints one
+// JSON object per loop, see the analyze option of the pass. Nothing is transformed or written back,
+// so large code bases can be triaged from their IR without rebuilding them with the pass.
+//
+//   swpf-analyze [-params='guard-chains;peel'] [-sw-prefetch-*] file.ll file.bc ...
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+
+extern "C" ::llvm::PassPluginLibraryInfo llvmGetPassPluginInfo();
+
+namespace {
+
+llvm::cl::list<std::string> InputFiles(llvm::cl::Positional, llvm::cl::OneOrMore,
+                                       llvm::cl::desc("<.ll or .bc files>"));
+
+llvm::cl::opt<std::string> Params("params", llvm::cl::init(""),
+                                  llvm::cl::desc("Pipeline parameters of the pass, e.g. 'guard-chains;chain-hops=1'"));
+
+}
+
+int main(int argc, char** argv)
+{
+  llvm::InitLLVM X(argc, argv);
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Prefetch candidates of every loop as JSON\n");
+
+  std::string Pipeline = "sw-prefetch<analyze" + (Params.empty() ? std::string() : ";" + Params) + ">";
+  int status = 0;
+
+  for (const std::string& File : InputFiles)
+  {
+    llvm::LLVMContext Context;
+    llvm::SMDiagnostic Err;
+    std::unique_ptr<llvm::Module> M = llvm::parseIRFile(File, Err, Context);
+    if (!M)
+    {
+      Err.print(argv[0], llvm::errs());
+      status = 1;
+      continue;
+    }
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassBuilder PB;
+    llvmGetPassPluginInfo().RegisterPassBuilderCallbacks(PB);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM;
+    if (llvm::Error E = PB.parsePassPipeline(MPM, Pipeline))
+    {
+      llvm::errs() << argv[0] << ": " << llvm::toString(std::move(E)) << "\n";
+      return 1;
+    }
+    MPM.run(*M, MAM);
+  }
+
+  return status;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+import argparse
+import pathlib
+import re
+import statistics
+import subprocess
+import time
+
+from gen_loops import generate_module
+
+REPO_ROOT = pathlib.Path(__file__).resolve().parents[2]
+BUILD_DIR = REPO_ROOT / "freshAttempt" / "build" / "swPrefetchPass"
+
+# The machine derived C constant reads ../../values.txt, so opt runs from a benchmark folder
+# exactly like the print_computed_c_val.sh scripts do.
+WORK_DIR = REPO_ROOT / "program" / "graph500"
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Time the prefetch pass on a module with many candidate loops")
+    parser.add_argument("-n", "--loops", type=int, default=500, help="number of candidate loops in the module")
+    parser.add_argument("-d", "--depth", type=int, default=2, help="levels of indirection per loop")
+    parser.add_argument("-r", "--repetitions", type=int, default=5)
+    parser.add_argument("-p", "--plugin", action="append",
+                        help="plugin build to time (repeatable), defaults to the one in freshAttempt/build")
+    parser.add_argument("-P", "--pipeline", action="append",
+                        help="pass pipeline to time with each plugin (repeatable), defaults to the hard coded and the machine derived C constant")
+    return parser.parse_args()
+
+def llvm_major():
+    version = subprocess.run(["opt", "--version"], capture_output=True, text=True).stdout
+    match = re.search(r"LLVM version (\d+)", version)
+    return int(match.group(1)) if match else None
+
+def opt_flags():
+    # Older opt releases still default to typed pointers.
+    major = llvm_major()
+    if major and major < 15:
+        return ["-opaque-pointers"]
+    return []
+
+def time_opt(args, repetitions):
+    times = []
+    for i in range(repetitions):
+        start = time.perf_counter()
+        subprocess.run(args, cwd=WORK_DIR, stdout=subprocess.DEVNULL, check=True)
+        times.append(time.perf_counter() - start)
+    return statistics.median(times)
+
+if __name__ == "__main__":
+    args = parse_args()
+    plugins = args.plugin or [str(BUILD_DIR / "SwPrefetchPass.so")]
+    pipelines = args.pipeline or ["sw-prefetch", "sw-prefetch<compute-c>"]
+
+    module = pathlib.Path("/tmp") / f"swpf_compile_time_{args.loops}.ll"
+    module.write_text(generate_module(args.loops, depth=args.depth))
+
+    base = ["opt"] + opt_flags() + [str(module), "-o", "/dev/null"]
+
+    # Label plugins by file name unless two builds of the same target are being compared.
+    names = [pathlib.Path(plugin).name for plugin in plugins]
+    labels = [name if names.count(name) == 1 else plugin for name, plugin in zip(names, plugins)]
+
+    results = [("no pass", time_opt(base + ["-passes=verify"], args.repetitions))]
+    for label, plugin in zip(labels, plugins):
+        for pipeline in pipelines:
+            command = base + [f"-load-pass-plugin={plugin}", f"-passes={pipeline}"]
+            results.append((f"{label} {pipeline}", time_opt(command, args.repetitions)))
+
+    print('*********************************************************')
+    print(f"Candidate loops: {args.loops}")
+    for name, seconds in results:
+        print(f"{name + ':':<48} {seconds:.3f}s")
+    print('*********************************************************')
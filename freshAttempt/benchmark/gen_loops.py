@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+import argparse
+
+# Generates a module full of loops that the prefetch pass can transform. Every loop walks an
+# index array with a canonical induction variable and follows `depth` levels of indirection.
+
+def generate_loop(k, depth):
+    lines = []
+    prev = f"exit{k - 1}" if k > 0 else "entry"
+    lines.append(f"  br label %header{k}")
+    lines.append(f"header{k}:")
+    lines.append(f"  %i{k} = phi i32 [ 0, %{prev} ], [ %i{k}.next, %body{k} ]")
+    lines.append(f"  %sum{k} = phi i32 [ 0, %{prev} ], [ %sum{k}.next, %body{k} ]")
+    lines.append(f"  %cmp{k} = icmp slt i32 %i{k}, %n")
+    lines.append(f"  br i1 %cmp{k}, label %body{k}, label %exit{k}")
+    lines.append(f"body{k}:")
+    value = f"%i{k}"
+    for level in range(depth):
+        array = "%a" if level == 0 else "%b"
+        lines.append(f"  %idx{k}.{level} = sext i32 {value} to i64")
+        lines.append(f"  %p{k}.{level} = getelementptr inbounds i32, ptr {array}, i64 %idx{k}.{level}")
+        lines.append(f"  %v{k}.{level} = load i32, ptr %p{k}.{level}, align 4")
+        value = f"%v{k}.{level}"
+    lines.append(f"  %sum{k}.next = add i32 %sum{k}, {value}")
+    lines.append(f"  %i{k}.next = add nsw i32 %i{k}, 1")
+    lines.append(f"  br label %header{k}")
+    lines.append(f"exit{k}:")
+    lines.append(f"  store i32 %sum{k}, ptr %out, align 4")
+    return lines
+
+def generate_function(f, loops, depth):
+    lines = [f"define void @loops{f}(ptr %a, ptr %b, ptr %out, i32 %n) {{", "entry:"]
+    for k in range(loops):
+        lines.extend(generate_loop(k, depth))
+    lines.append("  ret void")
+    lines.append("}")
+    lines.append("")
+    return lines
+
+def generate_module(num_loops, loops_per_function=4, depth=2):
+    lines = ['target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"',
+             'target triple = "x86_64-unknown-linux-gnu"',
+             ""]
+    functions = (num_loops + loops_per_function - 1) // loops_per_function
+    for f in range(functions):
+        loops = min(loops_per_function, num_loops - f * loops_per_function)
+        lines.extend(generate_function(f, loops, depth))
+    return "\n".join(lines)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--loops", type=int, default=500, help="number of candidate loops")
+    parser.add_argument("-f", "--loops-per-function", type=int, default=4)
+    parser.add_argument("-d", "--depth", type=int, default=2, help="levels of indirection per loop")
+    parser.add_argument("-o", "--output", default="loops.ll")
+    args = parser.parse_args()
+
+    with open(args.output, "w") as file:
+        file.write(generate_module(args.loops, args.loops_per_function, args.depth))
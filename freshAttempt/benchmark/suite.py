@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+import argparse
+import json
+import os
+import pathlib
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+from compile_time import BUILD_DIR, REPO_ROOT, WORK_DIR, llvm_major, opt_flags
+from gen_loops import generate_module
+
+# Measures the cost of the prefetch pass itself rather than the speed of the code it produces:
+# compile time and memory of opt, and how much code the pass adds to every module of the corpus.
+
+# Code size metrics only depend on the LLVM release and live in the repository. Time and memory
+# depend on the machine, so they are only compared against baselines stored on the same machine.
+BASELINES = pathlib.Path(__file__).resolve().parent / "baselines.json"
+LOCAL_BASELINES = pathlib.Path(__file__).resolve().parent / "baselines.local.json"
+CODE_METRICS = ("instructions_added", "text_growth", "inner_loop_insts", "inner_loop_insts_no")
+MACHINE_METRICS = ("pass_seconds", "peak_rss_kb")
+
+# The translation units the benchmark scripts run the pass on, with the language and include flags
+# their compile_x86.sh builds the rest of the program with.
+PROGRAMS = {
+    "g500":    (REPO_ROOT / "program" / "graph500", "seq-csr/seq-csr.c", ["-std=c99", "-I.", "-I./generator"]),
+    "hj2":     (REPO_ROOT / "program" / "hashjoin-ph-2" / "src", "npj2epb.c", ["-std=c99", "-I.", "-I.."]),
+    "hj8":     (REPO_ROOT / "program" / "hashjoin-ph-8" / "src", "npj2epb.c", ["-std=c99", "-I.", "-I.."]),
+    "cg":      (REPO_ROOT / "program" / "nas-cg", "cg.c", ["-I.", "-I../nas-common"]),
+    "randacc": (REPO_ROOT / "program" / "randacc", "randacc.c", []),
+}
+
+# Synthetic modules: (loops, loops per function, levels of indirection).
+SYNTHETIC = {
+    "many-loops":    (3000, 4, 2),
+    "deep-chains":   (500, 4, 8),
+    "huge-function": (2000, 500, 4),
+}
+
+# Relative and absolute slack before a metric counts as a regression.
+TOLERANCES = {
+    "pass_seconds":       (0.25, 0.02),
+    "peak_rss_kb":        (0.20, 1024),
+    "instructions_added": (0.05, 2),
+    "text_growth":        (0.05, 16),
+    "inner_loop_insts":   (0.05, 2),
+}
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Compile time and code size benchmarks for the prefetch pass")
+    parser.add_argument("-p", "--plugin", default=str(BUILD_DIR / "SwPrefetchPass.so"))
+    parser.add_argument("-P", "--pipeline", default="sw-prefetch")
+    parser.add_argument("-r", "--repetitions", type=int, default=3)
+    parser.add_argument("-o", "--only", action="append", help="corpus entry to run (repeatable), defaults to all")
+    parser.add_argument("-u", "--update-baselines", action="store_true",
+                        help="store the results as the new baselines instead of comparing against them")
+    args = parser.parse_args()
+    # opt runs from WORK_DIR.
+    args.plugin = os.path.abspath(args.plugin)
+    return args
+
+def run_measured(args, cwd):
+    # Wall time and peak resident memory of one child process. Callers keep the fastest of several
+    # runs, which is the least disturbed by whatever else the machine is doing.
+    start = time.perf_counter()
+    process = subprocess.Popen(args, cwd=cwd, stdout=subprocess.DEVNULL)
+    _, status, usage = os.wait4(process.pid, 0)
+    seconds = time.perf_counter() - start
+    if os.waitstatus_to_exitcode(status) != 0:
+        raise subprocess.CalledProcessError(os.waitstatus_to_exitcode(status), args)
+    return seconds, usage.ru_maxrss
+
+def count_instructions(ir):
+    # Instructions are the indented lines of function bodies.
+    count = 0
+    inside = False
+    for line in ir.splitlines():
+        if line.startswith("define "):
+            inside = True
+        elif line.startswith("}"):
+            inside = False
+        elif inside and line.startswith("  ") and not line.lstrip().startswith(";"):
+            count += 1
+    return count
+
+def text_size(obj):
+    output = subprocess.run(["llvm-size", "-A", str(obj)], capture_output=True, text=True, check=True).stdout
+    return sum(int(fields[1]) for fields in (line.split() for line in output.splitlines())
+               if len(fields) >= 2 and fields[0].startswith(".text"))
+
+def inner_loop_instructions(asm):
+    # llc annotates every block of a loop, on the comment lines after the block label, with the
+    # loop's header, and marks the headers of innermost loops.
+    headers = set()
+    block = None
+    counting = False
+    count = 0
+    for line in asm.splitlines():
+        label = re.match(r"^(?:\.(LBB\w+):|# (%bb\.\d+):)", line)
+        if label:
+            block = label.group(1) or label.group(2)
+            counting = False
+            continue
+        stripped = line.strip()
+        if stripped.startswith("#"):
+            if "Inner Loop Header" in stripped:
+                headers.add(block.lstrip("L"))
+                counting = True
+            else:
+                member = re.search(r"in Loop: Header=(\w+)", stripped)
+                if member:
+                    counting = member.group(1) in headers
+            continue
+        if line.startswith("\t") and not line.startswith("\t.") and counting:
+            count += 1
+        elif line and not line[0].isspace():
+            counting = False
+    return count
+
+def code_metrics(ir_path, flags, tmp):
+    obj = tmp / (ir_path.stem + ".o")
+    asm = tmp / (ir_path.stem + ".s")
+    subprocess.run(["llc", "-O3"] + flags + ["-filetype=obj", str(ir_path), "-o", str(obj)], check=True)
+    subprocess.run(["llc", "-O3"] + flags + [str(ir_path), "-o", str(asm)], check=True)
+    return text_size(obj), inner_loop_instructions(asm.read_text())
+
+def prepare_corpus(names, tmp):
+    corpus = {}
+    clang = shutil.which("clang")
+    for name, (directory, source, flags) in PROGRAMS.items():
+        if names and name not in names:
+            continue
+        if not clang:
+            print(f"Skipping {name}: clang not found")
+            continue
+        # Optimised IR without the pass, which is what the pass sees at the end of the clang pipeline.
+        output = tmp / f"{name}.ll"
+        subprocess.run([clang, "-O3"] + flags + ["-S", "-emit-llvm", source, "-o", str(output)], cwd=directory, check=True)
+        corpus[name] = output
+    for name, (loops, per_function, depth) in SYNTHETIC.items():
+        if names and name not in names:
+            continue
+        output = tmp / f"{name}.ll"
+        output.write_text(generate_module(loops, per_function, depth))
+        corpus[name] = output
+    return corpus
+
+def measure(name, module, args, flags, tmp):
+    transformed = tmp / f"{name}.auto.ll"
+    base = ["opt"] + flags + [str(module), "-S"]
+
+    plain = [run_measured(base + ["-passes=verify", "-o", os.devnull], WORK_DIR) for _ in range(args.repetitions)]
+    command = base + [f"-load-pass-plugin={args.plugin}", f"-passes={args.pipeline}", "-o", str(transformed)]
+    with_pass = [run_measured(command, WORK_DIR) for _ in range(args.repetitions)]
+
+    text_no, inner_no = code_metrics(module, flags, tmp)
+    text_auto, inner_auto = code_metrics(transformed, flags, tmp)
+
+    return {
+        "pass_seconds": round(max(0.0, min(t for t, _ in with_pass) - min(t for t, _ in plain)), 4),
+        "peak_rss_kb": max(rss for _, rss in with_pass),
+        "instructions_added": count_instructions(transformed.read_text()) - count_instructions(module.read_text()),
+        "text_growth": text_auto - text_no,
+        "inner_loop_insts": inner_auto,
+        "inner_loop_insts_no": inner_no,
+    }
+
+def load_baselines(path, llvm):
+    # Baselines of another LLVM release compile to different code and aren't compared against.
+    if not path.exists():
+        print(f"No baselines in {path}, run with -u to store them")
+        return {}
+    stored = json.loads(path.read_text())
+    if stored.get("llvm") != llvm:
+        print(f"Baselines in {path} are from LLVM {stored.get('llvm')}, not {llvm}, run with -u to replace them")
+        return {}
+    return stored["modules"]
+
+def store_baselines(path, llvm, results, metrics):
+    stored = json.loads(path.read_text()) if path.exists() else {}
+    modules = stored.get("modules", {}) if stored.get("llvm") == llvm else {}
+    for name, result in results.items():
+        modules[name] = {metric: value for metric, value in result.items() if metric in metrics}
+    path.write_text(json.dumps({"llvm": llvm, "modules": modules}, indent=2, sort_keys=True) + "\n")
+    print(f"Baselines written to {path}")
+
+def regressions(name, result, baselines):
+    flagged = []
+    baseline = baselines.get(name)
+    if not baseline:
+        return flagged
+    for metric, (relative, absolute) in TOLERANCES.items():
+        if metric in baseline and result[metric] > baseline[metric] * (1 + relative) + absolute:
+            flagged.append(f"{name} {metric}: {result[metric]} (baseline {baseline[metric]})")
+    return flagged
+
+if __name__ == "__main__":
+    args = parse_args()
+    flags = opt_flags()
+    llvm = llvm_major()
+
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="swpf_suite_") as directory:
+        tmp = pathlib.Path(directory)
+        for name, module in prepare_corpus(args.only, tmp).items():
+            results[name] = measure(name, module, args, flags, tmp)
+
+    print('*********************************************************')
+    print(f"{'module':<16}{'pass s':>9}{'peak MB':>9}{'+insts':>9}{'+.text':>9}{'inner no':>10}{'inner auto':>11}")
+    for name, result in results.items():
+        print(f"{name:<16}{result['pass_seconds']:>9.3f}{result['peak_rss_kb'] / 1024:>9.1f}"
+              f"{result['instructions_added']:>9}{result['text_growth']:>9}"
+              f"{result['inner_loop_insts_no']:>10}{result['inner_loop_insts']:>11}")
+    print('*********************************************************')
+
+    if args.update_baselines:
+        store_baselines(BASELINES, llvm, results, CODE_METRICS)
+        store_baselines(LOCAL_BASELINES, llvm, results, MACHINE_METRICS)
+        sys.exit(0)
+
+    baselines = load_baselines(BASELINES, llvm)
+    for name, local in load_baselines(LOCAL_BASELINES, llvm).items():
+        baselines.setdefault(name, {}).update(local)
+    flagged = [line for name, result in results.items() for line in regressions(name, result, baselines)]
+    for line in flagged:
+        print(f"REGRESSION {line}")
+    sys.exit(1 if flagged else 0)
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+import argparse
+import os
+import pathlib
+import re
+import statistics
+import subprocess
+import tempfile
+import time
+
+# Sweeps the look-ahead of every prefetch site of one binary built with the distance-table option
+# and linked with the distance runtime. Each site is swept on its own, with every other site at the
+# distance the compiler chose, through the SWPF_DISTANCES environment variable, so nothing is rebuilt.
+#
+#   sweep_sites.py -C program/randacc -x "Time in milliseconds:\s*(\d+\.\d+)" -- bin/x86/randacc-table 100000000
+
+DISTANCES = [8, 16, 32, 64, 128, 256, 512, 1024]
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Sweep the prefetch distance of every site of a binary independently")
+    parser.add_argument("command", nargs="+", help="command running the binary")
+    parser.add_argument("-C", "--directory", default=".", help="directory to run the command in")
+    parser.add_argument("-x", "--regex", help="regex whose first group is the time the program reports, "
+                                              "defaults to the wall time of the command")
+    parser.add_argument("-d", "--distance", type=int, action="append",
+                        help=f"distance to try (repeatable), defaults to {DISTANCES}")
+    parser.add_argument("-r", "--repetitions", type=int, default=3)
+    parser.add_argument("-s", "--sites", help="regex selecting the sites to sweep, defaults to all")
+    parser.add_argument("-p", "--profile", help="profile-gen profile; sweeps the sites with the most misses first")
+    parser.add_argument("-n", "--hottest", type=int, help="only sweep this many of the hottest sites of the profile")
+    parser.add_argument("-t", "--threshold", type=float, default=0.02,
+                        help="speedup a distance needs over the compiler's before it is kept (default 0.02)")
+    parser.add_argument("-o", "--output", default="swpf.distances",
+                        help="distances file for SWPF_DISTANCES_FILE with the best distance of every site")
+    return parser.parse_args()
+
+def run(args, overrides, dump=None):
+    env = dict(os.environ, SWPF_DISTANCES=",".join(f"{site}={value}" for site, value in overrides.items()))
+    env.pop("SWPF_DISTANCES_FILE", None)
+    if dump:
+        env["SWPF_DISTANCES_DUMP"] = str(dump)
+
+    start = time.perf_counter()
+    output = subprocess.run(args.command, cwd=args.directory, env=env, capture_output=True, text=True, check=True).stdout
+    seconds = time.perf_counter() - start
+
+    if not args.regex:
+        return seconds
+    match = re.search(args.regex, output)
+    if not match:
+        raise RuntimeError(f"'{args.regex}' not found in the output of {' '.join(args.command)}")
+    return float(match.group(1))
+
+def measure(args, overrides):
+    return statistics.median(run(args, overrides) for _ in range(args.repetitions))
+
+def list_sites(args):
+    # One run with the dump enabled lists every site of the binary with the compiler's distance.
+    with tempfile.TemporaryDirectory(prefix="swpf_sweep_") as directory:
+        dump = pathlib.Path(directory) / "sites"
+        run(args, {}, dump)
+        if not dump.exists():
+            raise RuntimeError("the binary didn't write a distance table, is it built with -sw-prefetch-distance-table "
+                               "and linked with libSwPrefetchDistances.a?")
+        sites = {}
+        for line in dump.read_text().splitlines():
+            site, value = line.rsplit(" ", 1)
+            sites[site] = int(value)
+        return sites
+
+def select_sites(args, sites):
+    selected = [site for site in sites if not args.sites or re.search(args.sites, site)]
+    if not args.profile:
+        return selected
+
+    misses = {}
+    for line in pathlib.Path(args.profile).read_text().splitlines():
+        fields = line.split()
+        if len(fields) == 3:
+            misses[fields[0]] = misses.get(fields[0], 0) + int(fields[2])
+    selected.sort(key=lambda site: misses.get(site, 0), reverse=True)
+    return selected[:args.hottest] if args.hottest else selected
+
+if __name__ == "__main__":
+    args = parse_args()
+    distances = args.distance or DISTANCES
+
+    sites = list_sites(args)
+    selected = select_sites(args, sites)
+    baseline = measure(args, {})
+    print(f"{len(sites)} sites, sweeping {len(selected)}, baseline {baseline:.4f}")
+
+    best = {}
+    for site in selected:
+        results = {sites[site]: baseline}
+        for value in distances:
+            if value not in results:
+                results[value] = measure(args, {site: value})
+        value = min(results, key=results.get)
+        if results[value] < baseline * (1 - args.threshold):
+            best[site] = value
+        print(f"{site:<48} compiler {sites[site]:>6}  best {value:>6}  "
+              + "  ".join(f"{v}:{t:.4f}" for v, t in sorted(results.items())))
+
+    # Sites were swept one at a time, so check what the best distances do together.
+    combined = measure(args, best) if best else baseline
+    print('*********************************************************')
+    print(f"baseline {baseline:.4f}, best distances together {combined:.4f}")
+    print('*********************************************************')
+
+    with open(args.output, "w") as file:
+        for site, value in sites.items():
+            file.write(f"{site} {best.get(site, value)}\n")
+    print(f"Distances written to {args.output}, run with SWPF_DISTANCES_FILE={args.output}")
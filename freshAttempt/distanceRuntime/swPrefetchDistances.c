@@ -0,0 +1,136 @@
+// Runtime of the distance-table mode of the prefetch pass. Every prefetch site's look-ahead, in
+// iterations, is a global the site's loop reads whenever it is entered, and the pass lists each of
+// them with the site's name (source:function:ordinal, as in profiles) in the swpf_sites section.
+// Before main runs, the overrides of the environment are written to those globals, so one binary
+// can be run with different distances for every site without rebuilding it.
+//
+// Environment:
+//   SWPF_DISTANCES_FILE  file of "site distance" lines, applied first
+//   SWPF_DISTANCES       "site=distance,..." ("site:distance" works too), "*" stands for every site
+//   SWPF_DISTANCES_DUMP  file every site and its distance are written to, in the format of
+//                        SWPF_DISTANCES_FILE, after the overrides are applied
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Emitted by the pass for every site, see createTableOffset.
+struct swpf_site
+{
+  const char* name;
+  int32_t* distance;
+};
+
+// Bounds of the swpf_sites section, provided by the linker.
+extern struct swpf_site __start_swpf_sites[] __attribute__((weak));
+extern struct swpf_site __stop_swpf_sites[] __attribute__((weak));
+
+static int setDistance(const char* name, size_t length, long distance)
+{
+  int all = length == 1 && name[0] == '*';
+  int found = 0;
+  for (struct swpf_site* site = __start_swpf_sites; site < __stop_swpf_sites; site++)
+  {
+    if (all || (strlen(site->name) == length && strncmp(site->name, name, length) == 0))
+    {
+      *site->distance = (int32_t)(distance > 0 ? distance : 1);
+      found = 1;
+    }
+  }
+
+  if (!found)
+  {
+    fprintf(stderr, "swpf: no prefetch site %.*s\n", (int)length, name);
+  }
+  return found;
+}
+
+static void readFile(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (!file)
+  {
+    fprintf(stderr, "swpf: unable to open %s\n", path);
+    return;
+  }
+
+  char line[1024];
+  while (fgets(line, sizeof(line), file))
+  {
+    char* space = strrchr(line, ' ');
+    if (line[0] != '#' && space)
+    {
+      setDistance(line, (size_t)(space - line), strtol(space + 1, NULL, 10));
+    }
+  }
+  fclose(file);
+}
+
+static void readList(const char* list)
+{
+  while (*list)
+  {
+    size_t length = strcspn(list, ",");
+
+    // Site names contain colons, so "site:distance" is split at the last one.
+    const char* separator = memchr(list, '=', length);
+    if (!separator)
+    {
+      for (const char* c = list; c < list + length; c++)
+      {
+        separator = *c == ':' ? c : separator;
+      }
+    }
+
+    if (separator)
+    {
+      setDistance(list, (size_t)(separator - list), strtol(separator + 1, NULL, 10));
+    }
+    list += length + (list[length] == ',');
+  }
+}
+
+static void writeDump(const char* path)
+{
+  FILE* file = fopen(path, "w");
+  if (!file)
+  {
+    fprintf(stderr, "swpf: unable to write %s\n", path);
+    return;
+  }
+
+  for (struct swpf_site* site = __start_swpf_sites; site < __stop_swpf_sites; site++)
+  {
+    fprintf(file, "%s %d\n", site->name, *site->distance);
+  }
+  fclose(file);
+}
+
+// Called from a constructor of every module with a table, so only the first call does anything.
+void __swpf_distances_init(void)
+{
+  static int initialized = 0;
+  if (initialized)
+  {
+    return;
+  }
+  initialized = 1;
+
+  const char* file = getenv("SWPF_DISTANCES_FILE");
+  const char* list = getenv("SWPF_DISTANCES");
+  const char* dump = getenv("SWPF_DISTANCES_DUMP");
+
+  if (file)
+  {
+    readFile(file);
+  }
+  if (list)
+  {
+    readList(list);
+  }
+  if (dump)
+  {
+    writeDump(dump);
+  }
+}
@@ -0,0 +1,393 @@
+// Describes the machine it runs on for the machine-file option of the prefetch pass. The cache
+// hierarchy is read from sysfs, and the clock, the latency of a load that misses every cache and the
+// bandwidth one core sustains are measured. The result is written as a JSON descriptor:
+//
+//   {"cpus": 8, "ghz": 3.4, "pageSize": 4096, "hugePageSize": 2097152,
+//    "latencyNs": 85.2, "bandwidthGBs": 14.1,
+//    "caches": [{"level": 1, "type": "Data", "size": 49152, "ways": 12, "line": 64, "sharedCpus": 2}, ...]}
+//
+// The latency is the time per step of a pointer chase through a buffer much larger than the last
+// level cache, visiting its cache lines in a random cycle, so neither the caches nor the hardware
+// prefetchers can help. Pages aren't huge, so it includes the TLB misses the benchmarks' random
+// accesses see too. The bandwidth is the best of several runs of the STREAM triad on one thread.
+//
+// Usage: swpf-machine [-o FILE] [-m MB]
+//   -o  descriptor to write (default swpf-machine.json, "-" for stdout)
+//   -m  size of the pointer chase buffer and of every triad array in MB (default 4x the last level cache,
+//       at least 64)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SWPF_MAX_CACHES 16
+#define SWPF_LINE 64
+
+struct swpf_cache
+{
+  long level;
+  char type[32];
+  long size;
+  long ways;
+  long line;
+  long sharedCpus;
+};
+
+static double now(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static int readSysfsText(int index, const char* field, char* text, size_t length)
+{
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/%s", index, field);
+
+  FILE* file = fopen(path, "r");
+  if (!file)
+  {
+    return 0;
+  }
+
+  int read = fgets(text, (int)length, file) != NULL;
+  fclose(file);
+  text[strcspn(text, "\n")] = 0;
+  return read;
+}
+
+static long readSysfsValue(int index, const char* field)
+{
+  char text[64];
+  if (!readSysfsText(index, field, text, sizeof(text)))
+  {
+    return -1;
+  }
+
+  char* end = NULL;
+  long value = strtol(text, &end, 10);
+  if (end && (*end == 'K' || *end == 'k'))
+  {
+    value *= 1024;
+  }
+  else if (end && (*end == 'M' || *end == 'm'))
+  {
+    value *= 1024 * 1024;
+  }
+  return value;
+}
+
+// Counts the CPUs of a list like "0-3,8-11".
+static long countCpus(const char* list)
+{
+  long count = 0;
+  while (*list)
+  {
+    char* end = NULL;
+    long first = strtol(list, &end, 10);
+    long last = first;
+    if (*end == '-')
+    {
+      last = strtol(end + 1, &end, 10);
+    }
+    count += last - first + 1;
+    list = *end == ',' ? end + 1 : end;
+    if (end == list && *list)
+    {
+      break;
+    }
+  }
+  return count;
+}
+
+static int readCaches(struct swpf_cache* caches)
+{
+  int count = 0;
+  for (int index = 0; index < SWPF_MAX_CACHES; index++)
+  {
+    struct swpf_cache* cache = &caches[count];
+    cache->level = readSysfsValue(index, "level");
+    if (cache->level < 0)
+    {
+      break;
+    }
+
+    if (!readSysfsText(index, "type", cache->type, sizeof(cache->type)))
+    {
+      strcpy(cache->type, "Unified");
+    }
+    cache->size = readSysfsValue(index, "size");
+    cache->ways = readSysfsValue(index, "ways_of_associativity");
+    cache->line = readSysfsValue(index, "coherency_line_size");
+
+    char shared[256];
+    cache->sharedCpus = readSysfsText(index, "shared_cpu_list", shared, sizeof(shared)) ? countCpus(shared) : 1;
+    count++;
+  }
+  return count;
+}
+
+static long readHugePageSize(void)
+{
+  FILE* file = fopen("/proc/meminfo", "r");
+  if (!file)
+  {
+    return 0;
+  }
+
+  char line[256];
+  long size = 0;
+  while (fgets(line, sizeof(line), file))
+  {
+    if (sscanf(line, "Hugepagesize: %ld kB", &size) == 1)
+    {
+      size *= 1024;
+      break;
+    }
+  }
+  fclose(file);
+  return size;
+}
+
+static double readCpufreqGhz(void)
+{
+  FILE* file = fopen("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", "r");
+  long khz = 0;
+  if (file)
+  {
+    if (fscanf(file, "%ld", &khz) != 1)
+    {
+      khz = 0;
+    }
+    fclose(file);
+  }
+  if (khz > 0)
+  {
+    return khz * 1e-6;
+  }
+
+  file = fopen("/proc/cpuinfo", "r");
+  double mhz = 0.0;
+  if (file)
+  {
+    char line[256];
+    while (fgets(line, sizeof(line), file) && sscanf(line, "cpu MHz : %lf", &mhz) != 1)
+    {
+    }
+    fclose(file);
+  }
+  return mhz * 1e-3;
+}
+
+// Times a chain of dependent adds, one cycle each, which gives the clock the core actually runs at
+// under load rather than its nominal one.
+static double measureGhz(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  const long iterations = 50000000;
+  double best = 0.0;
+  for (int run = 0; run < 3; run++)
+  {
+    long counter = iterations;
+    long value = 0;
+    double start = now();
+    __asm__ volatile("1:\n\t"
+                     "add %1, %1\n\tadd %1, %1\n\tadd %1, %1\n\tadd %1, %1\n\tadd %1, %1\n\t"
+                     "add %1, %1\n\tadd %1, %1\n\tadd %1, %1\n\tadd %1, %1\n\tadd %1, %1\n\t"
+                     "dec %0\n\t"
+                     "jnz 1b"
+                     : "+r"(counter), "+r"(value));
+    double ghz = iterations * 10 / (now() - start) * 1e-9;
+    best = ghz > best ? ghz : best;
+  }
+  return best;
+#else
+  return readCpufreqGhz();
+#endif
+}
+
+static double measureLatency(size_t bytes)
+{
+  size_t lines = bytes / SWPF_LINE;
+  char* buffer = aligned_alloc(SWPF_LINE, lines * SWPF_LINE);
+  size_t* order = malloc(lines * sizeof(size_t));
+  if (!buffer || !order)
+  {
+    free(buffer);
+    free(order);
+    return 0.0;
+  }
+
+  // A random cycle through every line (Sattolo's algorithm), so every step depends on the last and
+  // its address can't be predicted.
+  for (size_t i = 0; i < lines; i++)
+  {
+    order[i] = i;
+  }
+  uint64_t state = 0x9E3779B97F4A7C15ull;
+  for (size_t i = lines - 1; i > 0; i--)
+  {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    size_t j = state % i;
+    size_t swap = order[i];
+    order[i] = order[j];
+    order[j] = swap;
+  }
+  for (size_t i = 0; i < lines; i++)
+  {
+    *(void**)(buffer + order[i] * SWPF_LINE) = buffer + order[(i + 1) % lines] * SWPF_LINE;
+  }
+  free(order);
+
+  void** current = (void**)buffer;
+  for (size_t i = 0; i < lines; i++)
+  {
+    current = *current;
+  }
+
+  const size_t steps = 1 << 24;
+  double start = now();
+  for (size_t i = 0; i < steps; i++)
+  {
+    current = *current;
+  }
+  double seconds = now() - start;
+
+  // Keeps the chase from being optimised away.
+  if (current == NULL)
+  {
+    fprintf(stderr, "swpf-machine: broken pointer chase\n");
+  }
+  free(buffer);
+  return seconds / steps * 1e9;
+}
+
+static double measureBandwidth(size_t bytes)
+{
+  size_t count = bytes / sizeof(double);
+  double* a = aligned_alloc(SWPF_LINE, count * sizeof(double));
+  double* b = aligned_alloc(SWPF_LINE, count * sizeof(double));
+  double* c = aligned_alloc(SWPF_LINE, count * sizeof(double));
+  if (!a || !b || !c)
+  {
+    free(a);
+    free(b);
+    free(c);
+    return 0.0;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    a[i] = 0.0;
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
+
+  double best = 0.0;
+  for (int run = 0; run < 5; run++)
+  {
+    double start = now();
+    for (size_t i = 0; i < count; i++)
+    {
+      a[i] = b[i] + 3.0 * c[i];
+    }
+    double seconds = now() - start;
+
+    // STREAM counts the two arrays read and the one written.
+    double gbs = 3.0 * count * sizeof(double) / seconds * 1e-9;
+    best = gbs > best ? gbs : best;
+  }
+
+  if (a[count / 2] != 7.0)
+  {
+    fprintf(stderr, "swpf-machine: wrong triad result\n");
+  }
+  free(a);
+  free(b);
+  free(c);
+  return best;
+}
+
+int main(int argc, char** argv)
+{
+  const char* path = "swpf-machine.json";
+  long megabytes = 0;
+
+  int option;
+  while ((option = getopt(argc, argv, "o:m:")) != -1)
+  {
+    switch (option)
+    {
+    case 'o':
+      path = optarg;
+      break;
+    case 'm':
+      megabytes = strtol(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-o FILE] [-m MB]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  struct swpf_cache caches[SWPF_MAX_CACHES];
+  int cacheCount = readCaches(caches);
+
+  if (megabytes <= 0)
+  {
+    long largest = 0;
+    for (int i = 0; i < cacheCount; i++)
+    {
+      largest = caches[i].size > largest ? caches[i].size : largest;
+    }
+    megabytes = 4 * largest / (1024 * 1024);
+    megabytes = megabytes < 64 ? 64 : megabytes;
+  }
+  size_t bytes = (size_t)megabytes * 1024 * 1024;
+
+  double ghz = measureGhz();
+  if (ghz <= 0.0)
+  {
+    ghz = readCpufreqGhz();
+  }
+  double latency = measureLatency(bytes);
+  double bandwidth = measureBandwidth(bytes);
+
+  FILE* file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+  if (!file)
+  {
+    fprintf(stderr, "swpf-machine: unable to write %s\n", path);
+    return 1;
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(file, "  \"ghz\": %.3f,\n", ghz);
+  fprintf(file, "  \"pageSize\": %ld,\n", sysconf(_SC_PAGESIZE));
+  fprintf(file, "  \"hugePageSize\": %ld,\n", readHugePageSize());
+  fprintf(file, "  \"latencyNs\": %.2f,\n", latency);
+  fprintf(file, "  \"bandwidthGBs\": %.2f,\n", bandwidth);
+  fprintf(file, "  \"caches\": [");
+  for (int i = 0; i < cacheCount; i++)
+  {
+    fprintf(file, "%s\n    {\"level\": %ld, \"type\": \"%s\", \"size\": %ld, \"ways\": %ld, \"line\": %ld, \"sharedCpus\": %ld}",
+            i ? "," : "", caches[i].level, caches[i].type, caches[i].size, caches[i].ways, caches[i].line,
+            caches[i].sharedCpus);
+  }
+  fprintf(file, "\n  ]\n}\n");
+
+  if (file != stdout)
+  {
+    fclose(file);
+  }
+  return 0;
+}
@@ -0,0 +1,331 @@
+// Runtime of the profile-gen mode of the prefetch pass. Every candidate access calls
+// __swpf_profile_record with the name of its site and the address it touches. Each thread runs the
+// cache lines its sites touch through a model of one level of the machine's caches of its own: set
+// associative with LRU replacement, sized from sysfs. Only a sample of the sets is modelled, and the
+// misses of the others are estimated from it. Threads add their counts to the totals of the program
+// when they exit, and on exit the accesses and misses of every site are written to the profile, which
+// profile-use reads back.
+//
+// The model sees the accesses of each site on their own, so it measures how much a site reuses its
+// own data. This needs no hardware performance counters.
+//
+// Environment:
+//   SWPF_PROFILE       profile written on exit (default swpf.profile)
+//   SWPF_CACHE_LEVEL   cache level to model (default 2)
+//   SWPF_CACHE         "size,ways,line" in bytes, overrides the cache read from sysfs
+//   SWPF_SAMPLED_SETS  sets of the cache modelled for every site (default 64, 0 for all of them)
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SWPF_MAX_SITES 4096
+#define SWPF_SAMPLED_SETS 64
+
+struct swpf_site
+{
+  const char* name;
+  uint64_t accesses;
+  uint64_t sampled;  // accesses to the modelled sets
+  uint64_t misses;   // misses in the modelled sets
+  uint64_t* tags;    // ways tags of every modelled set, most recently used first in every set, 0 for empty
+};
+
+// The sites a thread has recorded, found by the address of their names.
+struct swpf_thread
+{
+  struct swpf_site sites[SWPF_MAX_SITES];
+  struct swpf_thread* next;
+};
+
+// Accesses and estimated misses of the threads that have exited, and the threads still running.
+static struct swpf_site totals[SWPF_MAX_SITES];
+static struct swpf_thread* threads = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t threadKey;
+static __thread struct swpf_thread* current = NULL;
+
+static uint64_t cacheSets = 1024;
+static uint64_t cacheWays = 16;
+static uint64_t lineShift = 6;
+static uint64_t sampleStride = 1; // every sampleStride-th set is modelled
+static uint64_t modelledSets = 1024;
+
+static long readSysfsValue(int index, const char* field)
+{
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/%s", index, field);
+
+  FILE* file = fopen(path, "r");
+  if (!file)
+  {
+    return -1;
+  }
+
+  char text[64] = {0};
+  long value = -1;
+  if (fgets(text, sizeof(text), file))
+  {
+    char* end = NULL;
+    value = strtol(text, &end, 10);
+    if (end && (*end == 'K' || *end == 'k'))
+    {
+      value *= 1024;
+    }
+    else if (end && (*end == 'M' || *end == 'm'))
+    {
+      value *= 1024 * 1024;
+    }
+  }
+  fclose(file);
+  return value;
+}
+
+static void configureCache(void)
+{
+  long size = 1024 * 1024, ways = 16, line = 64;
+
+  const char* level = getenv("SWPF_CACHE_LEVEL");
+  long wanted = level ? strtol(level, NULL, 10) : 2;
+
+  for (int index = 0; index < 16; index++)
+  {
+    long current = readSysfsValue(index, "level");
+    if (current < 0)
+    {
+      break;
+    }
+
+    char path[128], type[32] = {0};
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+    FILE* file = fopen(path, "r");
+    if (file)
+    {
+      if (!fgets(type, sizeof(type), file))
+      {
+        type[0] = 0;
+      }
+      fclose(file);
+    }
+
+    if (current == wanted && strncmp(type, "Instruction", 11) != 0)
+    {
+      long s = readSysfsValue(index, "size");
+      long w = readSysfsValue(index, "ways_of_associativity");
+      long l = readSysfsValue(index, "coherency_line_size");
+      size = s > 0 ? s : size;
+      ways = w > 0 ? w : ways;
+      line = l > 0 ? l : line;
+      break;
+    }
+  }
+
+  const char* override = getenv("SWPF_CACHE");
+  if (override)
+  {
+    sscanf(override, "%ld,%ld,%ld", &size, &ways, &line);
+  }
+
+  lineShift = 0;
+  while ((1L << (lineShift + 1)) <= line)
+  {
+    lineShift++;
+  }
+
+  cacheWays = ways > 0 ? (uint64_t)ways : 1;
+  cacheSets = (uint64_t)size / (cacheWays << lineShift);
+  if (cacheSets == 0)
+  {
+    cacheSets = 1;
+  }
+
+  // Modelling every set would take the tags of a whole cache for every site and thread.
+  const char* sampled = getenv("SWPF_SAMPLED_SETS");
+  long wantedSets = sampled ? strtol(sampled, NULL, 10) : SWPF_SAMPLED_SETS;
+  sampleStride = wantedSets > 0 && (uint64_t)wantedSets < cacheSets ? cacheSets / (uint64_t)wantedSets : 1;
+  modelledSets = (cacheSets + sampleStride - 1) / sampleStride;
+}
+
+static void simulate(struct swpf_site* site, uint64_t address)
+{
+  site->accesses++;
+
+  uint64_t index = address >> lineShift;
+  uint64_t setIndex = index % cacheSets;
+  if (setIndex % sampleStride != 0)
+  {
+    return;
+  }
+  site->sampled++;
+
+  // Line 0 marks empty ways, so lines are stored one up.
+  uint64_t line = index + 1;
+  uint64_t* set = site->tags + (setIndex / sampleStride) * cacheWays;
+
+  uint64_t way = 0;
+  while (way < cacheWays - 1 && set[way] != line)
+  {
+    way++;
+  }
+  if (set[way] != line)
+  {
+    site->misses++;
+  }
+
+  // Move to the front, which evicts the least recently used line on a miss.
+  memmove(set + 1, set, way * sizeof(uint64_t));
+  set[0] = line;
+}
+
+static struct swpf_site* findSite(struct swpf_site* table, const char* name)
+{
+  // Sites are identified by the address of their name, which is unique in the program.
+  uint64_t hash = ((uintptr_t)name >> 3) * 0x9E3779B97F4A7C15ull;
+  for (uint64_t probe = 0; probe < SWPF_MAX_SITES; probe++)
+  {
+    struct swpf_site* site = &table[(hash + probe) % SWPF_MAX_SITES];
+    if (site->name == name || !site->name)
+    {
+      return site;
+    }
+  }
+  return NULL;
+}
+
+// Adds the accesses of a thread's sites to the totals, with the misses of the sets that weren't
+// modelled estimated from the ones that were. Called with the lock held.
+static void mergeThread(struct swpf_thread* thread)
+{
+  for (int i = 0; i < SWPF_MAX_SITES; i++)
+  {
+    struct swpf_site* site = &thread->sites[i];
+    struct swpf_site* total = site->name ? findSite(totals, site->name) : NULL;
+    if (!total)
+    {
+      continue;
+    }
+
+    total->name = site->name;
+    total->accesses += site->accesses;
+    total->misses += site->sampled ? (uint64_t)((double)site->misses * site->accesses / site->sampled + 0.5) : 0;
+  }
+}
+
+static void freeThread(struct swpf_thread* thread)
+{
+  for (int i = 0; i < SWPF_MAX_SITES; i++)
+  {
+    free(thread->sites[i].tags);
+  }
+  free(thread);
+}
+
+// Runs when a thread that recorded accesses exits.
+static void exitThread(void* data)
+{
+  struct swpf_thread* thread = data;
+
+  pthread_mutex_lock(&lock);
+  struct swpf_thread** link = &threads;
+  while (*link && *link != thread)
+  {
+    link = &(*link)->next;
+  }
+  if (*link)
+  {
+    *link = thread->next;
+    mergeThread(thread);
+  }
+  pthread_mutex_unlock(&lock);
+
+  freeThread(thread);
+}
+
+// Threads still running at exit, the main thread among them, are merged as far as they got.
+static void writeProfile(void)
+{
+  pthread_mutex_lock(&lock);
+
+  for (struct swpf_thread* thread = threads; thread; thread = thread->next)
+  {
+    mergeThread(thread);
+  }
+  threads = NULL;
+
+  const char* path = getenv("SWPF_PROFILE");
+  FILE* file = fopen(path ? path : "swpf.profile", "w");
+  if (!file)
+  {
+    fprintf(stderr, "swpf: unable to write profile %s\n", path ? path : "swpf.profile");
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  for (int i = 0; i < SWPF_MAX_SITES; i++)
+  {
+    if (totals[i].name)
+    {
+      fprintf(file, "%s %llu %llu\n", totals[i].name,
+              (unsigned long long)totals[i].accesses, (unsigned long long)totals[i].misses);
+    }
+  }
+
+  fclose(file);
+  pthread_mutex_unlock(&lock);
+}
+
+static void initialize(void)
+{
+  configureCache();
+  pthread_key_create(&threadKey, exitThread);
+  atexit(writeProfile);
+}
+
+static struct swpf_thread* startThread(void)
+{
+  pthread_once(&once, initialize);
+
+  struct swpf_thread* thread = calloc(1, sizeof(struct swpf_thread));
+  if (!thread)
+  {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&lock);
+  thread->next = threads;
+  threads = thread;
+  pthread_mutex_unlock(&lock);
+
+  pthread_setspecific(threadKey, thread);
+  return thread;
+}
+
+void __swpf_profile_record(const char* name, const void* address)
+{
+  struct swpf_thread* thread = current ? current : (current = startThread());
+  if (!thread)
+  {
+    return;
+  }
+
+  struct swpf_site* site = findSite(thread->sites, name);
+  if (!site)
+  {
+    return;
+  }
+
+  if (!site->name)
+  {
+    site->tags = calloc(modelledSets * cacheWays, sizeof(uint64_t));
+    if (!site->tags)
+    {
+      return;
+    }
+    site->name = name;
+  }
+
+  simulate(site, (uintptr_t)address);
+}
@@ -1,976 +1,3598 @@
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopPeel.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/Transforms/Scalar/LoopUnrollPass.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/JSON.h"
 
 #include  <iostream>
+#include <algorithm>
 #include <array>
+#include <cstdlib>
 #include <fstream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 // To use LLVM_DEBUG
 #define DEBUG_TYPE "SwPrefetchPass"
 
 
-#ifndef IGNORE_SIZE
-#define IGNORE_SIZE 0
-#endif
-
-#ifndef COMPUTE_C_CONST
+#ifndef C_CONSTANT
 #define C_CONSTANT (256)
 #endif
 
 namespace {
 
+// Every setting of the pass can be given on the command line (e.g. through -mllvm when running clang)
+// or as a pipeline parameter, e.g. -passes='sw-prefetch<distance=128;no-strides>'.
+llvm::cl::opt<int> ClDistance("sw-prefetch-distance", llvm::cl::init(C_CONSTANT),
+                              llvm::cl::desc("Hard coded C constant (prefetch distance in iterations)"));
+
+llvm::cl::opt<bool> ClComputeCConst("sw-prefetch-compute-c", llvm::cl::init(false),
+                                    llvm::cl::desc("Compute the C constant from the machine and the IPC estimates"));
+
+llvm::cl::opt<std::string> ClIPCFile("sw-prefetch-ipc-file", llvm::cl::init("../../values.txt"),
+                                     llvm::cl::desc("IPC estimate file used with -sw-prefetch-compute-c"));
+
+llvm::cl::opt<int> ClIPCIndex("sw-prefetch-ipc-index", llvm::cl::init(0),
+                              llvm::cl::desc("Line of this program's estimate in the IPC estimate file"));
+
+llvm::cl::opt<std::string> ClMachineFile("sw-prefetch-machine-file", llvm::cl::init(""),
+                                         llvm::cl::desc("Compute the C constant from the latency and bandwidth in this "
+                                                        "swpf-machine descriptor instead of the regression"));
+
+llvm::cl::opt<bool> ClPrintCConst("sw-prefetch-print-c", llvm::cl::init(false),
+                                  llvm::cl::desc("Print the inputs and the result of the C constant computation"));
+
+llvm::cl::opt<bool> ClNoStrides("sw-prefetch-no-strides", llvm::cl::init(false),
+                                llvm::cl::desc("Don't generate prefetches for strided accesses"));
+
+llvm::cl::opt<bool> ClIgnoreSize("sw-prefetch-ignore-size", llvm::cl::init(false),
+                                 llvm::cl::desc("Don't clamp look-ahead indices to the loop bound"));
+
+llvm::cl::opt<bool> ClNoLoopModel("sw-prefetch-no-loop-model", llvm::cl::init(false),
+                                  llvm::cl::desc("Use the C constant for every loop instead of the per-loop model"));
+
+llvm::cl::opt<bool> ClLoopCost("sw-prefetch-loop-cost", llvm::cl::init(false),
+                               llvm::cl::desc("Scale the distance of every loop by the target's estimate of the cycles "
+                                              "its body takes instead of its instruction count and the IPC estimates"));
+
+llvm::cl::opt<unsigned> ClChainHops("sw-prefetch-chain-hops", llvm::cl::init(2),
+                                    llvm::cl::desc("Elements of a linked chain (e.g. a hash bucket overflow list) "
+                                                   "prefetched beyond the first, 0 to disable"));
+
+llvm::cl::opt<unsigned> ClSliceBudget("sw-prefetch-slice-budget", llvm::cl::init(200000),
+                                      llvm::cl::desc("Operands and slice instructions visited per function while looking for "
+                                                     "prefetch slices, after which the remaining loads are left alone"));
+
+llvm::cl::opt<bool> ClNoEpilogue("sw-prefetch-no-epilogue", llvm::cl::init(false),
+                                 llvm::cl::desc("Clamp look-ahead indices on every iteration instead of running the "
+                                                "last iterations of a loop in an epilogue without prefetches"));
+
+llvm::cl::opt<bool> ClPeel("sw-prefetch-peel", llvm::cl::init(false),
+                           llvm::cl::desc("Take loop bounds and base pointers that are loaded inside a loop from its "
+                                          "first iteration, peeled off when needed, instead of hoisting the loads"));
+
+llvm::cl::opt<bool> ClGuardChains("sw-prefetch-guard-chains", llvm::cl::init(false),
+                                  llvm::cl::desc("Prefetch chains of any depth in loops without a known bound, "
+                                                 "keeping the index of every intermediate load inside its array"));
+
+llvm::cl::opt<unsigned> ClGuardBound("sw-prefetch-guard-bound", llvm::cl::init(0),
+                                     llvm::cl::desc("Elements assumed in arrays indexed by guarded chains when the size "
+                                                    "of the array isn't known, 0 for none"));
+
+llvm::cl::opt<bool> ClOuterLookahead("sw-prefetch-outer-lookahead", llvm::cl::init(false),
+                                     llvm::cl::desc("Prefetch the first iterations of short inner loops for a later "
+                                                    "iteration of the enclosing loop, from the enclosing loop"));
+
+llvm::cl::opt<unsigned> ClOuterTripCount("sw-prefetch-outer-trip-count", llvm::cl::init(8),
+                                         llvm::cl::desc("Iterations assumed of inner loops without branch weights or a "
+                                                        "constant bound by outer-lookahead, 0 to leave them alone"));
+
+llvm::cl::opt<bool> ClProfileGen("sw-prefetch-profile-gen", llvm::cl::init(false),
+                                 llvm::cl::desc("Record the addresses of every prefetch site for the profile runtime "
+                                                "instead of prefetching"));
+
+llvm::cl::opt<std::string> ClProfileUse("sw-prefetch-profile-use", llvm::cl::init(""),
+                                        llvm::cl::desc("Profile written by a profile-gen build; only the sites it "
+                                                       "found to miss are prefetched"));
+
+llvm::cl::opt<unsigned> ClProfileMissRate("sw-prefetch-profile-miss-rate", llvm::cl::init(10),
+                                          llvm::cl::desc("Percentage of its accesses that have to miss for "
+                                                         "profile-use to prefetch a site"));
+
+llvm::cl::opt<bool> ClUniformLocality("sw-prefetch-uniform-locality", llvm::cl::init(false),
+                                      llvm::cl::desc("Keep every prefetched line in all cache levels instead of "
+                                                     "picking the level from the reuse of the access"));
+
+llvm::cl::opt<bool> ClAdaptive("sw-prefetch-adaptive", llvm::cl::init(false),
+                               llvm::cl::desc("Read the look-ahead of every prefetch from a global that the adaptive "
+                                              "runtime tunes while the program runs"));
+
+llvm::cl::opt<bool> ClDistanceTable("sw-prefetch-distance-table", llvm::cl::init(false),
+                                    llvm::cl::desc("Read the look-ahead of every prefetch from a table of the program "
+                                                   "that the distance runtime can override at startup"));
+
+llvm::cl::opt<bool> ClAnalyze("sw-prefetch-analyze", llvm::cl::init(false),
+                              llvm::cl::desc("Print the prefetch candidates of every loop as JSON instead of "
+                                             "transforming"));
+
+// Where the default pipelines (clang -O3 -fpass-plugin, opt -passes='default<O3>') run the pass. Pipelines
+// that name sw-prefetch run it where it is named whatever this is set to.
+enum class SwPrefetchPosition
+{
+  None,
+  ScalarOptimizerLate,
+  VectorizerStart,
+  OptimizerLast,
+};
+
+llvm::cl::opt<SwPrefetchPosition> ClPosition(
+    "sw-prefetch-position", llvm::cl::init(SwPrefetchPosition::OptimizerLast),
+    llvm::cl::desc("Where the default pipelines run the pass"),
+    llvm::cl::values(clEnumValN(SwPrefetchPosition::None, "none", "Only where a pipeline names sw-prefetch"),
+                     clEnumValN(SwPrefetchPosition::ScalarOptimizerLate, "scalar-optimizer-late",
+                                "At the end of the function simplification pipeline, before callers inline the function"),
+                     clEnumValN(SwPrefetchPosition::VectorizerStart, "vectorizer-start",
+                                "After LICM and induction variable simplification, before vectorization and unrolling"),
+                     clEnumValN(SwPrefetchPosition::OptimizerLast, "optimizer-last",
+                                "At the end of the optimization pipeline, after vectorization")));
+
+struct SwPrefetchOptions
+{
+  int distance = ClDistance;
+  bool computeCConst = ClComputeCConst;
+  std::string ipcFile = ClIPCFile;
+  int ipcIndex = ClIPCIndex;
+  std::string machineFile = ClMachineFile;
+  bool printCConst = ClPrintCConst;
+  bool noStrides = ClNoStrides;
+  bool ignoreSize = ClIgnoreSize;
+  bool noLoopModel = ClNoLoopModel;
+  bool loopCost = ClLoopCost;
+  unsigned sliceBudget = ClSliceBudget;
+  unsigned chainHops = ClChainHops;
+  bool uniformLocality = ClUniformLocality;
+  bool noEpilogue = ClNoEpilogue;
+  bool peel = ClPeel;
+  bool guardChains = ClGuardChains;
+  unsigned guardBound = ClGuardBound;
+  bool outerLookahead = ClOuterLookahead;
+  unsigned outerTripCount = ClOuterTripCount;
+  bool profileGen = ClProfileGen;
+  std::string profileUse = ClProfileUse;
+  unsigned profileMissRate = ClProfileMissRate;
+  bool adaptive = ClAdaptive;
+  bool distanceTable = ClDistanceTable;
+  bool analyze = ClAnalyze;
+};
+
+// Parses the parameters of sw-prefetch<...>, starting from the command line settings.
+llvm::Expected<SwPrefetchOptions> parseSwPrefetchOptions(llvm::StringRef Params)
+{
+  SwPrefetchOptions options;
+
+  while (!Params.empty())
+  {
+    llvm::StringRef Param;
+    std::tie(Param, Params) = Params.split(';');
+
+    llvm::StringRef Key, Value;
+    std::tie(Key, Value) = Param.split('=');
+
+    if (Key == "distance" && !Value.getAsInteger(10, options.distance))
+    {
+      continue;
+    }
+    if (Key == "ipc-index" && !Value.getAsInteger(10, options.ipcIndex))
+    {
+      continue;
+    }
+    if (Key == "slice-budget" && !Value.getAsInteger(10, options.sliceBudget))
+    {
+      continue;
+    }
+    if (Key == "chain-hops" && !Value.getAsInteger(10, options.chainHops))
+    {
+      continue;
+    }
+    if (Key == "guard-bound" && !Value.getAsInteger(10, options.guardBound))
+    {
+      continue;
+    }
+    if (Key == "outer-trip-count" && !Value.getAsInteger(10, options.outerTripCount))
+    {
+      continue;
+    }
+    if (Key == "profile-miss-rate" && !Value.getAsInteger(10, options.profileMissRate))
+    {
+      continue;
+    }
+    if (Key == "profile-use" && !Value.empty())
+    {
+      options.profileUse = Value.str();
+      continue;
+    }
+    if (Key == "ipc-file" && !Value.empty())
+    {
+      options.ipcFile = Value.str();
+      continue;
+    }
+    if (Key == "machine-file" && !Value.empty())
+    {
+      options.machineFile = Value.str();
+      continue;
+    }
+    if (Value.empty())
+    {
+      if (Key == "compute-c") { options.computeCConst = true; continue; }
+      if (Key == "print-c") { options.printCConst = true; continue; }
+      if (Key == "no-strides") { options.noStrides = true; continue; }
+      if (Key == "ignore-size") { options.ignoreSize = true; continue; }
+      if (Key == "no-loop-model") { options.noLoopModel = true; continue; }
+      if (Key == "loop-cost") { options.loopCost = true; continue; }
+      if (Key == "uniform-locality") { options.uniformLocality = true; continue; }
+      if (Key == "no-epilogue") { options.noEpilogue = true; continue; }
+      if (Key == "peel") { options.peel = true; continue; }
+      if (Key == "guard-chains") { options.guardChains = true; continue; }
+      if (Key == "outer-lookahead") { options.outerLookahead = true; continue; }
+      if (Key == "profile-gen") { options.profileGen = true; continue; }
+      if (Key == "adaptive") { options.adaptive = true; continue; }
+      if (Key == "distance-table") { options.distanceTable = true; continue; }
+      if (Key == "analyze") { options.analyze = true; continue; }
+    }
+
+    return llvm::make_error<llvm::StringError>("invalid sw-prefetch parameter '" + Param + "'",
+                                               llvm::inconvertibleErrorCode());
+  }
+
+  return options;
+}
+
 const std::array<double, 5> K_VALUES{-0.009309007357754038,-0.6902547322677854,-0.01174499830280426,5.290974393057368e-06,0.02107176132152629};
 
-struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
+// Loop body size (in IR instructions) and chain depth the C constant is tuned for.
+// Loops that are smaller or larger than this get a proportionally longer or shorter distance.
+const unsigned REFERENCE_BODY_SIZE = 16;
+const int REFERENCE_CHAIN_DEPTH = 2;
+
+// Relative latency of one level of a prefetch chain. The first level is a strided access
+// which the hardware prefetchers already help with, every level after it is a dependent access.
+const int STRIDE_LEVEL_LATENCY = 1;
+const int INDIRECT_LEVEL_LATENCY = 2;
+
+// Most iterations of a short inner loop that outer-lookahead prefetches for a later iteration of the
+// enclosing loop, as the hand-written BFS of graph500 does for the first eight edges of a vertex.
+const unsigned OUTER_LOOKAHEAD_ITERATIONS = 8;
+
+// The pass can run on the same code twice: at compile time and again at the link of an LTO build.
+// Functions it transformed get the attribute and are left alone. Its prefetches, the latches of the
+// loops it changed and the latches of the epilogues and copies it made of them get the metadata, so
+// loops of those functions inlined into another since are left alone too. Functions and loops it
+// didn't change get neither, and a later run may still prefetch them.
+const char* const PREFETCHED_ATTRIBUTE = "sw-prefetched";
+const char* const PREFETCHED_METADATA = "sw.prefetch";
+
+// Allocation functions the benchmarks use, with the argument holding the size in bytes and, for
+// calloc-style functions, the argument holding the element count (-1 if there is none). Functions
+// carrying an allocsize attribute are recognised without being listed here.
+struct AllocationFunction
+{
+  const char* name;
+  int sizeArg;
+  int countArg;
+};
 
-  bool makeLoopInvariantSpec(llvm::Instruction *I, bool &Changed, llvm::Loop* L) const {
-    // Test if the value is already loop-invariant.
-    if (L->isLoopInvariant(I)) {
+const std::array<AllocationFunction, 12> ALLOCATION_FUNCTIONS{{
+  {"malloc", 0, -1},
+  {"calloc", 1, 0},
+  {"realloc", 1, -1},
+  {"aligned_alloc", 1, -1},
+  {"valloc", 0, -1},
+  {"_Znwm", 0, -1},
+  {"_Znam", 0, -1},
+  {"xmalloc", 0, -1},
+  {"xcalloc", 1, 0},
+  {"xmalloc_large", 0, -1},
+  {"xmalloc_large_ext", 0, -1},
+  {"alloc_aligned", 0, -1},
+}};
+
+struct LoopDistanceModel
+{
+  unsigned tripCount = 0; // 0 when ScalarEvolution can't bound the trip count
+  unsigned bodySize = 0;
+  unsigned cycles = 0;    // cycles per iteration estimated by the target with loop-cost, 0 otherwise
+  int depth = 1;          // deepest prefetch chain rooted at this loop's induction variable
+  int distance = 0;       // prefetch distance, in iterations, of the first level of a chain
+};
+
+// Machine derived C constant. The inputs come from /proc, the machine descriptor and the IPC estimate
+// file, none of which changes while the compiler runs. Registered as a module analysis, which computes
+// the constant of every setting the sw-prefetch passes of its PassBuilder's pipelines asked for, so
+// pipelines can require it up front. Behind it the value is computed once per process (and set of
+// inputs) and shared by every module and prefetch site.
+struct MachineCConstAnalysis : public llvm::AnalysisInfoMixin<MachineCConstAnalysis>
+{
+  // The settings the C constant depends on.
+  using Settings = std::tuple<std::string, bool, std::string, int, bool>;
+
+  static Settings getSettings(const SwPrefetchOptions& options)
+  {
+    return std::make_tuple(options.machineFile, options.computeCConst, options.ipcFile, options.ipcIndex, options.loopCost);
+  }
+
+  // Settings of the sw-prefetch passes added to the pipelines of one PassBuilder, shared with the
+  // analysis it registers. Pipelines are built before they run, so the analysis sees all of them.
+  using Requests = std::shared_ptr<std::map<Settings, SwPrefetchOptions>>;
+
+  struct Result
+  {
+    std::map<Settings, int> c_consts;  // 0 where the C constant can't be computed
+
+    // False when the settings weren't requested before the analysis ran.
+    bool lookup(const SwPrefetchOptions& options, int& c_const) const
+    {
+      auto it = c_consts.find(getSettings(options));
+      if (it == c_consts.end())
+      {
+        return false;
+      }
+      c_const = it->second;
       return true;
     }
-    // EH block instructions are immobile.
-    // Determine the insertion point, unless one was given.
-    if(!I) return false;
-    if(!llvm::isSafeToSpeculativelyExecute(I) && !I->mayReadFromMemory()) return false; //hacky but it works for now. This is allowed because we're hoisting what are really going to be prefetches.
 
-    llvm::BasicBlock *Preheader = L->getLoopPreheader();
-    // Without a preheader, hoisting is not feasible.
-    if (!Preheader) {
+    bool invalidate(llvm::Module&, const llvm::PreservedAnalyses&, llvm::ModuleAnalysisManager::Invalidator&)
+    {
       return false;
     }
-    llvm::Instruction* InsertPt = Preheader->getTerminator();
+  };
 
-    // Don't hoist instructions with loop-variant operands.
-    for (llvm::Value *Operand : I->operands()) {
-      if(Operand) if(llvm::Instruction* i = llvm::dyn_cast<llvm::Instruction>(Operand)) if (!makeLoopInvariantSpec(i, Changed, L)) {
-        Changed = false;
-        return false;
-      }
+  explicit MachineCConstAnalysis(Requests requests) : requests(std::move(requests)) {}
+
+  // Asks the analysis for the C constant of options, when they need one.
+  static void request(const Requests& requests, const SwPrefetchOptions& options)
+  {
+    if (options.computeCConst || !options.machineFile.empty())
+    {
+      requests->emplace(getSettings(options), options);
+    }
+  }
+
+  Result run(llvm::Module&, llvm::ModuleAnalysisManager&)
+  {
+    Result result;
+    for (const auto& Requested : *requests)
+    {
+      result.c_consts[Requested.first] = computeCConst(Requested.second);
     }
+    return result;
+  }
 
-    // Hoist.
-    I->moveBefore(InsertPt);
+  // 0 when the C constant can't be computed.
+  static int computeCConst(const SwPrefetchOptions& options)
+  {
+    static std::mutex lock;
+    static std::map<Settings, int> c_consts;
 
-    // There is possibility of hoisting this instruction above some arbitrary
-    // condition. Any metadata defined on it can be control dependent on this
-    // condition. Conservatively strip it here so that we don't give any wrong
-    // information to the optimizer.
+    std::lock_guard<std::mutex> guard(lock);
 
-    Changed = true;
-    return true;
+    Settings key = getSettings(options);
+    auto it = c_consts.find(key);
+    if (it == c_consts.end())
+    {
+      int c_const = 0;
+      if (!options.machineFile.empty())
+      {
+        c_const = ComputeMachineCConst(options.machineFile, options.computeCConst && !options.loopCost,
+                                       options.ipcFile, options.ipcIndex, options.printCConst);
+      }
+      if (c_const <= 0 && options.computeCConst)
+      {
+        c_const = ComputeCConst(options.ipcFile, options.ipcIndex, !options.loopCost, options.printCConst);
+      }
+      it = c_consts.emplace(key, c_const).first;
+    }
+    return it->second;
   }
 
-  bool makeLoopInvariantPredecessor(llvm::Value *V, bool &Changed, llvm::Loop* L) const {
-    //if predecessor always runs before the loop, then we can hoist invariant loads, at the expense of exception imprecision.
-    //A better technique would retain precision by separating out the first iteration and reusing the invariant loads.
+  static double getInfoFromSysFile(std::string sys_file, std::string key)
+  {
+    double value = 0.0f;
 
-    // Test if the value is already loop-invariant.
-    if (L->isLoopInvariant(V)){
-      return true;
+    std::string current;
+    std::ifstream file(sys_file);
+    while (file >> current)
+    {     
+      if (current == key)
+      {
+        file >> value;
+        break; 
+      }
+      file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     }
 
-    if(!V) return true;
+    return value;
+  }
 
-    llvm::Instruction* I = llvm::dyn_cast<llvm::Instruction>(V);
-    if(!I) return false;
+  static double getInfoFromSysFileWithLine(std::string sys_file, std::string s1, std::string s2, std::string s3){
+    double value = 0.0f;
+    std::ifstream file(sys_file);
+    std::string line;
+    while (std::getline(file, line))
+    {
 
-    if (!llvm::isSafeToSpeculativelyExecute(I) && !I->mayReadFromMemory()) {
-      return false;
-    }
+      std::istringstream iss(line);
+      std::string a, b, c;
+      if (!(iss >> a >> b >> c)) { continue; }
 
-    // EH block instructions are immobile.
-    if (I->isEHPad()) {
-      return false;
+      if (a == s1 && b == s2 && c == s3){
+        iss >> value;
+        break;
+      }
     }
 
-    // Determine the insertion point, unless one was given.
+    return value;
+  }
 
-    llvm::BasicBlock *Preheader = L->getLoopPreheader();
-    // Without a preheader, hoisting is not feasible.
-    if (!Preheader) {
-      return false;
+  static double getCpuClockSpeed()
+  {
+
+    double value = 0.0f;
+    std::ifstream file("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream iss(line);
+        std::string a, b, last;
+        if (!(iss >> a >> b)) { continue; }
+
+        if (a == "model" && b == "name"){
+            while(iss >> last){
+            }
+
+            if (last.length() > 3) {
+                last.erase(last.length() - 3);
+            }
+
+            // Not every model name ends in the clock speed, e.g. virtualised "Intel(R) Xeon(R) Processor".
+            value = std::strtod(last.c_str(), nullptr);
+            break;
+        }
     }
-    llvm::Instruction* InsertPt = Preheader->getTerminator();
 
-    // Don't hoist instructions with loop-variant operands.
-    for (llvm::Value *Operand : I->operands()){
-      if (!makeLoopInvariantPredecessor(Operand, Changed,L)) {
-        return false;
-      }
+    if (value <= 0.0f)
+    {
+      value = getInfoFromSysFileWithLine("/proc/cpuinfo", "cpu", "MHz", ":") / 1000.0f;
     }
 
-    // Hoist.
-    I->moveBefore(InsertPt);
+    return value;
+  }
 
-    // There is possibility of hoisting this instruction above some arbitrary
-    // condition. Any metadata defined on it can be control dependent on this
-    // condition. Conservatively strip it here so that we don't give any wrong
-    // information to the optimizer.
-    I->dropUnknownNonDebugMetadata();
+  static double getTotalCores()
+  {
+    return getInfoFromSysFileWithLine("/proc/cpuinfo", "cpu", "cores", ":");
+  }
 
-    Changed = true;
-    return true;
+  static double getCacheSize()
+  {
+    return getInfoFromSysFileWithLine("/proc/cpuinfo", "cache", "size", ":");
+  }
 
+  static double getRamSize()
+  {
+    return getInfoFromSysFile("/proc/meminfo", "MemTotal:");
   }
 
-  llvm::Value* getArrayOrAllocSize(llvm::LoadInst* l) const
+  static double getPageSize()
   {
-    LLVM_DEBUG(llvm::dbgs() << "attempting to get size of base array:\n");
-    LLVM_DEBUG(l->getPointerOperand()->print(llvm::dbgs()));
+    return getInfoFromSysFile("/proc/meminfo", "Hugepagesize:");
+  }
 
-    llvm::GetElementPtrInst* gep = llvm::dyn_cast<llvm::GetElementPtrInst>(l->getPointerOperand());
+  // Reads every "name: ipc" line of the IPC estimate file in one pass.
+  static std::vector<std::pair<std::string, double>> readIPCValues(const std::string& ipcFile)
+  {
+    std::vector<std::pair<std::string, double>> values;
 
-    if (!gep)
+    std::ifstream file(ipcFile);
+
+    if (!file.is_open())
     {
-      LLVM_DEBUG(llvm::dbgs() << "Couldn't find gep \n");
-      return nullptr;
+      std::cerr << "Unable to open file" << std::endl;
+      return values;
     }
 
-    LLVM_DEBUG(llvm::dbgs() << " with ptr: ");
-    LLVM_DEBUG(gep->getPointerOperand()->print(llvm::dbgs()));
-
-    auto ArrayStart = gep->getPointerOperand();
-    
-    if(llvm::ArrayType* at = llvm::dyn_cast<llvm::ArrayType>(gep->getSourceElementType())) 
+    std::string line;
+    while (getline(file, line))
     {
-      LLVM_DEBUG(llvm::dbgs() << " and size: ");
-      LLVM_DEBUG(llvm::dbgs() << std::to_string(at->getNumElements()));
+      std::pair<std::string, double> value("", -1.0f);
+      std::istringstream iss(line);
 
-      int size = at->getNumElements();
+      std::getline(iss, value.first, ':');
+      iss >> value.second;
 
-      LLVM_DEBUG(llvm::dbgs() << "and type: " << *(at->getElementType ()));
+      if (value.second < 0.0f)
+      {
+        break;
+      }
 
-      return llvm::ConstantInt::get(llvm::Type::getInt64Ty(llvm_module->getContext()), size);
+      values.push_back(value);
     }
-    else if(llvm::AllocaInst* ai = llvm::dyn_cast<llvm::AllocaInst>(ArrayStart)) 
+
+    return values;
+  }
+
+  // The inputs and the result of a C constant computation go to stdout with print-c, which the
+  // print_computed_c_val.sh scripts enable, and to the debug output otherwise.
+  static void reportCConst(const std::string& Report, bool print)
+  {
+    if (print)
     {
-      LLVM_DEBUG(llvm::dbgs() << "and dynamic allocated size " << *(ai->getArraySize()));
-      LLVM_DEBUG(llvm::dbgs() << *(ai->getArraySize ()));
+      llvm::outs() << Report;
+    }
+    LLVM_DEBUG(llvm::dbgs() << Report);
+  }
 
-      LLVM_DEBUG(llvm::dbgs() << "and type: ");
-      LLVM_DEBUG(llvm::dbgs() << *(gep->getSourceElementType ()));
+  // With loop-cost (useIPC false) the per-loop estimates replace the program's IPC, so the estimate
+  // file isn't read and the C constant is the regression's alone.
+  static int ComputeCConst(const std::string& ipcFile, int ipcIndex, bool useIPC, bool print)
+  {
+    double cpuSpeed = getCpuClockSpeed();
+    double cores = getTotalCores();
+    double cacheSize = getCacheSize();
+    double ramSize = getRamSize();
+    double pageSize = getPageSize();
 
-      return ai->getArraySize ();
+    std::vector<std::pair<std::string, double>> ipc_values;
+    if (useIPC)
+    {
+      ipc_values = readIPCValues(ipcFile);
+    }
+
+    std::pair<std::string, double> test_ipc("", useIPC ? -1.0f : 0.0f);
+    if (ipcIndex >= 0 && static_cast<size_t>(ipcIndex) < ipc_values.size())
+    {
+      test_ipc = ipc_values[ipcIndex];
+    }
+    else if (useIPC)
+    {
+      std::cerr << "Line index out of range" << std::endl;
+    }
+
+    double average_ipc = 0.0f;
+    for (auto& ipc : ipc_values)
+    {
+      average_ipc += ipc.second;
+    }
+    if (!ipc_values.empty())
+    {
+      average_ipc /= static_cast<double>(ipc_values.size());
+    }
+
+
+    double c_const = K_VALUES[0] * cpuSpeed + K_VALUES[1] * cores + K_VALUES[2] * cacheSize + K_VALUES[3] * ramSize + K_VALUES[4] * pageSize;
+    c_const = c_const + 32.0d * (test_ipc.second - average_ipc);
+
+    if (c_const <= 0.0d)
+    {
+      c_const = 32.0d;
+    }
+
+    std::ostringstream OS;
+    OS << "cpu speed: " << cpuSpeed << "\n";
+    OS << "cores: " << cores << "\n";
+    OS << "cache size: " << cacheSize << "\n";
+    OS << "ram size: " << ramSize << "\n";
+    OS << "page size: " << pageSize << "\n";
+    OS << "IPC:" << test_ipc.second << "\n";
+    OS << "Average IPC: " << average_ipc << "\n";
+
+    OS << "Calculated C Const Value: " << c_const << " ... will be cast to " << static_cast<int>(c_const) << "\n";
+    reportCConst(OS.str(), print);
+
+    return static_cast<int>(c_const);
+  }
+
+  // Memory latency, bandwidth and clock of a descriptor written by swpf-machine (machineProfile/).
+  struct MachineDescriptor
+  {
+    double ghz = 0.0;
+    double latencyNs = 0.0;
+    double bandwidthGBs = 0.0;
+    double lineSize = 64.0; // line of the last level cache
+  };
+
+  static bool readMachineDescriptor(const std::string& machineFile, MachineDescriptor& machine)
+  {
+    std::ifstream file(machineFile);
+    if (!file.is_open())
+    {
+      std::cerr << "Unable to open machine file " << machineFile << std::endl;
+      return false;
+    }
+
+    std::stringstream text;
+    text << file.rdbuf();
+    llvm::Expected<llvm::json::Value> Descriptor = llvm::json::parse(text.str());
+    if (!Descriptor)
+    {
+      std::cerr << "Invalid machine file " << machineFile << ": " << llvm::toString(Descriptor.takeError()) << std::endl;
+      return false;
+    }
+
+    const llvm::json::Object* Machine = Descriptor->getAsObject();
+    if (!Machine)
+    {
+      std::cerr << "Invalid machine file " << machineFile << std::endl;
+      return false;
+    }
+
+    if (auto ghz = Machine->getNumber("ghz")) { machine.ghz = *ghz; }
+    if (auto latency = Machine->getNumber("latencyNs")) { machine.latencyNs = *latency; }
+    if (auto bandwidth = Machine->getNumber("bandwidthGBs")) { machine.bandwidthGBs = *bandwidth; }
+
+    if (const llvm::json::Array* Caches = Machine->getArray("caches"))
+    {
+      int64_t lastLevel = 0;
+      for (const llvm::json::Value& Cache : *Caches)
+      {
+        const llvm::json::Object* Level = Cache.getAsObject();
+        if (!Level)
+        {
+          continue;
+        }
+
+        auto level = Level->getInteger("level");
+        auto line = Level->getInteger("line");
+        if (level && line && *line > 0 && *level >= lastLevel)
+        {
+          lastLevel = *level;
+          machine.lineSize = static_cast<double>(*line);
+        }
+      }
+    }
+
+    return machine.ghz > 0.0 && machine.latencyNs > 0.0 && machine.bandwidthGBs > 0.0;
+  }
+
+  // The distance that keeps the last load of a reference chain (REFERENCE_CHAIN_DEPTH levels in a
+  // REFERENCE_BODY_SIZE instruction body) one memory latency ahead of its use. An iteration takes as
+  // long as its instructions at the estimated IPC, or as long as the core needs to bring in the
+  // line it misses, whichever is longer. The C constant is the distance of the chain's first level,
+  // which the loop model gives the share of the latency of every level.
+  static int ComputeMachineCConst(const std::string& machineFile, bool computeCConst, const std::string& ipcFile, int ipcIndex,
+                                  bool print)
+  {
+    MachineDescriptor machine;
+    if (!readMachineDescriptor(machineFile, machine))
+    {
+      return 0;
+    }
+
+    // Without an IPC estimate for the program the body is assumed to run at one instruction per cycle,
+    // which is also the unit of the target's cost estimates that loop-cost uses.
+    double ipc = 1.0;
+    if (computeCConst)
+    {
+      auto ipc_values = readIPCValues(ipcFile);
+      if (ipcIndex >= 0 && static_cast<size_t>(ipcIndex) < ipc_values.size() && ipc_values[ipcIndex].second > 0.0)
+      {
+        ipc = ipc_values[ipcIndex].second;
+      }
+    }
+
+    double computeNs = REFERENCE_BODY_SIZE / (ipc * machine.ghz);
+    double transferNs = machine.lineSize / machine.bandwidthGBs;
+    double iterationNs = std::max(computeNs, transferNs);
+
+    double lastLevelLatency = (REFERENCE_CHAIN_DEPTH > 1) ? INDIRECT_LEVEL_LATENCY : STRIDE_LEVEL_LATENCY;
+    double chainLatency = STRIDE_LEVEL_LATENCY + (REFERENCE_CHAIN_DEPTH - 1) * INDIRECT_LEVEL_LATENCY;
+    double c_const = machine.latencyNs / iterationNs * chainLatency / lastLevelLatency;
+
+    std::ostringstream OS;
+    OS << "cpu speed: " << machine.ghz << "\n";
+    OS << "memory latency: " << machine.latencyNs << " ns\n";
+    OS << "bandwidth: " << machine.bandwidthGBs << " GB/s\n";
+    OS << "IPC:" << ipc << "\n";
+    OS << "iteration: " << iterationNs << " ns\n";
+
+    OS << "Calculated C Const Value: " << c_const << " ... will be cast to " << static_cast<int>(c_const) << "\n";
+    reportCConst(OS.str(), print);
+
+    return std::max(static_cast<int>(c_const), 1);
+  }
+
+  Requests requests;
+
+  static llvm::AnalysisKey Key;
+};
+
+llvm::AnalysisKey MachineCConstAnalysis::Key;
+
+// Accesses and misses of one prefetch site in a profile written by the profile runtime
+// (profileRuntime/swPrefetchProfile.c), one "site accesses misses" line per site.
+struct SiteProfile
+{
+  uint64_t accesses = 0;
+  uint64_t misses = 0;
+};
+
+// Reads a profile once per process, like the C constant. nullptr when it can't be read.
+const llvm::StringMap<SiteProfile>* readSiteProfile(const std::string& path)
+{
+  static std::mutex lock;
+  static std::map<std::string, std::unique_ptr<llvm::StringMap<SiteProfile>>> profiles;
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  auto it = profiles.find(path);
+  if (it != profiles.end())
+  {
+    return it->second.get();
+  }
+
+  std::unique_ptr<llvm::StringMap<SiteProfile>> profile;
+  std::ifstream file(path);
+  if (file.is_open())
+  {
+    profile = std::make_unique<llvm::StringMap<SiteProfile>>();
+
+    std::string name;
+    SiteProfile counts;
+    while (file >> name >> counts.accesses >> counts.misses)
+    {
+      // The same site can be recorded more than once, e.g. when a header is in several modules.
+      SiteProfile& site = (*profile)[name];
+      site.accesses += counts.accesses;
+      site.misses += counts.misses;
+    }
+  }
+  else
+  {
+    std::cerr << "Unable to open profile " << path << ", prefetching every site" << std::endl;
+  }
+
+  return profiles.emplace(path, std::move(profile)).first->second.get();
+}
+
+struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
+
+  bool makeLoopInvariantSpec(llvm::Instruction *I, bool &Changed, llvm::Loop* L) {
+    // Test if the value is already loop-invariant.
+    if (L->isLoopInvariant(I)) {
+      return true;
+    }
+    // EH block instructions are immobile.
+    // Determine the insertion point, unless one was given.
+    if(!I) return false;
+    if(!llvm::isSafeToSpeculativelyExecute(I) && !I->mayReadFromMemory()) return false; //hacky but it works for now. This is allowed because we're hoisting what are really going to be prefetches.
+
+    llvm::BasicBlock *Preheader = L->getLoopPreheader();
+    // Without a preheader, hoisting is not feasible.
+    if (!Preheader) {
+      return false;
+    }
+    llvm::Instruction* InsertPt = Preheader->getTerminator();
+
+    // Don't hoist instructions with loop-variant operands.
+    for (llvm::Use& U : I->operands()) {
+      llvm::Instruction* i = llvm::dyn_cast_or_null<llvm::Instruction>(U.get());
+      if(!i) continue;
+
+      // Loads that might trap stay where they are, and the prefetch uses their first iteration value.
+      if(options.peel && L->contains(i) && !llvm::isSafeToSpeculativelyExecute(i)) {
+        if(llvm::Value* First = getFirstIterationValue(i, L)) {
+          U.set(First);
+          continue;
+        }
+        Changed = false;
+        return false;
+      }
+
+      if (!makeLoopInvariantSpec(i, Changed, L)) {
+        Changed = false;
+        return false;
+      }
+    }
+
+    // Hoist.
+    I->moveBefore(InsertPt);
+
+    // There is possibility of hoisting this instruction above some arbitrary
+    // condition. Any metadata defined on it can be control dependent on this
+    // condition. Conservatively strip it here so that we don't give any wrong
+    // information to the optimizer.
+
+    Changed = true;
+    return true;
+  }
+
+  bool makeLoopInvariantPredecessor(llvm::Value *V, bool &Changed, llvm::Loop* L) const {
+    //if predecessor always runs before the loop, then we can hoist invariant loads, at the expense of exception imprecision.
+    //The peel option retains precision by separating out the first iteration and reusing the invariant loads, see getFirstIterationValue.
+
+    // Test if the value is already loop-invariant.
+    if (L->isLoopInvariant(V)){
+      return true;
+    }
+
+    if(!V) return true;
+
+    llvm::Instruction* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if(!I) return false;
+
+    if (!llvm::isSafeToSpeculativelyExecute(I) && !I->mayReadFromMemory()) {
+      return false;
+    }
+
+    // EH block instructions are immobile.
+    if (I->isEHPad()) {
+      return false;
+    }
+
+    // Determine the insertion point, unless one was given.
+
+    llvm::BasicBlock *Preheader = L->getLoopPreheader();
+    // Without a preheader, hoisting is not feasible.
+    if (!Preheader) {
+      return false;
+    }
+    llvm::Instruction* InsertPt = Preheader->getTerminator();
+
+    // Don't hoist instructions with loop-variant operands.
+    for (llvm::Value *Operand : I->operands()){
+      if (!makeLoopInvariantPredecessor(Operand, Changed,L)) {
+        return false;
+      }
+    }
+
+    // Hoist.
+    I->moveBefore(InsertPt);
+
+    // There is possibility of hoisting this instruction above some arbitrary
+    // condition. Any metadata defined on it can be control dependent on this
+    // condition. Conservatively strip it here so that we don't give any wrong
+    // information to the optimizer.
+    I->dropUnknownNonDebugMetadata();
+
+    Changed = true;
+    return true;
+
+  }
+
+  // Whether Loop::makeLoopInvariant, or makeLoopInvariantPredecessor with `loads` set, would succeed
+  // on V. Nothing is moved.
+  bool canMakeLoopInvariant(llvm::Value* V, llvm::Loop* L, bool loads) const
+  {
+    if (L->isLoopInvariant(V))
+    {
+      return true;
+    }
+
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I || I->isEHPad() || !L->getLoopPreheader())
+    {
+      return false;
+    }
+
+    bool hoistable = loads ? llvm::isSafeToSpeculativelyExecute(I) || I->mayReadFromMemory()
+                           : llvm::isSafeToSpeculativelyExecute(I) && !I->mayReadFromMemory();
+    if (!hoistable)
+    {
+      return false;
+    }
+
+    return llvm::all_of(I->operands(), [&](llvm::Value* Op) { return canMakeLoopInvariant(Op, L, loads); });
+  }
+
+  // Instructions of L computing V from loop invariant values, operands first. Fails when one of them
+  // depends on the iteration, has side effects or doesn't run on every iteration that reaches the latch.
+  bool collectFirstIterationSlice(llvm::Value* V, llvm::Loop* L, llvm::SmallSetVector<llvm::Instruction*, 8>& Slice) const
+  {
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I || !L->contains(I) || Slice.count(I))
+    {
+      return true;
+    }
+
+    if (llvm::isa<llvm::PHINode>(I) || I->mayHaveSideEffects() || !L->getLoopLatch()
+        || !DT->dominates(I->getParent(), L->getLoopLatch()))
+    {
+      return false;
+    }
+
+    for (llvm::Value* Op : I->operands())
+    {
+      if (!collectFirstIterationSlice(Op, L, Slice))
+      {
+        return false;
+      }
+    }
+
+    Slice.insert(I);
+    return true;
+  }
+
+  // Whether every instruction of the header up to and including I runs whenever the loop is entered.
+  static bool runsOnEntry(llvm::Instruction* I, llvm::Loop* L)
+  {
+    if (I->getParent() != L->getHeader())
+    {
+      return false;
+    }
+
+    for (llvm::Instruction& J : *L->getHeader())
+    {
+      if (&J == I)
+      {
+        return true;
+      }
+      if (!llvm::isGuaranteedToTransferExecutionToSuccessor(&J))
+      {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  // The value V, computed inside L from loop invariant values, has on the first iteration, available
+  // before the loop. Unlike hoisting V, this never runs a load the program wouldn't run, and never
+  // moves the program's own loads out of the loop (which would be wrong when the loop stores to the
+  // same memory). When all of it is at the top of the header it is copied into the preheader, which
+  // runs exactly when the header does. Otherwise the first iteration of L is peeled off, once per
+  // loop, and V is taken from the peeled copy. With `create` unset nothing changes and V itself is
+  // returned when its first iteration value could be made.
+  llvm::Value* getFirstIterationValue(llvm::Value* V, llvm::Loop* L, bool create = true)
+  {
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I || !L->contains(I))
+    {
+      return V;
+    }
+
+    auto Found = firstValues.find(I);
+    if (Found != firstValues.end())
+    {
+      return Found->second;
+    }
+
+    llvm::SmallSetVector<llvm::Instruction*, 8> Slice;
+    llvm::BasicBlock* Preheader = L->getLoopPreheader();
+    if (!Preheader || !collectFirstIterationSlice(I, L, Slice))
+    {
+      return nullptr;
+    }
+
+    bool onEntry = llvm::all_of(Slice, [&](llvm::Instruction* J) { return runsOnEntry(J, L); });
+    if (!onEntry && (peeled.count(L) || !llvm::canPeel(L)))
+    {
+      return nullptr;
+    }
+
+    if (!create)
+    {
+      return V;
+    }
+
+    if (onEntry)
+    {
+      for (llvm::Instruction* J : Slice)
+      {
+        llvm::Instruction* Copy = J->clone();
+        Copy->insertBefore(Preheader->getTerminator());
+        for (llvm::Use& U : Copy->operands())
+        {
+          if (llvm::Value* First = firstValues.lookup(U.get()))
+          {
+            U.set(First);
+          }
+        }
+        firstValues[J] = Copy;
+      }
+      return firstValues.lookup(I);
+    }
+
+    peelFirstIteration(L);
+    return firstValues.lookup(I);
+  }
+
+  // Peels the first iteration off L and records, for every instruction of L that getFirstIterationValue
+  // could ask for, its copy in the peeled iteration. The copies are found through header phis that
+  // carry each instruction around the backedge: peeling points their entry value at the peeled copy.
+  void peelFirstIteration(llvm::Loop* L)
+  {
+    peeled.insert(L);
+
+    // Peeling rewrites the uses of L's values outside it through the LCSSA phis of its exits, which
+    // InstCombine removes when they have a single incoming value.
+    if (!L->isLCSSAForm(*DT))
+    {
+      llvm::formLCSSA(*L, *DT, Loops, SE);
+    }
+
+    llvm::BasicBlock* Latch = L->getLoopLatch();
+    llvm::SmallVector<llvm::BasicBlock*, 8> Blocks;
+    for (llvm::BasicBlock* BB : L->blocks())
+    {
+      if (DT->dominates(BB, Latch))
+      {
+        Blocks.push_back(BB);
+      }
+    }
+    llvm::sort(Blocks, [&](llvm::BasicBlock* A, llvm::BasicBlock* B) { return DT->dominates(A, B) && A != B; });
+
+    llvm::SmallSetVector<llvm::Instruction*, 8> Slice;
+    for (llvm::BasicBlock* BB : Blocks)
+    {
+      for (llvm::Instruction& I : *BB)
+      {
+        if (!I.getType()->isVoidTy() && !I.getType()->isTokenTy())
+        {
+          collectFirstIterationSlice(&I, L, Slice);
+        }
+      }
+    }
+
+    llvm::SmallVector<std::pair<llvm::Instruction*, llvm::PHINode*>, 8> Carriers;
+    llvm::BasicBlock* Preheader = L->getLoopPreheader();
+    for (llvm::Instruction* I : Slice)
+    {
+      llvm::PHINode* Carrier = llvm::PHINode::Create(I->getType(), 2, "", &L->getHeader()->front());
+      Carrier->addIncoming(llvm::PoisonValue::get(I->getType()), Preheader);
+      Carrier->addIncoming(I, Latch);
+      Carriers.push_back({I, Carrier});
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    llvm::ValueToValueMapTy VMap;
+    bool Peeled = llvm::peelLoop(L, 1, Loops, SE, *DT, nullptr, false, VMap);
+#else
+    bool Peeled = llvm::peelLoop(L, 1, Loops, SE, *DT, nullptr, false);
+#endif
+    LLVM_DEBUG(llvm::dbgs() << (Peeled ? "Peeled " : "Couldn't peel ") << L->getName() << "\n");
+
+    for (auto& Carried : Carriers)
+    {
+      if (Peeled)
+      {
+        firstValues[Carried.first] = Carried.second->getIncomingValueForBlock(L->getLoopPreheader());
+      }
+      Carried.second->eraseFromParent();
+    }
+  }
+
+  // Finds the size arguments of an allocation call, from its allocsize attribute or the list of
+  // known allocation functions.
+  bool getAllocationSizeArgs(llvm::CallBase* CB, int& sizeArg, int& countArg) const
+  {
+    llvm::Function* Callee = CB->getCalledFunction();
+
+    llvm::Attribute AllocSize = CB->getAttributes().getFnAttr(llvm::Attribute::AllocSize);
+    if (!AllocSize.isValid() && Callee)
+    {
+      AllocSize = Callee->getFnAttribute(llvm::Attribute::AllocSize);
+    }
+
+    if (AllocSize.isValid())
+    {
+      auto Args = AllocSize.getAllocSizeArgs();
+      sizeArg = Args.first;
+      countArg = Args.second ? static_cast<int>(*Args.second) : -1;
+      return true;
+    }
+
+    if (!Callee)
+    {
+      return false;
+    }
+
+    for (const AllocationFunction& AF : ALLOCATION_FUNCTIONS)
+    {
+      if (Callee->getName() == AF.name)
+      {
+        sizeArg = AF.sizeArg;
+        countArg = AF.countArg;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // The allocation call a pointer was returned by, looking through casts and through static
+  // globals that are only ever assigned the result of a single allocation.
+  llvm::CallBase* getAllocationCall(llvm::Value* ptr) const
+  {
+    ptr = ptr->stripPointerCasts();
+
+    if (auto* LI = llvm::dyn_cast<llvm::LoadInst>(ptr))
+    {
+      auto* G = llvm::dyn_cast<llvm::GlobalVariable>(LI->getPointerOperand()->stripPointerCasts());
+      if (!G || !G->hasLocalLinkage() || LI->isVolatile())
+      {
+        return nullptr;
+      }
+
+      llvm::Value* Stored = nullptr;
+      for (llvm::User* U : G->users())
+      {
+        if (llvm::isa<llvm::LoadInst>(U))
+        {
+          continue;
+        }
+
+        auto* SI = llvm::dyn_cast<llvm::StoreInst>(U);
+        if (!SI || SI->getPointerOperand() != G || Stored)
+        {
+          return nullptr;
+        }
+        Stored = SI->getValueOperand();
+      }
+
+      if (!Stored)
+      {
+        return nullptr;
+      }
+      ptr = Stored->stripPointerCasts();
+    }
+
+    auto* CB = llvm::dyn_cast<llvm::CallBase>(ptr);
+    int sizeArg, countArg;
+    if (!CB || !getAllocationSizeArgs(CB, sizeArg, countArg))
+    {
+      return nullptr;
+    }
+
+    return CB;
+  }
+
+  // Whether the size arguments of CB can be used ahead of L: constants, or values of this
+  // function that are available before the loop is entered.
+  bool isAllocationSizeAvailable(llvm::CallBase* CB, llvm::Loop* L) const
+  {
+    int sizeArg, countArg;
+    getAllocationSizeArgs(CB, sizeArg, countArg);
+
+    if (llvm::isa<llvm::Constant>(CB->getArgOperand(sizeArg))
+        && (countArg < 0 || llvm::isa<llvm::Constant>(CB->getArgOperand(countArg))))
+    {
+      return true;
+    }
+
+    llvm::BasicBlock* Entering = L->getLoopPredecessor();
+    return Entering && CB->getFunction() == Entering->getParent()
+           && DT->dominates(CB, Entering->getTerminator());
+  }
+
+  // Element count of the heap allocation a single-index GEP reads from, or nullptr.
+  llvm::Value* getAllocationElementCount(llvm::GetElementPtrInst* gep, llvm::Loop* L, bool create) const
+  {
+    if (gep->getNumIndices() != 1 || !gep->getSourceElementType()->isSized())
+    {
+      return nullptr;
+    }
+
+    llvm::CallBase* CB = getAllocationCall(gep->getPointerOperand());
+    if (!CB || !isAllocationSizeAvailable(CB, L))
+    {
+      return nullptr;
+    }
+
+    uint64_t elemSize = llvm_module->getDataLayout().getTypeAllocSize(gep->getSourceElementType());
+    if (elemSize == 0)
+    {
+      return nullptr;
+    }
+
+    LLVM_DEBUG(llvm::dbgs() << " allocated by " << *CB << "\n");
+
+    if (!create)
+    {
+      return CB;
+    }
+
+    int sizeArg, countArg;
+    getAllocationSizeArgs(CB, sizeArg, countArg);
+
+    // Sizes of allocations made elsewhere are constants, which the builder folds.
+    llvm::IRBuilder<> Builder(L->getLoopPredecessor()->getTerminator());
+    llvm::Value* bytes = CB->getArgOperand(sizeArg);
+    if (countArg >= 0)
+    {
+      llvm::Value* count = Builder.CreateZExtOrTrunc(CB->getArgOperand(countArg), bytes->getType());
+      bytes = Builder.CreateMul(bytes, count);
+    }
+
+    return Builder.CreateUDiv(bytes, llvm::ConstantInt::get(bytes->getType(), elemSize));
+  }
+
+  // Element count of the stack allocation a GEP reads from, in elements of the GEP's source type. The
+  // array size of `alloca [N x T]` is 1, so the count comes from the bytes allocated.
+  llvm::Value* getAllocaElementCount(llvm::AllocaInst* ai, llvm::GetElementPtrInst* gep, llvm::Loop* L, bool create) const
+  {
+    const llvm::DataLayout& DL = llvm_module->getDataLayout();
+    if (!gep->getSourceElementType()->isSized() || !ai->getAllocatedType()->isSized()
+        || DL.getTypeAllocSize(gep->getSourceElementType()).isScalable() || DL.getTypeAllocSize(ai->getAllocatedType()).isScalable())
+    {
+      return nullptr;
+    }
+
+    uint64_t elemSize = DL.getTypeAllocSize(gep->getSourceElementType()).getFixedValue();
+    uint64_t allocated = DL.getTypeAllocSize(ai->getAllocatedType()).getFixedValue();
+    if (elemSize == 0 || allocated == 0)
+    {
+      return nullptr;
+    }
+
+    llvm::Type* Int64 = llvm::Type::getInt64Ty(llvm_module->getContext());
+    if (auto* count = llvm::dyn_cast<llvm::ConstantInt>(ai->getArraySize()))
+    {
+      uint64_t elements = allocated * count->getZExtValue() / elemSize;
+      return elements ? llvm::ConstantInt::get(Int64, elements) : nullptr;
+    }
+
+    llvm::BasicBlock* Entering = L->getLoopPredecessor();
+    if (!Entering || !DT->dominates(ai, Entering->getTerminator()))
+    {
+      return nullptr;
+    }
+    if (!create)
+    {
+      return ai;
+    }
+
+    llvm::IRBuilder<> Builder(Entering->getTerminator());
+    llvm::Value* bytes = Builder.CreateMul(Builder.CreateZExtOrTrunc(ai->getArraySize(), Int64), llvm::ConstantInt::get(Int64, allocated));
+    return Builder.CreateUDiv(bytes, llvm::ConstantInt::get(Int64, elemSize));
+  }
+
+  // Number of elements in the array a load indexes into: a static array type, an alloca or a heap
+  // allocation. Runtime sizes are computed before L is entered; with `create` false nothing is
+  // inserted and the result only says whether a size is known.
+  llvm::Value* getArrayOrAllocSize(llvm::LoadInst* l, llvm::Loop* L, bool create = true) const
+  {
+    LLVM_DEBUG(llvm::dbgs() << "attempting to get size of base array:\n");
+    LLVM_DEBUG(l->getPointerOperand()->print(llvm::dbgs()));
+
+    llvm::GetElementPtrInst* gep = llvm::dyn_cast<llvm::GetElementPtrInst>(l->getPointerOperand());
+
+    if (!gep)
+    {
+      LLVM_DEBUG(llvm::dbgs() << "Couldn't find gep \n");
+      return nullptr;
+    }
+
+    LLVM_DEBUG(llvm::dbgs() << " with ptr: ");
+    LLVM_DEBUG(gep->getPointerOperand()->print(llvm::dbgs()));
+
+    auto ArrayStart = gep->getPointerOperand();
+    
+    if(llvm::ArrayType* at = llvm::dyn_cast<llvm::ArrayType>(gep->getSourceElementType())) 
+    {
+      LLVM_DEBUG(llvm::dbgs() << " and size: ");
+      LLVM_DEBUG(llvm::dbgs() << std::to_string(at->getNumElements()));
+
+      int size = at->getNumElements();
+
+      LLVM_DEBUG(llvm::dbgs() << "and type: " << *(at->getElementType ()));
+
+      return llvm::ConstantInt::get(llvm::Type::getInt64Ty(llvm_module->getContext()), size);
+    }
+    else if(llvm::AllocaInst* ai = llvm::dyn_cast<llvm::AllocaInst>(ArrayStart->stripPointerCasts())) 
+    {
+      LLVM_DEBUG(llvm::dbgs() << "and dynamic allocated size " << *(ai->getArraySize()));
+      LLVM_DEBUG(llvm::dbgs() << *(ai->getArraySize ()));
+
+      LLVM_DEBUG(llvm::dbgs() << "and type: ");
+      LLVM_DEBUG(llvm::dbgs() << *(gep->getSourceElementType ()));
+
+      return getAllocaElementCount(ai, gep, L, create);
+    }
+
+    return getAllocationElementCount(gep, L, create);
+  }
+
+  // Operand of gep holding the element index a chain guard checks: the only index, or the second
+  // one of a static array indexed from its start. 0 when there is no such index.
+  static unsigned getGuardedIndexOperand(llvm::GetElementPtrInst* gep)
+  {
+    unsigned op = 0;
+    if (gep->getNumIndices() == 1)
+    {
+      op = 1;
+    }
+    else if (gep->getNumIndices() == 2 && llvm::isa<llvm::ArrayType>(gep->getSourceElementType()))
+    {
+      auto* C = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(1));
+      op = C && C->isZero() ? 2 : 0;
+    }
+    return op && gep->getOperand(op)->getType()->isIntegerTy() ? op : 0;
+  }
+
+  // Elements of the array a load of a guarded chain indexes: its known size, or the guard-bound option.
+  llvm::Value* getGuardSize(llvm::LoadInst* l, llvm::Loop* L, bool create = true) const
+  {
+    if (llvm::Value* size = getArrayOrAllocSize(l, L, create))
+    {
+      return size;
+    }
+    if (options.guardChains && options.guardBound > 0)
+    {
+      return llvm::ConstantInt::get(llvm::Type::getInt64Ty(llvm_module->getContext()), options.guardBound);
+    }
+    return nullptr;
+  }
+
+  // Whether every load of a slice between the one indexed by the induction variable and the
+  // prefetched access can be guarded.
+  bool canGuardChain(llvm::ArrayRef<llvm::Instruction*> Slice, llvm::Instruction* target, llvm::LoadInst* firstLoad, llvm::Loop* L) const
+  {
+    for (llvm::Instruction* I : Slice)
+    {
+      if (isGather(I) && I != target)
+      {
+        LLVM_DEBUG(llvm::dbgs() << "Can't guard " << *I << "\n");
+        return false;
+      }
+
+      auto* l = llvm::dyn_cast<llvm::LoadInst>(I);
+      if (!l || l == target || l == firstLoad)
+      {
+        continue;
+      }
+
+      auto* gep = llvm::dyn_cast<llvm::GetElementPtrInst>(l->getPointerOperand());
+      if (!gep || !getGuardedIndexOperand(gep) || !getGuardSize(l, L, false))
+      {
+        LLVM_DEBUG(llvm::dbgs() << "Can't guard " << *l << "\n");
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Keeps the index of a cloned intermediate load inside its array. Indices out of range, negative
+  // ones included by comparing unsigned, read element 0 instead, so the load never faults.
+  void createChainGuard(llvm::GetElementPtrInst* gep, llvm::Value* size) const
+  {
+    unsigned op = getGuardedIndexOperand(gep);
+    llvm::IRBuilder<> Builder(gep);
+    llvm::Value* index = gep->getOperand(op);
+    llvm::Value* bound = Builder.CreateZExtOrTrunc(size, index->getType());
+    llvm::Value* inside = Builder.CreateICmpULT(index, bound);
+    gep->setOperand(op, Builder.CreateSelect(inside, index, llvm::Constant::getNullValue(index->getType())));
+  }
+
+  // `create` unset only checks that a bound can be made: nothing is hoisted and the returned value
+  // may still be inside L. With the peel option, see also getFirstIterationValue.
+  llvm::Value* getCanonicalishSizeVariable(llvm::Loop* L, bool create = true)
+  {
+    // Loop over all of the PHI nodes, looking for a canonical indvar.
+    auto B = L->getExitingBlock();
+    
+    if(!B)
+    {
+      return nullptr;
+    }
+
+    llvm::CmpInst* CI = nullptr;
+
+    //really, should be reverse dataflow from the terminating jump
+    for (llvm::Instruction& J : *B)
+    {
+      llvm::Instruction* I = &J;
+      CI = llvm::dyn_cast<llvm::CmpInst>(I) ? llvm::dyn_cast<llvm::CmpInst>(I) : CI;
+    }
+
+    // The bound is only meaningful when it is compared against an induction variable.
+    auto isInduction = [&](llvm::Value* V) {
+      if (!SE->isSCEVable(V->getType()))
+      {
+        return false;
+      }
+      auto* AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(SE->getSCEV(V));
+      return AR && AR->getLoop() == L;
+    };
+
+    if (CI && !isInduction(CI->getOperand(0)) && !isInduction(CI->getOperand(1)))
+    {
+      LLVM_DEBUG(llvm::dbgs() << "Exit comparison doesn't test an induction variable " << *CI << "\n");
+      return nullptr;
+    }
+
+    bool Changed = false;
+    auto hoist = [&](llvm::Value* V, bool loads) {
+      if (!create)
+      {
+        return canMakeLoopInvariant(V, L, loads);
+      }
+      return L->makeLoopInvariant(V, Changed) || (loads && makeLoopInvariantPredecessor(V, Changed, L));
+    };
+
+    if (CI && options.peel)
+    {
+      for (unsigned op : {1u, 0u})
+      {
+        if (hoist(CI->getOperand(op), false))
+        {
+          return CI->getOperand(op);
+        }
+        if (llvm::Value* First = getFirstIterationValue(CI->getOperand(op), L, create))
+        {
+          return First;
+        }
+      }
+
+      LLVM_DEBUG(llvm::dbgs() << "No first iteration bound " << *CI << "\n");
+    }
+    else if (CI)
+    {
+      if(hoist(CI->getOperand(1), true))
+      {
+        return CI->getOperand(1);
+      }
+
+      if(hoist(CI->getOperand(0), true))
+      {
+        return CI->getOperand(0);
+      }
+
+      LLVM_DEBUG(llvm::dbgs() << "Size not loop invariant!" << *(CI->getOperand(0)) << *(CI->getOperand(1)) << "\n");
+    }
+
+    return nullptr;
+  }
+
+  // Returns the per-iteration step of PN if it is an affine induction variable of L, and nullptr otherwise.
+  // ScalarEvolution recognises integer and pointer induction variables of any direction and step, in
+  // rotated and multi-latch loops alike, e.g. count-down loops and the unrolled `k += 8` loops of CG.
+  const llvm::SCEV* getInductionStep(llvm::PHINode* PN, llvm::Loop* L) const
+  {
+    if (!L || PN->getParent() != L->getHeader() || !SE->isSCEVable(PN->getType()))
+    {
+      return nullptr;
+    }
+
+    auto* AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(SE->getSCEV(PN));
+    if (!AR || AR->getLoop() != L || !AR->isAffine())
+    {
+      return nullptr;
+    }
+
+    const llvm::SCEV* Step = AR->getStepRecurrence(*SE);
+    if (Step->isZero())
+    {
+      return nullptr;
+    }
+
+    return Step;
+  }
+
+  bool isInductionVariable(llvm::PHINode* PN, llvm::Loop* L) const
+  {
+    return getInductionStep(PN, L) != nullptr;
+  }
+
+  llvm::PHINode* getCanonicalishInductionVariable(llvm::Loop* L) const
+  {
+    for (llvm::PHINode& PN : L->getHeader()->phis())
+    {
+      if (PN.getType()->isIntegerTy() && isInductionVariable(&PN, L))
+      {
+        return &PN;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // This covers code where a pointer is incremented, instead of a canonical induction variable.
+  llvm::PHINode* getWeirdCanonicalishInductionVariable(llvm::Loop* L) const
+  {
+    for (llvm::PHINode& PN : L->getHeader()->phis())
+    {
+      if (PN.getType()->isPointerTy() && isInductionVariable(&PN, L))
+      {
+        return &PN;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // Value of a header phi on entry to the loop. Any number of latches is fine, but the loop must be
+  // entered from a single block.
+  llvm::Value* getOddPhiFirst(llvm::Loop* L, llvm::PHINode* PN) const
+  {
+    if (!L || L->getHeader() != PN->getParent())
+    {
+      return nullptr;
+    }
+
+    llvm::BasicBlock* Incoming = L->getLoopPredecessor();
+    if (!Incoming)
+    {
+      return nullptr;
+    }
+
+    return PN->getIncomingValueForBlock(Incoming);
+  }
+
+  // Value of the induction variable PN `offset` iterations ahead, inserted at Builder's insertion point.
+  // A loop-invariant, non-constant step is expanded in the preheader.
+  llvm::Value* createLookAhead(llvm::IRBuilder<>& Builder, llvm::PHINode* PN, llvm::Loop* L, int offset) const
+  {
+    const llvm::SCEV* Step = getInductionStep(PN, L);
+    assert(Step);
+
+    const llvm::SCEV* Distance = SE->getMulExpr(Step, SE->getConstant(Step->getType(), offset, true));
+
+    llvm::Value* Ahead = nullptr;
+    if (auto* C = llvm::dyn_cast<llvm::SCEVConstant>(Distance))
+    {
+      Ahead = C->getValue();
+    }
+    else
+    {
+      llvm::BasicBlock* Preheader = L->getLoopPredecessor();
+      llvm::Instruction* InsertPt = Preheader ? Preheader->getTerminator() : &*Builder.GetInsertPoint();
+      llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+      Ahead = Expander.expandCodeFor(Distance, Distance->getType(), InsertPt);
+    }
+
+    return applyLookAhead(Builder, PN, Ahead);
+  }
+
+  // The same with an offset that is only known at run time, loaded in the preheader of L.
+  llvm::Value* createLookAhead(llvm::IRBuilder<>& Builder, llvm::PHINode* PN, llvm::Loop* L, llvm::Value* offset) const
+  {
+    const llvm::SCEV* Step = getInductionStep(PN, L);
+    assert(Step);
+
+    llvm::Instruction* InsertPt = llvm::cast<llvm::Instruction>(offset)->getNextNode();
+    llvm::IRBuilder<> PreheaderBuilder(InsertPt);
+    const llvm::SCEV* Distance = SE->getMulExpr(Step, SE->getSCEV(PreheaderBuilder.CreateSExtOrTrunc(offset, Step->getType())));
+
+    llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+    llvm::Value* Ahead = Expander.expandCodeFor(Distance, Distance->getType(), InsertPt);
+    return applyLookAhead(Builder, PN, Ahead);
+  }
+
+  llvm::Value* applyLookAhead(llvm::IRBuilder<>& Builder, llvm::PHINode* PN, llvm::Value* Ahead) const
+  {
+    if (PN->getType()->isPointerTy())
+    {
+      // The step of a pointer induction variable is in bytes.
+      llvm::Type* BytePtr = llvm::Type::getInt8PtrTy(llvm_module->getContext(), PN->getType()->getPointerAddressSpace());
+      llvm::Value* Base = Builder.CreateBitCast(PN, BytePtr);
+      llvm::Value* Gep = Builder.CreateGEP(llvm::Type::getInt8Ty(llvm_module->getContext()), Base, Ahead);
+      return Builder.CreateBitCast(Gep, PN->getType());
+    }
+
+    return Builder.CreateAdd(PN, Builder.CreateSExtOrTrunc(Ahead, PN->getType()));
+  }
+
+  // Keeps a look-ahead index inside the loop bound: below `bound` when counting up, and no lower
+  // than `bound` when counting down, where `bound` is the lower end of the loop or of the array.
+  llvm::Instruction* createClamp(llvm::IRBuilder<>& Builder, llvm::Value* ahead, llvm::Value* bound, bool countsDown) const
+  {
+    if (countsDown)
+    {
+      llvm::Value* cmp = Builder.CreateICmp(llvm::CmpInst::ICMP_SGT, bound, ahead);
+      return llvm::dyn_cast<llvm::Instruction>(Builder.CreateSelect(cmp, bound, ahead));
+    }
+
+    llvm::Value* sub = Builder.CreateSub(bound, llvm::ConstantInt::get(ahead->getType(), 1));
+    llvm::Value* cmp = Builder.CreateICmp(llvm::CmpInst::ICMP_SLT, sub, ahead);
+    return llvm::dyn_cast<llvm::Instruction>(Builder.CreateSelect(cmp, sub, ahead));
+  }
+
+  bool isSafeToExpandAt(const llvm::SCEV* S, llvm::Instruction* InsertPt) const
+  {
+#if LLVM_VERSION_MAJOR >= 15
+    llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+    return Expander.isSafeToExpandAt(S, InsertPt);
+#else
+    return llvm::isSafeToExpandAt(S, InsertPt, *SE);
+#endif
+  }
+
+  // SCEV of the value PN takes on the last iteration that runs the body of L, or nullptr if
+  // ScalarEvolution cannot bound the trip count or the value cannot be computed ahead of the loop.
+  const llvm::SCEV* getLastInductionSCEV(llvm::PHINode* PN, llvm::Loop* L) const
+  {
+    llvm::BasicBlock* Preheader = L->getLoopPredecessor();
+    if (!Preheader || !isInductionVariable(PN, L))
+    {
+      return nullptr;
+    }
+
+    const llvm::SCEV* BTC = SE->getSymbolicMaxBackedgeTakenCount(L);
+    if (llvm::isa<llvm::SCEVCouldNotCompute>(BTC))
+    {
+      LLVM_DEBUG(llvm::dbgs() << "No backedge-taken count for " << *PN << "\n");
+      return nullptr;
+    }
+
+    // A rotated loop runs its body on every iteration the backedge count allows, while a loop that
+    // is left from the header runs the body once less. Anything else depends on where the loads are.
+    llvm::BasicBlock* Exiting = L->getExitingBlock();
+    if (Exiting && Exiting == L->getHeader() && Exiting != L->getLoopLatch())
+    {
+      BTC = SE->getMinusSCEV(BTC, SE->getOne(BTC->getType()));
+    }
+    else if (!Exiting || Exiting != L->getLoopLatch())
+    {
+      LLVM_DEBUG(llvm::dbgs() << "Loop not exited from its header or latch " << *PN << "\n");
+      return nullptr;
+    }
+
+    auto* AR = llvm::cast<llvm::SCEVAddRecExpr>(SE->getSCEV(PN));
+    const llvm::SCEV* Last = AR->evaluateAtIteration(BTC, *SE);
+
+    if (!isSafeToExpandAt(Last, Preheader->getTerminator()))
+    {
+      LLVM_DEBUG(llvm::dbgs() << "Last value not expandable: " << *Last << "\n");
+      return nullptr;
+    }
+
+    return Last;
+  }
+
+  // Materialises the last value of PN in the block entering L, once per induction variable.
+  llvm::Value* getLastInductionValue(llvm::PHINode* PN, llvm::Loop* L)
+  {
+    auto Found = lastValues.find(PN);
+    if (Found != lastValues.end())
+    {
+      return Found->second;
+    }
+
+    llvm::Value* Last = nullptr;
+    if (const llvm::SCEV* S = getLastInductionSCEV(PN, L))
+    {
+      llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+      Last = Expander.expandCodeFor(S, PN->getType(), L->getLoopPredecessor()->getTerminator());
+    }
+
+    lastValues[PN] = Last;
+    return Last;
+  }
+
+  // Keeps a look-ahead value between the current value and `last`, the value of the induction
+  // variable on the final iteration. Works for integer and pointer induction variables.
+  llvm::Instruction* createClampToLast(llvm::IRBuilder<>& Builder, llvm::Value* ahead, llvm::Value* last, bool countsDown) const
+  {
+    bool isPointer = ahead->getType()->isPointerTy();
+    llvm::CmpInst::Predicate pred = countsDown
+      ? (isPointer ? llvm::CmpInst::ICMP_UGT : llvm::CmpInst::ICMP_SGT)
+      : (isPointer ? llvm::CmpInst::ICMP_ULT : llvm::CmpInst::ICMP_SLT);
+
+    llvm::Value* cmp = Builder.CreateICmp(pred, last, ahead);
+    return llvm::dyn_cast<llvm::Instruction>(Builder.CreateSelect(cmp, last, ahead));
+  }
+
+  // Whether an induction variable at `value` hasn't passed `bound` yet. The same comparisons as
+  // createClampToLast, but inclusive.
+  llvm::Value* createNotPast(llvm::IRBuilder<>& Builder, llvm::Value* value, llvm::Value* bound, bool countsDown) const
+  {
+    bool isPointer = value->getType()->isPointerTy();
+    llvm::CmpInst::Predicate pred = countsDown
+      ? (isPointer ? llvm::CmpInst::ICMP_UGE : llvm::CmpInst::ICMP_SGE)
+      : (isPointer ? llvm::CmpInst::ICMP_ULE : llvm::CmpInst::ICMP_SLE);
+
+    return Builder.CreateICmp(pred, value, bound);
+  }
+
+  // Runs the last `offset` iterations of L in a copy of the loop that is made before any prefetch is
+  // inserted, so the look-ahead index of every iteration left in L stays within the last value of IV
+  // and needs no clamp. The CFG becomes
+  //
+  //   preheader:  br (split doesn't wrap && start not past split), L, epilogue.preheader
+  //   L:          ... the original exit, plus a latch that leaves for the epilogue once IV passes split
+  //   epilogue:   a copy of L entered with the values IV and the other header phis had when L stopped
+  //
+  // where split = last - offset * step. Only innermost loops with a single exit from the latch are
+  // split, and they are put into LCSSA form first so the exit's phis can take values from both loops.
+  bool splitEpilogue(llvm::Loop* L, llvm::PHINode* IV, int offset, llvm::LoopInfo& LI)
+  {
+    llvm::BasicBlock* Preheader = L->getLoopPreheader();
+    llvm::BasicBlock* Header = L->getHeader();
+    llvm::BasicBlock* Latch = L->getLoopLatch();
+    llvm::BasicBlock* Exit = L->getExitBlock();
+    if (!L->isInnermost() || !Preheader || !Latch || !Exit || L->getExitingBlock() != Latch || !L->hasDedicatedExits())
+    {
+      return false;
+    }
+
+    const llvm::SCEV* Step = getInductionStep(IV, L);
+    const llvm::SCEV* Last = getLastInductionSCEV(IV, L);
+    if (!Step || !Last || (!SE->isKnownNegative(Step) && !SE->isKnownPositive(Step)))
+    {
+      return false;
+    }
+    bool countsDown = SE->isKnownNegative(Step);
+
+    const llvm::SCEV* Distance = SE->getMulExpr(Step, SE->getConstant(Step->getType(), offset, true));
+    const llvm::SCEV* Split = SE->getMinusSCEV(Last, Distance);
+    if (!isSafeToExpandAt(Split, Preheader->getTerminator()))
+    {
+      return false;
+    }
+
+    if (!L->isLCSSAForm(*DT))
+    {
+      llvm::formLCSSA(*L, *DT, &LI, SE);
+    }
+
+    llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+    llvm::Value* LastValue = Expander.expandCodeFor(Last, IV->getType(), Preheader->getTerminator());
+    llvm::Value* SplitValue = Expander.expandCodeFor(Split, IV->getType(), Preheader->getTerminator());
+
+    // An empty block to enter L from, whose copy becomes the epilogue's preheader.
+    llvm::BasicBlock* Entry = llvm::SplitEdge(Preheader, Header, DT, &LI);
+
+    llvm::ValueToValueMapTy VMap;
+    llvm::SmallVector<llvm::BasicBlock*, 8> Blocks;
+    llvm::cloneLoopWithPreheader(Exit, Preheader, L, VMap, ".epilogue", &LI, DT, Blocks);
+    llvm::remapInstructionsInBlocks(Blocks, VMap);
+
+    auto* EpilogueEntry = llvm::cast<llvm::BasicBlock>(VMap[Entry]);
+    auto* EpilogueLatch = llvm::cast<llvm::BasicBlock>(VMap[Latch]);
+    markPrefetched(EpilogueLatch);
+
+    for (llvm::PHINode& PN : Exit->phis())
+    {
+      llvm::Value* V = PN.getIncomingValueForBlock(Latch);
+      llvm::Value* Mapped = VMap.lookup(V);
+      PN.addIncoming(Mapped ? Mapped : V, EpilogueLatch);
+    }
+
+    llvm::IRBuilder<> Builder(Preheader->getTerminator());
+    llvm::Value* Start = IV->getIncomingValueForBlock(Entry);
+    llvm::Value* Enter = Builder.CreateAnd(createNotPast(Builder, SplitValue, LastValue, countsDown),
+                                           createNotPast(Builder, Start, SplitValue, countsDown));
+    Builder.CreateCondBr(Enter, Entry, EpilogueEntry);
+    Preheader->getTerminator()->eraseFromParent();
+
+    llvm::BasicBlock* Check = llvm::SplitEdge(Latch, Header, DT, &LI);
+    Builder.SetInsertPoint(Check->getTerminator());
+    Builder.CreateCondBr(createNotPast(Builder, IV->getIncomingValueForBlock(Check), SplitValue, countsDown),
+                         Header, EpilogueEntry);
+    Check->getTerminator()->eraseFromParent();
+
+    // The epilogue continues from wherever L stopped, or from the start when L is skipped.
+    Builder.SetInsertPoint(EpilogueEntry, EpilogueEntry->begin());
+    for (llvm::PHINode& PN : Header->phis())
+    {
+      llvm::PHINode* Resume = Builder.CreatePHI(PN.getType(), 2, PN.getName() + ".resume");
+      Resume->addIncoming(PN.getIncomingValueForBlock(Entry), Preheader);
+      Resume->addIncoming(PN.getIncomingValueForBlock(Check), Check);
+      llvm::cast<llvm::PHINode>(VMap[&PN])->setIncomingValueForBlock(EpilogueEntry, Resume);
+    }
+
+    DT->recalculate(*Header->getParent());
+    SE->forgetLoop(L);
+    return true;
+  }
+
+  // adaptive: L is versioned on the prefetch flag of its descriptor, which the runtime clears when
+  // prefetching makes the loop slower, and the copy without prefetches runs instead. Both versions
+  // call the runtime when they are entered and left, so it can time them. Returns the loads of the
+  // look-ahead of each site, in the block that enters the prefetching version, or nothing when L
+  // doesn't have the shape to be versioned.
+  std::vector<llvm::Value*> createAdaptiveLoop(llvm::Loop* L, const std::string& name, llvm::ArrayRef<int> initial,
+                                               llvm::LoopInfo& LI)
+  {
+    if (initial.empty() || (!L->getLoopPreheader() && !llvm::InsertPreheaderForLoop(L, DT, &LI, nullptr, true)))
+    {
+      return {};
+    }
+    if (!L->hasDedicatedExits() && !llvm::formDedicatedExitBlocks(L, DT, &LI, nullptr, true))
+    {
+      return {};
+    }
+    llvm::BasicBlock* Preheader = L->getLoopPreheader();
+    llvm::BasicBlock* Header = L->getHeader();
+
+    if (!L->isLCSSAForm(*DT))
+    {
+      llvm::formLCSSA(*L, *DT, &LI, SE);
+    }
+
+    llvm::LLVMContext& Ctx = llvm_module->getContext();
+    llvm::IRBuilder<> Builder(Preheader->getTerminator());
+    llvm::Type* I32 = Builder.getInt32Ty();
+    llvm::Type* I64 = Builder.getInt64Ty();
+    llvm::PointerType* Ptr = Builder.getInt8PtrTy();
+
+    // Iterations of this entry, when ScalarEvolution knows them, so the runtime can compare the
+    // cost per iteration. 0 makes it compare the cost per entry instead.
+    llvm::Value* Iterations = Builder.getInt64(0);
+    const llvm::SCEV* BTC = SE->getBackedgeTakenCount(L);
+    if (!llvm::isa<llvm::SCEVCouldNotCompute>(BTC) && BTC->getType()->isIntegerTy())
+    {
+      const llvm::SCEV* Count = SE->getAddExpr(SE->getTruncateOrZeroExtend(BTC, I64), SE->getOne(I64));
+      if (isSafeToExpandAt(Count, Preheader->getTerminator()))
+      {
+        llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+        Iterations = Expander.expandCodeFor(Count, I64, Preheader->getTerminator());
+      }
+    }
+
+    // struct swpf_loop in adaptiveRuntime/swPrefetchAdaptive.c.
+    llvm::StructType* DescTy = llvm::StructType::get(Ctx, {I32, I32, Ptr, Ptr, Ptr, Ptr});
+    llvm::ArrayType* OffsetsTy = llvm::ArrayType::get(I32, initial.size());
+    std::vector<llvm::Constant*> Values;
+    for (int offset : initial)
+    {
+      Values.push_back(llvm::ConstantInt::get(I32, offset));
+    }
+    llvm::Constant* Init = llvm::ConstantArray::get(OffsetsTy, Values);
+
+    auto* Offsets = new llvm::GlobalVariable(*llvm_module, OffsetsTy, false, llvm::GlobalValue::InternalLinkage,
+                                             Init, "swpf.offsets");
+    auto* Initial = new llvm::GlobalVariable(*llvm_module, OffsetsTy, true, llvm::GlobalValue::PrivateLinkage,
+                                             Init, "swpf.initial");
+    llvm::Constant* NameData = llvm::ConstantDataArray::getString(Ctx, name);
+    auto* Name = new llvm::GlobalVariable(*llvm_module, NameData->getType(), true, llvm::GlobalValue::PrivateLinkage,
+                                          NameData, "swpf.name");
+    auto* Desc = new llvm::GlobalVariable(
+        *llvm_module, DescTy, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantStruct::get(DescTy, {llvm::ConstantInt::get(I32, 1), llvm::ConstantInt::get(I32, initial.size()),
+                                           llvm::ConstantExpr::getPointerCast(Offsets, Ptr),
+                                           llvm::ConstantExpr::getPointerCast(Initial, Ptr),
+                                           llvm::ConstantExpr::getPointerCast(Name, Ptr),
+                                           llvm::ConstantPointerNull::get(Ptr)}),
+        "swpf.loop");
+    llvm::Constant* DescPtr = llvm::ConstantExpr::getPointerCast(Desc, Ptr);
+
+    // An empty block to enter L from, whose copy enters the version without prefetches.
+    llvm::BasicBlock* Entry = llvm::SplitEdge(Preheader, Header, DT, &LI);
+
+    llvm::ValueToValueMapTy VMap;
+    llvm::SmallVector<llvm::BasicBlock*, 8> Blocks;
+    llvm::cloneLoopWithPreheader(Entry, Preheader, L, VMap, ".noprefetch", &LI, DT, Blocks);
+    llvm::remapInstructionsInBlocks(Blocks, VMap);
+    for (llvm::Loop* Inner : L->getLoopsInPreorder())
+    {
+      if (llvm::BasicBlock* InnerLatch = Inner->getLoopLatch())
+      {
+        markPrefetched(llvm::cast<llvm::BasicBlock>(VMap[InnerLatch]));
+      }
+    }
+
+    llvm::SmallVector<llvm::BasicBlock*, 4> Exits;
+    L->getUniqueExitBlocks(Exits);
+    for (llvm::BasicBlock* Exit : Exits)
+    {
+      for (llvm::PHINode& PN : Exit->phis())
+      {
+        for (unsigned k = 0, e = PN.getNumIncomingValues(); k < e; k++)
+        {
+          llvm::BasicBlock* From = PN.getIncomingBlock(k);
+          if (L->contains(From))
+          {
+            llvm::Value* V = PN.getIncomingValue(k);
+            llvm::Value* Mapped = VMap.lookup(V);
+            PN.addIncoming(Mapped ? Mapped : V, llvm::cast<llvm::BasicBlock>(VMap[From]));
+          }
+        }
+      }
+
+      llvm::IRBuilder<> ExitBuilder(&*Exit->getFirstInsertionPt());
+      ExitBuilder.CreateCall(llvm_module->getOrInsertFunction("__swpf_loop_exit", Builder.getVoidTy(), Ptr), {DescPtr});
+    }
+
+    Builder.SetInsertPoint(Preheader->getTerminator());
+    Builder.CreateCall(llvm_module->getOrInsertFunction("__swpf_loop_enter", Builder.getVoidTy(), Ptr, I64),
+                       {DescPtr, Iterations});
+    llvm::Value* Prefetch = Builder.CreateLoad(I32, Builder.CreateStructGEP(DescTy, Desc, 0), "swpf.prefetch");
+    Builder.CreateCondBr(Builder.CreateICmpNE(Prefetch, Builder.getInt32(0)), Entry,
+                         llvm::cast<llvm::BasicBlock>(VMap[Entry]));
+    Preheader->getTerminator()->eraseFromParent();
+
+    Builder.SetInsertPoint(Entry->getTerminator());
+    std::vector<llvm::Value*> Loaded;
+    for (unsigned k = 0; k < initial.size(); k++)
+    {
+      Loaded.push_back(Builder.CreateLoad(I32, Builder.CreateConstInBoundsGEP2_32(OffsetsTy, Offsets, 0, k), "swpf.offset"));
+    }
+
+    DT->recalculate(*Header->getParent());
+    SE->forgetLoop(L);
+    return Loaded;
+  }
+
+  // distance-table: the look-ahead of `site` lives in a global of its own, listed with the site's
+  // name in the swpf_sites section, where the distance runtime finds it and applies the overrides
+  // of the environment at startup. Returns its load in the preheader of L.
+  llvm::Value* createTableOffset(const std::string& site, int offset, llvm::Loop* L, llvm::LoopInfo& LI)
+  {
+    if (!L->getLoopPreheader() && !llvm::InsertPreheaderForLoop(L, DT, &LI, nullptr, true))
+    {
+      return nullptr;
+    }
+
+    llvm::LLVMContext& Ctx = llvm_module->getContext();
+    llvm::IRBuilder<> Builder(L->getLoopPreheader()->getTerminator());
+    llvm::PointerType* Ptr = Builder.getInt8PtrTy();
+
+    auto* Distance = new llvm::GlobalVariable(*llvm_module, Builder.getInt32Ty(), false, llvm::GlobalValue::InternalLinkage,
+                                              Builder.getInt32(offset), "swpf.distance");
+    llvm::Constant* NameData = llvm::ConstantDataArray::getString(Ctx, site);
+    auto* Name = new llvm::GlobalVariable(*llvm_module, NameData->getType(), true, llvm::GlobalValue::PrivateLinkage,
+                                          NameData, "swpf.name");
+
+    // struct swpf_site in distanceRuntime/swPrefetchDistances.c.
+    llvm::StructType* SiteTy = llvm::StructType::get(Ctx, {Ptr, Ptr});
+    auto* Entry = new llvm::GlobalVariable(*llvm_module, SiteTy, true, llvm::GlobalValue::PrivateLinkage,
+                                           llvm::ConstantStruct::get(SiteTy, {llvm::ConstantExpr::getPointerCast(Name, Ptr),
+                                                                              llvm::ConstantExpr::getPointerCast(Distance, Ptr)}),
+                                           "swpf.site");
+    Entry->setSection("swpf_sites");
+    Entry->setAlignment(llvm::Align(llvm_module->getDataLayout().getPointerABIAlignment(0)));
+    llvm::appendToCompilerUsed(*llvm_module, {Entry});
+
+    // The runtime reads the environment from a constructor of every module with a table, which
+    // also makes the linker pull it out of its archive.
+    if (!llvm_module->getFunction("__swpf_distances_init"))
+    {
+      llvm::FunctionCallee Init = llvm_module->getOrInsertFunction("__swpf_distances_init", Builder.getVoidTy());
+      llvm::appendToGlobalCtors(*llvm_module, llvm::cast<llvm::Function>(Init.getCallee()), 0);
+    }
+
+    return Builder.CreateLoad(Builder.getInt32Ty(), Distance, "swpf.distance");
+  }
+
+  // Slice of an instruction found by depthFirstSearch: the induction variable it depends on, and
+  // the instructions between the two. Every instruction is searched once per function, unless the
+  // search passed a load that hadn't been searched yet; `candidates` then holds the number of
+  // candidate loads it saw, and the slice is searched again once there are more.
+  struct SliceInfo
+  {
+    static constexpr unsigned Final = ~0u;
+
+    bool found = false;
+    llvm::Instruction* phi = nullptr;
+    llvm::SmallVector<llvm::Instruction*, 8> insts;
+    unsigned candidates = Final;
+  };
+
+  // An instruction depthFirstSearch is part way through: the next operand to look at, and the slice
+  // put together from the operands before it.
+  struct SliceFrame
+  {
+    llvm::Instruction* I = nullptr;
+    unsigned operand = 0;
+    llvm::Instruction* phi = nullptr;
+    llvm::SetVector<llvm::Instruction*> insts;
+    bool found = false;
+    bool pending = false;                          // passed a load that hasn't been searched yet
+    llvm::SmallVector<llvm::Instruction*, 8> via;  // instructions between I and the operand searched
+  };
+
+  // Adds the slice of an operand, from induction variable phi through Instrs, to the slice of the
+  // frame. Of two induction variables the one of the outer loop is kept.
+  static void mergeSlice(SliceFrame& Frame, llvm::Instruction* phi, llvm::ArrayRef<llvm::Instruction*> Instrs,
+                         llvm::LoopInfo& LI)
+  {
+    if(Frame.phi && Frame.phi != phi) 
+    {
+      //check which is older.
+      if(LI.getLoopFor(Frame.phi->getParent())->isLoopInvariant(phi)) 
+      {
+        LLVM_DEBUG(llvm::dbgs() << "not switching phis\n");
+        return;
+      } 
+      if(!LI.getLoopFor(phi->getParent())->isLoopInvariant(Frame.phi)) 
+      {
+        assert(0);
+        return;
+      }
+      LLVM_DEBUG(llvm::dbgs() << "switching phis\n");
+      Frame.insts.clear();
+    }
+
+    for(auto q : Instrs)
+    {
+      Frame.insts.remove(q);
+      Frame.insts.insert(q);
+    }
+    Frame.phi = phi;
+    Frame.found = true;
+  }
+
+  // Adds the finished slice of the operand the frame was searching.
+  static void mergeOperandSlice(SliceFrame& Frame, const SliceInfo& Slice, llvm::LoopInfo& LI)
+  {
+    Frame.pending |= Slice.candidates != SliceInfo::Final;
+    if(Slice.found)
+    {
+      llvm::SmallVector<llvm::Instruction*, 8> Instrz(Frame.via.begin(), Frame.via.end());
+      Instrz.append(Slice.insts.begin(), Slice.insts.end());
+      mergeSlice(Frame, Slice.phi, Instrz, LI);
+    }
+  }
+
+  // Returns the slice of I if it is known, or pushes a frame to search it. A search that runs out of
+  // budget leaves I a miss.
+  const SliceInfo* beginSlice(llvm::Instruction* I, unsigned Candidates, llvm::SmallVectorImpl<SliceFrame>& Stack)
+  {
+    auto Cached = slices.find(I);
+    if(Cached != slices.end()
+       && (Cached->second.candidates == SliceInfo::Final || Cached->second.candidates == Candidates))
+    {
+      return &Cached->second;
+    }
+
+    // Stays a miss if the search gives up part way, and stops cycles through non-induction phis.
+    SliceInfo& Slice = slices[I];
+    Slice = SliceInfo();
+
+    sliceWork += I->getNumOperands();
+    if(sliceWork > options.sliceBudget)
+    {
+      return &Slice;
+    }
+
+    Stack.emplace_back();
+    Stack.back().I = I;
+    return nullptr;
+  }
+
+  // Finds the induction variable I is computed from, and appends the instructions between the two to
+  // Instrs. The operands are walked with an explicit stack, as address computations can be chains of
+  // thousands of instructions.
+  bool depthFirstSearch( llvm::Instruction* I, 
+                         llvm::LoopInfo& LI, 
+                         llvm::Instruction*& Phi, 
+                         llvm::SmallVector<llvm::Instruction*, 8>& Instrs, 
+                         llvm::DenseMap<llvm::Instruction*, unsigned>& LoadIndex, 
+                         llvm::SmallVector<llvm::Instruction*, 4>& Phis, 
+                         std::vector<llvm::SmallVector<llvm::Instruction*, 8>>& Insts )
+  {
+    llvm::SmallVector<SliceFrame, 16> Stack;
+    beginSlice(I, LoadIndex.size(), Stack);
+
+    while(!Stack.empty())
+    {
+      SliceFrame& Top = Stack.back();
+
+      if(Top.operand == Top.I->getNumOperands())
+      {
+        // Slices are copied into every instruction on the way back, so they count against the budget too.
+        sliceWork += Top.insts.size();
+
+        SliceInfo& Slice = slices[Top.I];
+        Slice.found = Top.found && sliceWork <= options.sliceBudget;
+        Slice.candidates = Top.pending ? LoadIndex.size() : SliceInfo::Final;
+        if(Slice.found)
+        {
+          Slice.phi = Top.phi;
+          Slice.insts.assign(Top.insts.begin(), Top.insts.end());
+        }
+        Stack.pop_back();
+        if(!Stack.empty())
+        {
+          mergeOperandSlice(Stack.back(), Slice, LI);
+        }
+        continue;
+      }
+
+      llvm::Value* v = Top.I->getOperand(Top.operand++);
+      llvm::PHINode* p = llvm::dyn_cast<llvm::PHINode>(v);
+      llvm::Loop* L = nullptr;
+      if(p) 
+      {
+        L = LI.getLoopFor(p->getParent());
+      }
+
+      if(p && L && isInductionVariable(p, L)) 
+      {
+        LLVM_DEBUG(llvm::dbgs() << "Loop induction phi node! " << *p << "\n");
+        mergeSlice(Top, p, {p}, LI);
+      }
+      else if(llvm::dyn_cast<llvm::StoreInst>(v))
+      {}
+      else if(llvm::dyn_cast<llvm::CallInst>(v) && !isGather(v))
+      {}
+      else if(llvm::dyn_cast<llvm::Instruction>(v) && llvm::dyn_cast<llvm::Instruction>(v)->isTerminator())
+      {}
+      else if(llvm::Instruction* linst = getLoadAccess(v)) 
+      {
+        auto Known = LoadIndex.find(linst);
+        if(Known != LoadIndex.end())
+        {
+          mergeSlice(Top, Phis[Known->second], Insts[Known->second], LI);
+        }
+        else if(!searchedAccesses.count(linst))
+        {
+          Top.pending = true;
+        }
+      }
+      else if(llvm::Instruction* k = llvm::dyn_cast_or_null<llvm::Instruction>(v)) 
+      {
+        if(p && !L)
+        {
+          continue;
+        }
+
+        llvm::Instruction* j = k;
+        L = LI.getLoopFor(j->getParent());
+        if(!L) 
+        {
+          continue;
+        }
+
+        Top.via.clear();
+        Top.via.push_back(k);
+
+        if(p) 
+        {
+          LLVM_DEBUG(llvm::dbgs() << "Non-loop-induction phi node! " << *p << "\n");
+
+          j = llvm::dyn_cast_or_null<llvm::Instruction>(getOddPhiFirst(L, p));
+          if(!j) 
+          {
+            // Gives up on Top, which stays a miss.
+            Stack.pop_back();
+            continue;
+          }
+          Top.via.push_back(j);
+        }
+
+        if(const SliceInfo* Slice = beginSlice(j, LoadIndex.size(), Stack))
+        {
+          mergeOperandSlice(Stack.back(), *Slice, LI);
+        }
+      }
+    }
+
+    const SliceInfo& Slice = slices[I];
+    if(Slice.found)
+    {
+      Phi = Slice.phi;
+      Instrs.append(Slice.insts.begin(), Slice.insts.end());
+    }
+    return Slice.found;
+  }
+
+  void initialize(llvm::Function& F, llvm::FunctionAnalysisManager& FAM)
+  {
+    llvm_module = F.getParent();
+    SE = &FAM.getResult<llvm::ScalarEvolutionAnalysis>(F);
+    DT = &FAM.getResult<llvm::DominatorTreeAnalysis>(F);
+    Loops = &FAM.getResult<llvm::LoopAnalysis>(F);
+    ORE = &FAM.getResult<llvm::OptimizationRemarkEmitterAnalysis>(F);
+    TTI = &FAM.getResult<llvm::TargetIRAnalysis>(F);
+    lastValues.clear();
+    firstValues.clear();
+    peeled.clear();
+    slices.clear();
+    searchedAccesses.clear();
+    sliceWork = 0;
+  }
+
+  // An inner loop walking a linked chain, `p = next(p)`, whose first element is computed from the
+  // induction variable of an enclosing loop: bucket overflow lists (b = b->next) and index chains
+  // (hit = next[hit-1]) in the hash join probes.
+  struct ChainTraversal
+  {
+    llvm::Loop* loop = nullptr;
+    llvm::PHINode* node = nullptr;            // current element of the chain
+    llvm::LoadInst* next = nullptr;           // load of the following element
+    llvm::ICmpInst* test = nullptr;           // comparison that ends the chain
+    unsigned testOperand = 0;                 // operand of `test` holding the element
+    bool continueOnTrue = true;
+    llvm::Instruction* IV = nullptr;          // induction variable of the enclosing loop
+    llvm::SmallVector<llvm::Instruction*, 8> start; // slice from the first element back to IV
+    llvm::SmallSetVector<llvm::Value*, 4> addresses; // addresses read from every element
+  };
+
+  // Whether V is computed from the chain element p by address arithmetic alone, with everything else
+  // available at InsertPt.
+  bool isComputableFromNode(llvm::Value* V, llvm::PHINode* p, llvm::Loop* L, llvm::Instruction* InsertPt,
+                            bool& usesNode, unsigned depth = 0) const
+  {
+    if (V == p)
+    {
+      usesNode = true;
+      return true;
+    }
+
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I)
+    {
+      return true;
+    }
+    if (!L->contains(I))
+    {
+      return DT->dominates(I, InsertPt);
+    }
+    if (depth > 8 || !(llvm::isa<llvm::GetElementPtrInst>(I) || llvm::isa<llvm::CastInst>(I) || llvm::isa<llvm::BinaryOperator>(I)))
+    {
+      return false;
+    }
+
+    for (llvm::Value* Op : I->operands())
+    {
+      if (!isComputableFromNode(Op, p, L, InsertPt, usesNode, depth + 1))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  llvm::Value* cloneFromNode(llvm::Value* V, llvm::PHINode* p, llvm::Value* node, llvm::Loop* L, llvm::IRBuilder<>& Builder) const
+  {
+    if (V == p)
+    {
+      return node;
+    }
+
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I || !L->contains(I))
+    {
+      return V;
+    }
+
+    llvm::Instruction* C = I->clone();
+    for (unsigned k = 0; k < I->getNumOperands(); k++)
+    {
+      C->setOperand(k, cloneFromNode(I->getOperand(k), p, node, L, Builder));
+    }
+    return Builder.Insert(C);
+  }
+
+  // Finds the chain traversals of the function. The first element of each chain must have a slice
+  // back to an outer induction variable that can be recomputed for a later iteration.
+  std::vector<ChainTraversal> findChainTraversals(llvm::LoopInfo& LI,
+                                                  llvm::DenseMap<llvm::Instruction*, unsigned>& LoadIndex,
+                                                  llvm::SmallVector<llvm::Instruction*, 4>& Phis,
+                                                  std::vector<llvm::SmallVector<llvm::Instruction*, 8>>& Insts)
+  {
+    std::vector<ChainTraversal> chains;
+
+    for (llvm::Loop* L : LI.getLoopsInPreorder())
+    {
+      llvm::BasicBlock* Entering = L->getLoopPredecessor();
+      llvm::BasicBlock* Latch = L->getLoopLatch();
+      if (!L->getParentLoop() || !Entering || !Latch)
+      {
+        continue;
+      }
+      llvm::Instruction* InsertPt = Entering->getTerminator();
+
+      for (llvm::PHINode& PN : L->getHeader()->phis())
+      {
+        ChainTraversal chain;
+        chain.loop = L;
+        chain.node = &PN;
+        chain.next = llvm::dyn_cast<llvm::LoadInst>(PN.getIncomingValueForBlock(Latch));
+
+        bool usesNode = false;
+        if (isInductionVariable(&PN, L) || !chain.next || !chain.next->isSimple() || !L->contains(chain.next)
+            || !isComputableFromNode(chain.next->getPointerOperand(), &PN, L, InsertPt, usesNode) || !usesNode)
+        {
+          continue;
+        }
+
+        // The comparison that stops the walk, on either the current or the next element.
+        llvm::SmallVector<llvm::BasicBlock*, 4> ExitingBlocks;
+        L->getExitingBlocks(ExitingBlocks);
+        for (llvm::BasicBlock* Exiting : ExitingBlocks)
+        {
+          auto* BI = llvm::dyn_cast<llvm::BranchInst>(Exiting->getTerminator());
+          auto* Cmp = BI && BI->isConditional() ? llvm::dyn_cast<llvm::ICmpInst>(BI->getCondition()) : nullptr;
+          if (!Cmp)
+          {
+            continue;
+          }
+          for (unsigned k = 0; k < 2; k++)
+          {
+            llvm::Value* Element = Cmp->getOperand(k);
+            bool otherUsesNode = false;
+            if ((Element == &PN || Element == chain.next)
+                && isComputableFromNode(Cmp->getOperand(1 - k), &PN, L, InsertPt, otherUsesNode) && !otherUsesNode)
+            {
+              chain.test = Cmp;
+              chain.testOperand = k;
+              chain.continueOnTrue = L->contains(BI->getSuccessor(0));
+            }
+          }
+        }
+        if (!chain.test)
+        {
+          continue;
+        }
+
+        for (llvm::BasicBlock* BB : L->blocks())
+        {
+          for (llvm::Instruction& I : *BB)
+          {
+            auto* LD = llvm::dyn_cast<llvm::LoadInst>(&I);
+            bool addressUsesNode = false;
+            if (LD && chain.addresses.size() < 4
+                && isComputableFromNode(LD->getPointerOperand(), &PN, L, InsertPt, addressUsesNode) && addressUsesNode)
+            {
+              chain.addresses.insert(LD->getPointerOperand());
+            }
+          }
+        }
+
+        // The first element, recomputed for a later iteration of the enclosing loop.
+        auto* First = llvm::dyn_cast_or_null<llvm::Instruction>(getOddPhiFirst(L, &PN));
+        if (!First)
+        {
+          continue;
+        }
+        chain.start.push_back(First);
+        llvm::Instruction* phi = nullptr;
+        if (!depthFirstSearch(First, LI, phi, chain.start, LoadIndex, Phis, Insts))
+        {
+          continue;
+        }
+        chain.IV = phi;
+
+        llvm::Loop* Outer = LI.getLoopFor(phi->getParent());
+        bool loads = false;
+        bool supported = Outer && Outer != L && Outer->contains(L);
+        for (llvm::Instruction* z : chain.start)
+        {
+          loads |= llvm::isa<llvm::LoadInst>(z);
+          supported &= (z == phi || !llvm::isa<llvm::PHINode>(z));
+        }
+
+        // Loads in the slice read a later iteration's data, so they need a bound on the induction variable.
+        if (supported && loads)
+        {
+          const llvm::SCEV* Step = getInductionStep(llvm::cast<llvm::PHINode>(phi), Outer);
+          supported = getLastInductionSCEV(llvm::cast<llvm::PHINode>(phi), Outer)
+                      && (SE->isKnownNegative(Step) || SE->isKnownPositive(Step));
+        }
+        if (!supported)
+        {
+          continue;
+        }
+
+        LLVM_DEBUG(llvm::dbgs() << "Chain traversal " << PN << " from " << *phi << "\n");
+        chains.push_back(chain);
+      }
+    }
+
+    return chains;
+  }
+
+  // Levels of a chain traversal's prefetches: the loads leading to the first element, the first
+  // element itself, then one level per hop.
+  int getChainStartLevels(const ChainTraversal& chain) const
+  {
+    int levels = 1;
+    for (llvm::Instruction* z : chain.start)
+    {
+      levels += llvm::isa<llvm::LoadInst>(z);
+    }
+    return levels;
+  }
+
+  // Recomputes the first element of a chain `offset` iterations of the enclosing loop ahead.
+  llvm::Value* cloneChainStart(const ChainTraversal& chain, llvm::Loop* Outer, int offset, llvm::IRBuilder<>& Builder)
+  {
+    llvm::PHINode* IV = llvm::cast<llvm::PHINode>(chain.IV);
+    llvm::DenseMap<llvm::Value*, llvm::Value*> VMap;
+
+    for (auto it = chain.start.rbegin(); it != chain.start.rend(); ++it)
+    {
+      llvm::Instruction* z = *it;
+      if (VMap.count(z))
+      {
+        continue;
+      }
+      if (z == IV)
+      {
+        llvm::Value* ahead = createLookAhead(Builder, IV, Outer, offset);
+        if (getChainStartLevels(chain) > 1)
+        {
+          bool countsDown = SE->isKnownNegative(getInductionStep(IV, Outer));
+          ahead = createClampToLast(Builder, ahead, getLastInductionValue(IV, Outer), countsDown);
+        }
+        VMap[z] = ahead;
+        continue;
+      }
+
+      llvm::Instruction* C = z->clone();
+      for (unsigned k = 0; k < C->getNumOperands(); k++)
+      {
+        if (llvm::Value* V = VMap.lookup(C->getOperand(k)))
+        {
+          C->setOperand(k, V);
+        }
+      }
+      VMap[z] = Builder.Insert(C);
     }
 
-    return nullptr;
+    return VMap.lookup(chain.start.front());
   }
 
-  llvm::Value* getCanonicalishSizeVariable(llvm::Loop* L) const
+  llvm::Value* createChainTest(const ChainTraversal& chain, llvm::Value* node, llvm::IRBuilder<>& Builder) const
   {
-    // Loop over all of the PHI nodes, looking for a canonical indvar.
-    auto B = L->getExitingBlock();
-    
-    if(!B)
-    {
-      return nullptr;
-    }
+    llvm::Value* other = chain.test->getOperand(1 - chain.testOperand);
+    llvm::Value* cmp = chain.testOperand == 0 ? Builder.CreateICmp(chain.test->getPredicate(), node, other)
+                                              : Builder.CreateICmp(chain.test->getPredicate(), other, node);
+    return chain.continueOnTrue ? cmp : Builder.CreateNot(cmp);
+  }
 
-    llvm::CmpInst* CI = nullptr;
+  // Prefetches the `hops` elements after the first one of the chain for a later iteration of the
+  // enclosing loop, in the block that enters the chain's loop. One walk loads every element from the
+  // one before it, behind the chain's own end test, so it never goes further than the original
+  // program would, and prefetches what the loop reads from each element it reaches.
+  void prefetchChainHops(const ChainTraversal& chain, unsigned hops, int offset, llvm::LoopInfo& LI)
+  {
+    llvm::Loop* Outer = LI.getLoopFor(chain.IV->getParent());
+    llvm::DomTreeUpdater DTU(*DT, llvm::DomTreeUpdater::UpdateStrategy::Eager);
 
-    //really, should be reverse dataflow from the terminating jump
-    for (llvm::Instruction& J : *B)
-    {
-      llvm::Instruction* I = &J;
-      CI = llvm::dyn_cast<llvm::CmpInst>(I) ? llvm::dyn_cast<llvm::CmpInst>(I) : CI;
-    }
+    llvm::IRBuilder<> Builder(chain.loop->getLoopPredecessor()->getTerminator());
+    llvm::Value* node = cloneChainStart(chain, Outer, offset, Builder);
 
-    bool Changed = false;
-    if (CI)
+    for (unsigned hop = 0; hop <= hops; hop++)
     {
-      if(L->makeLoopInvariant(CI->getOperand(1), Changed) 
-         || makeLoopInvariantPredecessor(CI->getOperand(1), Changed, L))
+      if (hop > 0)
       {
-        return CI->getOperand(1);
+        llvm::Value* address = cloneFromNode(chain.next->getPointerOperand(), chain.node, node, chain.loop, Builder);
+        node = Builder.CreateLoad(chain.next->getType(), address);
       }
 
-      if(L->makeLoopInvariant(CI->getOperand(0), Changed)
-         || makeLoopInvariantPredecessor(CI->getOperand(1), Changed , L))
+      llvm::Value* valid = createChainTest(chain, node, Builder);
+      llvm::Instruction* Then = llvm::SplitBlockAndInsertIfThen(valid, &*Builder.GetInsertPoint(), false, nullptr, &DTU, &LI);
+      Builder.SetInsertPoint(Then);
+
+      // The first element is prefetched like any other indirect access.
+      for (llvm::Value* address : hop > 0 ? chain.addresses.getArrayRef() : llvm::ArrayRef<llvm::Value*>())
       {
-        return CI->getOperand(0);
+        createPrefetch(cloneFromNode(address, chain.node, node, chain.loop, Builder), Then,
+                       isWrittenAddress(address), getLocality(address), chain.next->getDebugLoc());
       }
-
-      LLVM_DEBUG(llvm::dbgs() << "Size not loop invariant!" << *(CI->getOperand(0)) << *(CI->getOperand(1)) << "\n");
     }
-
-    return nullptr;
   }
 
-  llvm::PHINode* getCanonicalishInductionVariable(llvm::Loop* L) const
+  // A candidate of a short inner loop prefetched from the enclosing loop instead: the first iterations
+  // of the inner loop for a later iteration of the enclosing one, e.g. the first edges of a vertex a
+  // few vertices ahead in the BFS of graph500, rather than edges past the end of the current vertex.
+  struct OuterLookAhead
   {
-    llvm::BasicBlock* H = L->getHeader();
-
-    llvm::BasicBlock* Incoming = nullptr;
-    llvm::BasicBlock* Backedge = nullptr;
-    llvm::pred_iterator PI = llvm::pred_begin(H);
-
-    assert(PI != llvm::pred_end(H) && "Loop must have at least one backedge!");
+    llvm::Loop* outer = nullptr;
+    llvm::PHINode* IV = nullptr;      // induction variable of the enclosing loop
+    unsigned iterations = 0;          // estimated iterations of the inner loop
+    int startLevels = 0;              // loads that find where the inner loop starts and ends
+  };
 
-    Backedge = *PI++;
-    if (PI == llvm::pred_end(H))
+  // Iterations of L from its branch weights, its constant bound, or the outer-trip-count option.
+  unsigned getEstimatedTripCount(llvm::Loop* L) const
+  {
+    if (auto Estimate = llvm::getLoopEstimatedTripCount(L))
     {
-      // indicates dead loop
-      return nullptr;
+      return *Estimate;
     }
-     
-    Incoming = *PI++;
-    if (PI != llvm::pred_end(H))
+    if (unsigned trips = SE->getSmallConstantMaxTripCount(L))
     {
-      // indicates the possibility of multiple backedges
-      return nullptr;
+      return trips;
     }
+    return options.outerTripCount;
+  }
 
-    if (L->contains(Incoming))
+  // Loads along the longest path from V back to IV, the induction variable of Outer, if V can be
+  // recomputed for a later iteration of Outer by its own arithmetic and by loads that every iteration
+  // runs, or -1. Values defined outside Outer are the same on every iteration.
+  int getLevelsAhead(llvm::Value* V, llvm::PHINode* IV, llvm::Loop* Outer, llvm::LoopInfo& LI, bool& usesIV,
+                     unsigned depth = 0) const
+  {
+    if (V == IV)
     {
-      if (L->contains(Backedge))
-      {
-        return nullptr;
-      }
-      std::swap(Incoming, Backedge);
+      usesIV = true;
+      return 0;
     }
-    else if (!L->contains(Backedge))
+
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I || !Outer->contains(I))
     {
-      return nullptr;
+      return 0;
     }
-
-    for (llvm::BasicBlock::iterator I = H->begin(); llvm::isa<llvm::PHINode>(I); ++I)
+    auto* LD = llvm::dyn_cast<llvm::LoadInst>(I);
+    if (depth > 8 || LI.getLoopFor(I->getParent()) != Outer
+        || (LD && (!LD->isSimple() || !DT->dominates(I->getParent(), Outer->getLoopLatch())))
+        || !(LD || llvm::isa<llvm::GetElementPtrInst>(I) || llvm::isa<llvm::CastInst>(I) || llvm::isa<llvm::BinaryOperator>(I)
+             || llvm::isa<llvm::CmpInst>(I) || llvm::isa<llvm::SelectInst>(I)))
     {
-      llvm::PHINode* PN = llvm::cast<llvm::PHINode>(I);
-
-      if(!PN->getIncomingValueForBlock(Backedge))
-      {
-        return nullptr;
-      }
+      return -1;
+    }
 
-      if (llvm::Instruction* Inc = llvm::dyn_cast<llvm::Instruction>(PN->getIncomingValueForBlock(Backedge)))
+    int levels = 0;
+    for (llvm::Value* Op : I->operands())
+    {
+      int opLevels = getLevelsAhead(Op, IV, Outer, LI, usesIV, depth + 1);
+      if (opLevels < 0)
       {
-        if (Inc->getOpcode() == llvm::Instruction::Add && Inc->getOperand(0) == PN)
-        {
-          if (llvm::dyn_cast<llvm::ConstantInt>(Inc->getOperand(1)))
-          {
-            return PN;
-          }
-        }
+        return -1;
       }
+      levels = std::max(levels, opLevels);
     }
-
-    return nullptr;
+    return levels + (LD != nullptr);
   }
 
-  llvm::PHINode* getWeirdCanonicalishInductionVariable(llvm::Loop* L) const
+  // Recomputes V with IV replaced by `ahead`, for values getLevelsAhead accepted.
+  llvm::Value* cloneAhead(llvm::Value* V, llvm::Loop* Outer, llvm::DenseMap<llvm::Value*, llvm::Value*>& VMap,
+                          llvm::IRBuilder<>& Builder) const
   {
-    llvm::BasicBlock* H = L->getHeader();
+    if (llvm::Value* Known = VMap.lookup(V))
+    {
+      return Known;
+    }
 
-    llvm::BasicBlock* Incoming = nullptr;
-    llvm::BasicBlock* Backedge = nullptr;
-    llvm::pred_iterator PI = llvm::pred_begin(H);
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (!I || !Outer->contains(I))
+    {
+      return V;
+    }
 
-    assert(PI != llvm::pred_end(H) && "Loop must have at least one backedge!");
+    llvm::Instruction* C = I->clone();
+    for (unsigned k = 0; k < I->getNumOperands(); k++)
+    {
+      C->setOperand(k, cloneAhead(I->getOperand(k), Outer, VMap, Builder));
+    }
+    return VMap[V] = Builder.Insert(C);
+  }
 
-    Backedge = *PI++;
-    if (PI == llvm::pred_end(H))
+  // Rewrites an expression of the values of one iteration of a loop into the same expression of
+  // another iteration's values.
+  struct LookAheadRewriter : public llvm::SCEVRewriteVisitor<LookAheadRewriter>
+  {
+    LookAheadRewriter(llvm::ScalarEvolution& SE, llvm::function_ref<llvm::Value*(llvm::Value*)> Ahead)
+        : llvm::SCEVRewriteVisitor<LookAheadRewriter>(SE), Ahead(Ahead)
     {
-      // indicates dead loop
-      return nullptr;
     }
 
-    Incoming = *PI++;
-    if (PI != pred_end(H))
+    const llvm::SCEV* visitUnknown(const llvm::SCEVUnknown* U)
     {
-      // indicates the possibility of multiple backedges
-      return nullptr;
+      llvm::Value* V = Ahead(U->getValue());
+      return V == U->getValue() ? U : SE.getSCEV(V);
     }
 
-    if (L->contains(Incoming))
+    llvm::function_ref<llvm::Value*(llvm::Value*)> Ahead;
+  };
+
+  // The conditional branch that decides whether L is entered, in the block entering it or the one
+  // before its preheader, and which way it enters.
+  llvm::BranchInst* getEntryGuard(llvm::Loop* L, bool& entersOnTrue) const
+  {
+    llvm::BasicBlock* Target = L->getHeader();
+    llvm::BasicBlock* Entry = L->getLoopPredecessor();
+    if (Entry && Entry->getSingleSuccessor())
     {
-      if (L->contains(Backedge))
-      {
-        return nullptr;
-      }
-      std::swap(Incoming, Backedge);
+      Target = Entry;
+      Entry = Entry->getSinglePredecessor();
     }
-    else if (!L->contains(Backedge))
+
+    auto* BI = Entry ? llvm::dyn_cast<llvm::BranchInst>(Entry->getTerminator()) : nullptr;
+    if (!BI || !BI->isConditional() || BI->getSuccessor(0) == BI->getSuccessor(1)
+        || (BI->getSuccessor(0) != Target && BI->getSuccessor(1) != Target))
     {
       return nullptr;
     }
 
-    // Loop over all of the PHI nodes, looking for a canonical indvar.
-    for (llvm::BasicBlock::iterator I = H->begin(); llvm::isa<llvm::PHINode>(I); ++I)
+    entersOnTrue = BI->getSuccessor(0) == Target;
+    return BI;
+  }
+
+  // Whether the inner loop L of candidate `Slice` can be run ahead from its parent loop: the parent
+  // can recompute where L starts, how many times it goes round and whether it is entered at all for
+  // a later iteration of its own, and the slice from the access back to IV only needs L's index.
+  bool findOuterLookAhead(llvm::ArrayRef<llvm::Instruction*> Slice, llvm::Instruction* access, llvm::PHINode* IV,
+                          llvm::Loop* L, llvm::LoopInfo& LI, OuterLookAhead& stage) const
+  {
+    llvm::Loop* Outer = L->getParentLoop();
+    llvm::BasicBlock* Entering = L->getLoopPredecessor();
+    if (!Outer || !L->isInnermost() || !Entering || LI.getLoopFor(Entering) != Outer || !Outer->getLoopLatch()
+        || L->getExitingBlock() != L->getLoopLatch() || !IV->getType()->isIntegerTy() || getGatherOrScatter(access)
+        || !llvm::is_contained(Slice, getAccessAddress(access))
+        || !llvm::isa_and_nonnull<llvm::SCEVConstant>(getInductionStep(IV, L)))
     {
-      llvm::PHINode* PN = llvm::cast<llvm::PHINode>(I);
+      return false;
+    }
 
-      if (llvm::GetElementPtrInst* Inc = llvm::dyn_cast<llvm::GetElementPtrInst>(PN->getIncomingValueForBlock(Backedge)))
+    for (llvm::Instruction* z : Slice)
+    {
+      if (z == IV)
+      {
+        continue;
+      }
+      if (llvm::isa<llvm::PHINode>(z) || !L->contains(z))
+      {
+        return false;
+      }
+      for (llvm::Value* Op : z->operands())
       {
-        if (Inc->getOperand(0) == PN)
+        auto* I = llvm::dyn_cast<llvm::Instruction>(Op);
+        if (I && !llvm::is_contained(Slice, I) && !DT->dominates(I, Entering->getTerminator()))
         {
-          if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(Inc->getOperand(Inc->getNumOperands()-1)))
-          {
-            if (CI->equalsInt(1))
-            {
-              return PN;
-            }
-          }
+          return false;
         }
       }
     }
-    
-    return nullptr;
-  }
-
-  llvm::GetElementPtrInst* getWeirdCanonicalishInductionVariableGep(llvm::Loop* L) const
-  {
-    llvm::BasicBlock* H = L->getHeader();
 
-    llvm::BasicBlock* Incoming = nullptr;
-    llvm::BasicBlock* Backedge = nullptr;
-    llvm::pred_iterator PI = llvm::pred_begin(H);
+    // The look-ahead of the enclosing loop is kept to its own last iteration.
+    stage.outer = Outer;
+    stage.IV = getCanonicalishInductionVariable(Outer);
+    const llvm::SCEV* Step = stage.IV ? getInductionStep(stage.IV, Outer) : nullptr;
+    if (!Step || !(SE->isKnownPositive(Step) || SE->isKnownNegative(Step)) || !getLastInductionSCEV(stage.IV, Outer))
+    {
+      return false;
+    }
 
-    assert(PI != llvm::pred_end(H) && "Loop must have at least one backedge!");
+    // Rows that start in the same place on every iteration are already in the cache.
+    bool usesIV = false;
+    stage.startLevels = getLevelsAhead(IV->getIncomingValueForBlock(Entering), stage.IV, Outer, LI, usesIV);
+    if (stage.startLevels < 0 || !usesIV)
+    {
+      return false;
+    }
 
-    Backedge = *PI++;
-    if (PI == llvm::pred_end(H))
+    const llvm::SCEV* BTC = SE->getSymbolicMaxBackedgeTakenCount(L);
+    bool computable = !llvm::isa<llvm::SCEVCouldNotCompute>(BTC);
+    computable = computable && !llvm::SCEVExprContains(BTC, [&](const llvm::SCEV* S) {
+      if (llvm::isa<llvm::SCEVAddRecExpr>(S))
+      {
+        return true;
+      }
+      auto* U = llvm::dyn_cast<llvm::SCEVUnknown>(S);
+      int levels = U ? getLevelsAhead(U->getValue(), stage.IV, Outer, LI, usesIV) : 0;
+      stage.startLevels = std::max(stage.startLevels, levels);
+      return levels < 0;
+    });
+    if (!computable)
     {
-      // indicates dead loop
-      return nullptr;
+      return false;
     }
 
-    Incoming = *PI++;
-    if (PI != pred_end(H))
+    // A later iteration's loop has to be entered for its trip count to mean anything, which the
+    // guard around a rotated loop tells, unless every iteration of the enclosing loop enters it.
+    bool entersOnTrue = true;
+    if (llvm::BranchInst* Guard = getEntryGuard(L, entersOnTrue))
     {
-      // indicates the possibility of multiple backedges
-      return nullptr;
+      int levels = LI.getLoopFor(Guard->getParent()) == Outer && DT->dominates(Guard->getParent(), Outer->getLoopLatch())
+                   ? getLevelsAhead(Guard->getCondition(), stage.IV, Outer, LI, usesIV) : -1;
+      stage.startLevels = std::max(stage.startLevels, levels);
+      if (levels < 0)
+      {
+        return false;
+      }
+    }
+    else if (!DT->dominates(L->getHeader(), Outer->getLoopLatch()))
+    {
+      return false;
     }
 
-    if (L->contains(Incoming))
+    stage.iterations = getEstimatedTripCount(L);
+    return stage.iterations > 0;
+  }
+
+  // Prefetches the first iterations of the access of the inner loop L, `offset` iterations of the
+  // enclosing loop ahead, in the block that enters L. Iterations the later loop doesn't run are
+  // replaced by the first one of the current loop, which is running, so every load stays in range.
+  // Accesses that step through consecutive elements get one prefetch per line.
+  void prefetchOuterLookAhead(const OuterLookAhead& stage, llvm::ArrayRef<llvm::Instruction*> Slice,
+                              llvm::Instruction* access, llvm::PHINode* IV, llvm::Loop* L, int offset, llvm::LoopInfo& LI)
+  {
+    if (!L->getLoopPreheader() && !llvm::InsertPreheaderForLoop(L, DT, &LI, nullptr, true))
     {
-      if (L->contains(Backedge))
+      return;
+    }
+    llvm::BasicBlock* Preheader = L->getLoopPreheader();
+    llvm::IRBuilder<> Builder(Preheader->getTerminator());
+    llvm::Loop* Outer = stage.outer;
+
+    bool countsDown = SE->isKnownNegative(getInductionStep(stage.IV, Outer));
+    llvm::Value* ahead = createLookAhead(Builder, stage.IV, Outer, offset);
+    ahead = createClampToLast(Builder, ahead, getLastInductionValue(stage.IV, Outer), countsDown);
+
+    llvm::DenseMap<llvm::Value*, llvm::Value*> VMap;
+    VMap[stage.IV] = ahead;
+    llvm::Value* first = IV->getIncomingValueForBlock(Preheader);
+    llvm::Value* start = cloneAhead(first, Outer, VMap, Builder);
+
+    auto Ahead = [&](llvm::Value* V) { return cloneAhead(V, Outer, VMap, Builder); };
+    const llvm::SCEV* BTC = LookAheadRewriter(*SE, Ahead).visit(SE->getSymbolicMaxBackedgeTakenCount(L));
+    llvm::SCEVExpander Expander(*SE, llvm_module->getDataLayout(), "swpf");
+    llvm::Value* backedges = Expander.expandCodeFor(BTC, BTC->getType(), Preheader->getTerminator());
+
+    llvm::Value* entered = Builder.getTrue();
+    bool entersOnTrue = true;
+    if (llvm::BranchInst* Guard = getEntryGuard(L, entersOnTrue))
+    {
+      entered = cloneAhead(Guard->getCondition(), Outer, VMap, Builder);
+      if (!entersOnTrue)
       {
-        return nullptr;
+        entered = Builder.CreateNot(entered);
       }
-      std::swap(Incoming, Backedge);
     }
-    else if (!L->contains(Backedge))
+
+    int64_t step = llvm::cast<llvm::SCEVConstant>(getInductionStep(IV, L))->getAPInt().getSExtValue();
+    unsigned every = 1;
+    auto* Address = llvm::dyn_cast<llvm::SCEVAddRecExpr>(SE->getSCEV(getAccessAddress(access)));
+    auto* Stride = Address && Address->getLoop() == L ? llvm::dyn_cast<llvm::SCEVConstant>(Address->getStepRecurrence(*SE)) : nullptr;
+    if (Stride && !Stride->isZero())
     {
-      return nullptr;
+      unsigned line = TTI->getCacheLineSize() ? TTI->getCacheLineSize() : 64;
+      every = std::max<uint64_t>(line / Stride->getAPInt().abs().getLimitedValue(line), 1);
     }
 
-    // Loop over all of the PHI nodes, looking for a canonical indvar.
-    for (llvm::BasicBlock::iterator I = H->begin(); llvm::isa<llvm::PHINode>(I); ++I)
+    unsigned iterations = std::min(stage.iterations, OUTER_LOOKAHEAD_ITERATIONS);
+    bool write = isWriteAccess(access) || isWrittenAddress(getAccessAddress(access));
+    for (unsigned j = 0; j < iterations; j += every)
     {
-      llvm::PHINode* PN = llvm::cast<llvm::PHINode>(I);
+      llvm::Value* index = start;
+      llvm::Value* runs = entered;
+      if (j > 0)
+      {
+        index = Builder.CreateAdd(start, llvm::ConstantInt::get(IV->getType(), j * step, true));
+        runs = Builder.CreateAnd(runs, Builder.CreateICmpULE(llvm::ConstantInt::get(backedges->getType(), j), backedges));
+      }
+      index = Builder.CreateSelect(runs, index, first);
 
-      if (llvm::GetElementPtrInst* Inc = llvm::dyn_cast<llvm::GetElementPtrInst>(PN->getIncomingValueForBlock(Backedge)))
+      llvm::DenseMap<llvm::Value*, llvm::Value*> Inner;
+      Inner[IV] = index;
+      for (auto it = Slice.rbegin(); it != Slice.rend(); ++it)
       {
-        if (Inc->getOperand(0) == PN)
+        llvm::Instruction* z = *it;
+        if (z == IV || z == access)
         {
-          if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(Inc->getOperand(Inc->getNumOperands()-1)))
+          continue;
+        }
+        llvm::Instruction* C = z->clone();
+        for (unsigned k = 0; k < C->getNumOperands(); k++)
+        {
+          if (llvm::Value* V = Inner.lookup(C->getOperand(k)))
           {
-            if (CI->equalsInt(1))
-            {
-              return Inc;
-            }
+            C->setOperand(k, V);
           }
         }
+        Inner[z] = Builder.Insert(C);
       }
+
+      llvm::Value* address = Inner.lookup(getAccessAddress(access));
+      assert(address);
+      createPrefetch(address, Preheader->getTerminator(), write, getLocality(getAccessAddress(access)), access->getDebugLoc());
+    }
+  }
+
+  // Vectorized loops read and write non-consecutive elements, e.g. p[colidx[k]] of CG, through
+  // llvm.masked.gather and llvm.masked.scatter, which take a vector with the address of every lane.
+  static llvm::IntrinsicInst* getGatherOrScatter(llvm::Value* V)
+  {
+    auto* II = llvm::dyn_cast<llvm::IntrinsicInst>(V);
+    if (II && (II->getIntrinsicID() == llvm::Intrinsic::masked_gather || II->getIntrinsicID() == llvm::Intrinsic::masked_scatter))
+    {
+      return II;
     }
-    
     return nullptr;
   }
 
-  llvm::Value* getWeirdCanonicalishInductionVariableFirst(llvm::Loop* L) const
+  static bool isGather(llvm::Value* V)
   {
-    llvm::BasicBlock* H = L->getHeader();
+    llvm::IntrinsicInst* II = getGatherOrScatter(V);
+    return II && II->getIntrinsicID() == llvm::Intrinsic::masked_gather;
+  }
 
-    llvm::BasicBlock* Incoming = nullptr;
-    llvm::BasicBlock* Backedge = nullptr;
-    llvm::pred_iterator PI = llvm::pred_begin(H);
+  static bool isWriteAccess(llvm::Value* V)
+  {
+    return llvm::isa<llvm::StoreInst>(V) || (getGatherOrScatter(V) && !isGather(V));
+  }
 
-    assert(PI != llvm::pred_end(H) && "Loop must have at least one backedge!");
+  // Loads and gathers, whose results later accesses of a chain are indexed by.
+  static llvm::Instruction* getLoadAccess(llvm::Value* V)
+  {
+    return llvm::isa<llvm::LoadInst>(V) || isGather(V) ? llvm::cast<llvm::Instruction>(V) : nullptr;
+  }
 
-    Backedge = *PI++;
-    if (PI == llvm::pred_end(H))
+  // The address an access reads or writes, a vector of addresses for gathers and scatters.
+  static llvm::Value* getAccessAddress(llvm::Instruction* I)
+  {
+    if (llvm::IntrinsicInst* II = getGatherOrScatter(I))
     {
-      // indicates dead loop
-      return nullptr;
+      return II->getArgOperand(isGather(II) ? 0 : 1);
     }
+    return llvm::getLoadStorePointerOperand(I);
+  }
 
-    Incoming = *PI++;
-    if (PI != pred_end(H))
+  static const char* getAccessKind(llvm::Instruction* I)
+  {
+    if (getGatherOrScatter(I))
     {
-      // indicates the possibility of multiple backedges
-      return nullptr;
+      return isGather(I) ? "gather" : "scatter";
     }
+    return llvm::isa<llvm::StoreInst>(I) ? "store" : "load";
+  }
 
-    if (L->contains(Incoming))
+  // Whether the program stores to `address` itself, e.g. a read-modify-write such as `Table[x] ^= v`.
+  bool isWrittenAddress(llvm::Value* address) const
+  {
+    for (llvm::User* U : address->users())
     {
-      if (L->contains(Backedge))
+      if (isWriteAccess(U) && getAccessAddress(llvm::cast<llvm::Instruction>(U)) == address)
       {
-        return nullptr;
+        return true;
       }
-      std::swap(Incoming, Backedge);
     }
-    else if (!L->contains(Backedge))
+    return false;
+  }
+
+  // Stores whose address isn't also loaded get prefetches of their own, e.g. the scatter
+  // `dst[hist[idx]++] = t`. Read-modify-writes are prefetched through their load. The same goes
+  // for the scatters of vectorized loops.
+  bool isPrefetchableStore(llvm::Instruction* I) const
+  {
+    auto* SI = llvm::dyn_cast<llvm::StoreInst>(I);
+    if ((SI && !SI->isSimple()) || !isWriteAccess(I) || !llvm::isa<llvm::Instruction>(getAccessAddress(I)))
     {
-      return nullptr;
+      return false;
     }
 
-    // Loop over all of the PHI nodes, looking for a canonical indvar.
-    for (llvm::BasicBlock::iterator I = H->begin(); llvm::isa<llvm::PHINode>(I); ++I)
+    for (llvm::User* U : getAccessAddress(I)->users())
     {
-      llvm::PHINode* PN = llvm::cast<llvm::PHINode>(I);
-
-      if (llvm::GetElementPtrInst* Inc = llvm::dyn_cast<llvm::GetElementPtrInst>(PN->getIncomingValueForBlock(Backedge)))
+      if (getLoadAccess(U))
       {
-        if (Inc->getOperand(0) == PN)
-        {
-          if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(Inc->getOperand(Inc->getNumOperands()-1)))
-          {
-            if (CI->equalsInt(1))
-            {
-              return PN->getIncomingValueForBlock(Incoming);
-            }
-          }
-        }
+        return false;
       }
     }
-    
-    return nullptr;
+    return true;
   }
 
-  llvm::Value* getOddPhiFirst(llvm::Loop* L, llvm::PHINode* PN) const
+  enum class Reuse
   {
-    llvm::BasicBlock* H = L->getHeader();
-
-    llvm::BasicBlock* Incoming = nullptr;
-    llvm::BasicBlock* Backedge = nullptr;
-    llvm::pred_iterator PI = llvm::pred_begin(H);
-
-    assert(PI != llvm::pred_end(H) && "Loop must have at least one backedge!");
+    Streaming,  // walked once, e.g. the index arrays colidx[k] or rel->tuples[i]
+    Temporal,   // walked again by every iteration of an enclosing loop
+    Random      // data dependent, e.g. p[colidx[k]] or Table[ran & mask]
+  };
 
-    Backedge = *PI++;
-    if (PI == llvm::pred_end(H))
+  // Classifies the accesses of `address` by how the lines they touch are used again. Affine
+  // addresses touch every line once per walk, and the walk only repeats when the enclosing loop
+  // doesn't move it. Anything else depends on loaded data, and the same line can come back at any time.
+  Reuse classifyReuse(llvm::Value* address) const
+  {
+    if (!SE->isSCEVable(address->getType()))
     {
-      // indicates dead loop
-      return nullptr;
+      return Reuse::Random;
     }
 
-    Incoming = *PI++;
-    if (PI != pred_end(H))
+    auto* AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(SE->getSCEV(address));
+    if (!AR || !AR->isAffine())
     {
-      // indicates the possibility of multiple backedges
-      return nullptr;
+      return Reuse::Random;
     }
 
-    if(H != PN->getParent())
+    llvm::Loop* Outer = AR->getLoop()->getParentLoop();
+    if (Outer && SE->isLoopInvariant(AR->getStart(), Outer) && SE->isLoopInvariant(AR->getStepRecurrence(*SE), Outer))
     {
-      return nullptr;
+      return Reuse::Temporal;
     }
+    return Reuse::Streaming;
+  }
 
-    if (L->contains(Incoming))
+  // The locality argument of llvm.prefetch: 0 is NTA, 1 is T2 and 3 is T0 on x86. Streams go
+  // around the caches they would pollute, so the randomly reused targets stay resident.
+  int getLocality(llvm::Value* address) const
+  {
+    if (options.uniformLocality)
     {
-      if (L->contains(Backedge))
-      {
-        return nullptr;
-      }
-      std::swap(Incoming, Backedge);
+      return 3;
     }
-    else if (!L->contains(Backedge))
+
+    switch (classifyReuse(address))
     {
-      return nullptr;
+      case Reuse::Streaming: return 0;
+      case Reuse::Temporal: return 1;
+      case Reuse::Random: return 3;
     }
-
-    return PN->getIncomingValueForBlock(Incoming);
+    llvm_unreachable("unknown reuse");
   }
 
-  bool depthFirstSearch( llvm::Instruction* I, 
-                         llvm::LoopInfo& LI, 
-                         llvm::Instruction*& Phi, 
-                         llvm::SmallVector<llvm::Instruction*, 8>& Instrs, 
-                         llvm::SmallVector<llvm::Instruction*, 4>& Loads, 
-                         llvm::SmallVector<llvm::Instruction*, 4>& Phis, 
-                         std::vector<llvm::SmallVector<llvm::Instruction*, 8>>& Insts )
+  // Sites are named after the source file, the function and the candidate's position in it, which
+  // stay the same between a profile-gen and a profile-use build of the same source with the same options.
+  std::string getSiteName(llvm::Function& F, const llvm::Twine& site) const
   {
-    llvm::Use* u   = I->getOperandList();
-    llvm::Use* end = u + I->getNumOperands();
-
-    llvm::SetVector<llvm::Instruction*> roundInsts;
-
-    bool found = false;
+    return (llvm_module->getSourceFileName() + ":" + F.getName() + ":" + site).str();
+  }
 
-    for (llvm::Use* v = u; v < end; v++)
+  // Calls the profile runtime with the address `I` accesses, just before it. Gathers and scatters
+  // are recorded by their first lane.
+  void createProfileRecord(const std::string& site, llvm::Instruction* I, llvm::Value* address) const
+  {
+    llvm::IRBuilder<> Builder(I);
+    if (address->getType()->isVectorTy())
     {
-      llvm::PHINode* p = llvm::dyn_cast<llvm::PHINode>(v->get());
-      llvm::Loop* L = nullptr;
-      if(p) 
-      {
-        L = LI.getLoopFor(p->getParent());
-      }
-
-      if(p && L && (p == getCanonicalishInductionVariable (L) || p == getWeirdCanonicalishInductionVariable(L))) 
-      {
-        LLVM_DEBUG(llvm::dbgs() << "Loop induction phi node! " << *p << "\n");
-
-        if(Phi) 
-        {
-          if(Phi == p) 
-          {
-            //add this
-            roundInsts.remove(p);
-            roundInsts.insert(p);
-            found = true; //should have been before anyway
-          } 
-          else 
-          {
-            //check which is older.
-            if(LI.getLoopFor(Phi->getParent())->isLoopInvariant(p)) 
-            {
-              //do nothing
-              LLVM_DEBUG(llvm::dbgs() << "not switching phis\n");
-            } 
-            else if (LI.getLoopFor(p->getParent())->isLoopInvariant(Phi)) 
-            {
-              LLVM_DEBUG(llvm::dbgs() << "switching phis\n");
-              roundInsts.clear();
-              roundInsts.insert(p);
-              Phi = p;
-              found = true;
-            } 
-            else 
-            {
-              assert(0);
-            }
-          }
-        } 
-        else 
-        {
-          Phi = p;
-          roundInsts.remove(p);
-          roundInsts.insert(p);
-          found = true;
-        }
-      }
-      else if(llvm::dyn_cast<llvm::StoreInst>(v->get()))
-      {}
-      else if(llvm::dyn_cast<llvm::CallInst>(v->get()))
-      {}
-      else if(llvm::dyn_cast<llvm::Instruction>(v->get()) && llvm::dyn_cast<llvm::Instruction>(v->get())->isTerminator())
-      {}
-      else if(llvm::LoadInst* linst = llvm::dyn_cast<llvm::LoadInst>(v->get())) 
-      {
-        //Cache results
-        int lindex=-1;
-        int index=0;
-        for(auto l: Loads) 
-        {
-          if (l == linst)
-          {
-            lindex=index;
-            break;
-          }
-          index++;
-        }
-
-        if(lindex!=-1)
-        {
-          llvm::Instruction* phi = Phis[lindex];
+      address = Builder.CreateExtractElement(address, uint64_t(0));
+    }
+    llvm::FunctionCallee record = llvm_module->getOrInsertFunction("__swpf_profile_record", Builder.getVoidTy(),
+                                                                   Builder.getInt8PtrTy(), Builder.getInt8PtrTy());
 
-          if(Phi) 
-          {
-            if(Phi == phi) 
-            {
-              //add this
-              for(auto q : Insts[lindex])
-              {
-                roundInsts.remove(q);
-                roundInsts.insert(q);
-              }
-              found = true; //should have been before anyway
-            } 
-            else 
-            {
-              //check which is older.
-              if(LI.getLoopFor(Phi->getParent())->isLoopInvariant(phi)) 
-              {
-                //do nothing
-                LLVM_DEBUG(llvm::dbgs() << "not switching phis\n");
-              } 
-              else if (LI.getLoopFor(phi->getParent())->isLoopInvariant(Phi)) 
-              {
-                LLVM_DEBUG(llvm::dbgs() << "switching phis\n");
-                roundInsts.clear();
-                for(auto q : Insts[lindex]) 
-                {
-                  roundInsts.remove(q);
-                  roundInsts.insert(q);
-                }
-                Phi = phi;
-                found = true;
-              } 
-              else 
-              {
-                assert(0);
-              }
-            }
-          } 
-          else 
-          {
-            for(auto q : Insts[lindex]) 
-            {
-              roundInsts.remove(q);
-              roundInsts.insert(q);
-            }
-            Phi = phi;
-            found = true;
-          }
-        }
-      }
-      else if(v->get())
-      { 
-        if(llvm::Instruction* k = llvm::dyn_cast<llvm::Instruction>(v->get())) 
-        {
-          if(!((!p) || L != nullptr))
-          {
-            continue;
-          }
+    llvm::Value* name = Builder.CreateGlobalStringPtr(site, "swpf.site");
+    Builder.CreateCall(record, {name, Builder.CreatePointerBitCastOrAddrSpaceCast(address, Builder.getInt8PtrTy())});
+  }
 
-          llvm::Instruction* j = k;
+  // Whether profile-use allows prefetching `site`. Sites missing from the profile never ran.
+  bool isProfiledMiss(const std::string& site) const
+  {
+    if (options.profileUse.empty())
+    {
+      return true;
+    }
 
-          llvm::Loop* L = LI.getLoopFor(j->getParent());
-          
-          if(L) 
-          {
-            llvm::SmallVector<llvm::Instruction*, 8> Instrz;
+    const llvm::StringMap<SiteProfile>* profile = readSiteProfile(options.profileUse);
+    if (!profile)
+    {
+      return true;
+    }
 
-            if(p) 
-            {
-              LLVM_DEBUG(llvm::dbgs() << "Non-loop-induction phi node! " << *p << "\n");
-              
-              j = nullptr;
-              
-              if(!getOddPhiFirst(L,p)) 
-              {
-                return false;
-              }
-              
-              j = llvm::dyn_cast<llvm::Instruction>(getOddPhiFirst(L,p));
-              if(!j) 
-              {
-                return false;
-              }
+    auto it = profile->find(site);
+    if (it == profile->end() || it->second.accesses == 0)
+    {
+      LLVM_DEBUG(llvm::dbgs() << "Site " << site << " didn't run\n");
+      return false;
+    }
 
-              Instrz.push_back(k);
-              Instrz.push_back(j);
-              L = LI.getLoopFor(j->getParent());
+    LLVM_DEBUG(llvm::dbgs() << "Site " << site << " missed " << it->second.misses << " of " << it->second.accesses << "\n");
+    return it->second.misses * 100 >= it->second.accesses * options.profileMissRate;
+  }
 
-            } 
-            else 
-            {
-              Instrz.push_back(k);
-            }
+  // Difference between the values of neighbouring lanes of a vector of indices, when it is the same
+  // for all of them: scalars and splats, constant steps such as <0, 1, 2, 3> and sums and multiples
+  // of them.
+  static bool getLaneStep(llvm::Value* V, int64_t& step)
+  {
+    if (!V->getType()->isVectorTy() || llvm::getSplatValue(V))
+    {
+      step = 0;
+      return true;
+    }
 
-            llvm::Instruction* phi = nullptr;
-            if(depthFirstSearch(j,LI,phi, Instrz, Loads, Phis, Insts))
-            {
-              if(Phi) 
-              {
-                if(Phi == phi) 
-                {
-                  //add this
-                  for(auto q : Instrz) 
-                  {
-                    roundInsts.remove(q);
-                    roundInsts.insert(q);
-                  }
-                  found = true; //should have been before anyway
-                } 
-                else 
-                {
-                  //check which is older.
-                  if(LI.getLoopFor(Phi->getParent())->isLoopInvariant(phi)) 
-                  {
-                    //do nothing
-                    LLVM_DEBUG(llvm::dbgs() << "not switching phis\n");
-                  } 
-                  else if (LI.getLoopFor(phi->getParent())->isLoopInvariant(Phi)) 
-                  {
-                    LLVM_DEBUG(llvm::dbgs() << "switching phis\n");
-                    roundInsts.clear();
-                    for(auto q : Instrz) 
-                    {
-                      roundInsts.remove(q);
-                      roundInsts.insert(q);
-                    }
-                    Phi = phi;
-                    found = true;
-                  } 
-                  else 
-                  {
-                    assert(0);
-                  }
-                }
-              } 
-              else 
-              {
-                for(auto q : Instrz) 
-                {
-                  roundInsts.remove(q);
-                  roundInsts.insert(q);
-                }
-                Phi = phi;
-                found = true;
-              }
-            }
-          }
+    if (auto* C = llvm::dyn_cast<llvm::Constant>(V))
+    {
+      auto* Ty = llvm::dyn_cast<llvm::FixedVectorType>(C->getType());
+      auto* First = Ty ? llvm::dyn_cast_or_null<llvm::ConstantInt>(C->getAggregateElement(0u)) : nullptr;
+      auto* Second = Ty && Ty->getNumElements() > 1 ? llvm::dyn_cast_or_null<llvm::ConstantInt>(C->getAggregateElement(1u)) : nullptr;
+      if (!First || !Second)
+      {
+        return false;
+      }
+      step = Second->getSExtValue() - First->getSExtValue();
+      for (unsigned lane = 2; lane < Ty->getNumElements(); lane++)
+      {
+        auto* E = llvm::dyn_cast_or_null<llvm::ConstantInt>(C->getAggregateElement(lane));
+        if (!E || E->getSExtValue() - First->getSExtValue() != step * lane)
+        {
+          return false;
         }
       }
+      return true;
     }
 
-    if(found)
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    if (I && (llvm::isa<llvm::SExtInst>(I) || llvm::isa<llvm::ZExtInst>(I)))
     {
-      for(auto q : roundInsts)
-      {
-        Instrs.push_back(q);
-      }
+      return getLaneStep(I->getOperand(0), step);
+    }
+
+    int64_t lhs, rhs;
+    auto* BO = llvm::dyn_cast<llvm::BinaryOperator>(V);
+    if (!BO || !getLaneStep(BO->getOperand(0), lhs) || !getLaneStep(BO->getOperand(1), rhs))
+    {
+      return false;
     }
 
-    return found;
+    auto* Factor = llvm::dyn_cast_or_null<llvm::ConstantInt>(llvm::getSplatValue(BO->getOperand(1)));
+    switch (BO->getOpcode())
+    {
+    case llvm::Instruction::Add: step = lhs + rhs; return true;
+    case llvm::Instruction::Sub: step = lhs - rhs; return true;
+    case llvm::Instruction::Mul: step = lhs * (Factor ? Factor->getSExtValue() : 0); return Factor != nullptr;
+    case llvm::Instruction::Shl: step = lhs << (Factor ? Factor->getZExtValue() : 0); return Factor != nullptr;
+    default: return false;
+    }
   }
 
-  void initialize(llvm::Function& F)
+  // Bytes between the addresses of neighbouring lanes of a getelementptr of a vector of indices, when
+  // they are all the same distance apart, e.g. the field of consecutive structures a gather reads.
+  bool getLaneStride(llvm::Value* address, int64_t& stride) const
   {
-    llvm_module = F.getParent();
+    auto* gep = llvm::dyn_cast<llvm::GetElementPtrInst>(address);
+    if (!gep || (gep->getPointerOperand()->getType()->isVectorTy() && !llvm::getSplatValue(gep->getPointerOperand())))
+    {
+      return false;
+    }
+
+    stride = 0;
+    const llvm::DataLayout& DL = llvm_module->getDataLayout();
+    for (auto it = llvm::gep_type_begin(gep); it != llvm::gep_type_end(gep); ++it)
+    {
+      int64_t step;
+      if (!getLaneStep(it.getOperand(), step))
+      {
+        return false;
+      }
+      if (step && (it.isStruct() || DL.getTypeAllocSize(it.getIndexedType()).isScalable()))
+      {
+        return false;
+      }
+      stride += step ? step * static_cast<int64_t>(DL.getTypeAllocSize(it.getIndexedType()).getFixedValue()) : 0;
+    }
+    return true;
   }
 
-#ifdef COMPUTE_C_CONST
-  double getInfoFromSysFile(std::string sys_file, std::string key)
+  // The addresses to prefetch for an access at `address`, one per cache line it touches: every lane
+  // of a gather or scatter, and every line of a vector load or store of consecutive elements wider
+  // than one. Lanes closer than a line apart are covered by the first lane, one address a line
+  // further on for each line they span, and the last lane, whichever line the first one starts in.
+  // Other lanes can still share a line, which costs a redundant prefetch but no extra miss.
+  llvm::SmallVector<llvm::Instruction*, 8> createLineAddresses(llvm::IRBuilder<>& Builder, llvm::Value* address,
+                                                              llvm::Instruction* access) const
   {
-    double value = 0.0f;
+    llvm::Type* BytePtr = llvm::Type::getInt8PtrTy(llvm_module->getContext());
+    unsigned line = TTI->getCacheLineSize() ? TTI->getCacheLineSize() : 64;
+    llvm::SmallVector<llvm::Instruction*, 8> lines;
 
-    std::string current;
-    std::ifstream file(sys_file);
-    while (file >> current)
-    {     
-      if (current == key)
+    int64_t stride;
+    auto* Lanes = llvm::dyn_cast<llvm::FixedVectorType>(address->getType());
+    if (Lanes && getLaneStride(address, stride) && std::abs(stride) < line)
+    {
+      unsigned last = Lanes->getNumElements() - 1;
+      llvm::Value* first = Builder.CreateBitCast(Builder.CreateExtractElement(address, uint64_t(stride < 0 ? last : 0)), BytePtr);
+      lines.push_back(llvm::cast<llvm::Instruction>(first));
+
+      uint64_t span = std::abs(stride) * last;
+      for (uint64_t offset = line; offset < span; offset += line)
       {
-        file >> value;
-        break; 
+        lines.push_back(llvm::cast<llvm::Instruction>(Builder.CreateConstGEP1_64(Builder.getInt8Ty(), first, offset)));
       }
-      file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      if (span)
+      {
+        llvm::Value* end = Builder.CreateExtractElement(address, uint64_t(stride < 0 ? 0 : last));
+        lines.push_back(llvm::cast<llvm::Instruction>(Builder.CreateBitCast(end, BytePtr)));
+      }
+      return lines;
     }
 
-    return value;
-  }
-
-  double getInfoFromSysFileWithLine(std::string sys_file, std::string s1, std::string s2, std::string s3){
-    double value = 0.0f;
-    std::ifstream file(sys_file);
-    std::string line;
-    while (std::getline(file, line))
+    if (Lanes)
     {
+      for (unsigned lane = 0; lane < Lanes->getNumElements(); lane++)
+      {
+        llvm::Value* laneAddress = Builder.CreateExtractElement(address, uint64_t(lane));
+        lines.push_back(llvm::cast<llvm::Instruction>(Builder.CreateBitCast(laneAddress, BytePtr)));
+      }
+      return lines;
+    }
 
-      std::istringstream iss(line);
-      std::string a, b, c;
-      if (!(iss >> a >> b >> c)) { continue; }
+    auto* base = llvm::cast<llvm::Instruction>(Builder.CreateBitCast(address, BytePtr));
+    lines.push_back(base);
 
-      if (a == s1 && b == s2 && c == s3){
-        iss >> value;
-        break;
+    llvm::Type* accessed = llvm::isa<llvm::StoreInst>(access) ? llvm::cast<llvm::StoreInst>(access)->getValueOperand()->getType()
+                                                              : access->getType();
+    if (llvm::isa<llvm::FixedVectorType>(accessed))
+    {
+      uint64_t bytes = llvm_module->getDataLayout().getTypeStoreSize(accessed).getFixedValue();
+      for (uint64_t offset = line; offset < bytes; offset += line)
+      {
+        lines.push_back(llvm::cast<llvm::Instruction>(Builder.CreateConstGEP1_64(Builder.getInt8Ty(), base, offset)));
       }
     }
+    return lines;
+  }
 
-    return value;
+  // Prefetches with write intent (PREFETCHW on x86) when the line is going to be written, which
+  // saves the separate ownership request that would follow a read prefetch. The prefetch gets the
+  // location of the access it is for, so profiles attribute its cost to that source line.
+  llvm::CallInst* createPrefetch(llvm::Value* address, llvm::Instruction* InsertBefore, bool write, int locality,
+                                 const llvm::DebugLoc& Loc) const
+  {
+    llvm::IRBuilder<> Builder(InsertBefore);
+    Builder.SetCurrentDebugLocation(Loc);
+    llvm::Value* cast = Builder.CreateBitCast(address, llvm::Type::getInt8PtrTy(llvm_module->getContext()));
+
+    llvm::Value* ar[] = { cast,
+                          llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), write ? 1 : 0),
+                          llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), locality),
+                          llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), 1) };
+
+    llvm::ArrayRef<llvm::Type*> art = { llvm::Type::getInt8PtrTy(llvm_module->getContext()) };
+
+    llvm::Function* fun = llvm::Intrinsic::getDeclaration(llvm_module, llvm::Intrinsic::prefetch, art);
+
+    assert(fun);
+
+    llvm::CallInst* call = Builder.CreateCall(fun, ar);
+    call->setMetadata(PREFETCHED_METADATA, llvm::MDNode::get(llvm_module->getContext(), {}));
+    return call;
   }
 
-  double getCpuClockSpeed()
+  // Tags a loop the pass changed through its latch, see PREFETCHED_METADATA.
+  void markPrefetched(llvm::BasicBlock* Latch) const
   {
+    Latch->getTerminator()->setMetadata(PREFETCHED_METADATA, llvm::MDNode::get(llvm_module->getContext(), {}));
+  }
 
-    double value = 0.0f;
-    std::ifstream file("/proc/cpuinfo");
-    std::string line;
-    while (std::getline(file, line))
+  // Sum of the relative latencies of chain levels [first, levels).
+  int getChainLatency(int first, int levels) const
+  {
+    int latency = 0;
+    for (int level = first; level < levels; level++)
     {
-        std::istringstream iss(line);
-        std::string a, b, last;
-        if (!(iss >> a >> b)) { continue; }
+      latency += (level == 0) ? STRIDE_LEVEL_LATENCY : INDIRECT_LEVEL_LATENCY;
+    }
+    return latency;
+  }
 
-        if (a == "model" && b == "name"){
-            while(iss >> last){
-            }
+  // Reciprocal throughput of the loop's body in the target's cost model, roughly the cycles an
+  // iteration takes when it isn't waiting for memory. Instructions that aren't lowered (phis,
+  // debug intrinsics, no-op casts) cost nothing.
+  unsigned getLoopCycles(llvm::Loop* L) const
+  {
+    int64_t cycles = 0;
+    for (llvm::BasicBlock* BB : L->blocks())
+    {
+      for (llvm::Instruction& I : *BB)
+      {
+        llvm::InstructionCost Cost = TTI->getInstructionCost(&I, llvm::TargetTransformInfo::TCK_RecipThroughput);
+        if (auto Value = Cost.getValue())
+        {
+          cycles += *Value;
+        }
+      }
+    }
+    return static_cast<unsigned>(std::min<int64_t>(cycles, std::numeric_limits<unsigned>::max()));
+  }
 
-            if (last.length() > 3) {
-                last.erase(last.length() - 3);
-            }
+  LoopDistanceModel computeLoopDistanceModel(llvm::Loop* L, int depth, int c_const) const
+  {
+    LoopDistanceModel model;
+    model.depth = depth;
 
-            value = stod(last);
-            break;
-        }
+    model.tripCount = SE->getSmallConstantTripCount(L);
+    if (!model.tripCount)
+    {
+      model.tripCount = SE->getSmallConstantMaxTripCount(L);
     }
 
-    return value;
+    for (llvm::BasicBlock* BB : L->blocks())
+    {
+      model.bodySize += BB->sizeWithoutDebug();
+    }
+
+    // Fewer instructions per iteration means more iterations are needed to cover the same latency.
+    // With loop-cost the target's estimate of the cycles an iteration takes stands in for the
+    // instruction count: REFERENCE_BODY_SIZE instructions at one per cycle.
+    unsigned bodyCost = model.bodySize;
+    if (options.loopCost)
+    {
+      bodyCost = model.cycles = getLoopCycles(L);
+    }
+    double bodyScale = static_cast<double>(REFERENCE_BODY_SIZE) / std::max(bodyCost, 1u);
+    bodyScale = std::min(std::max(bodyScale, 0.25), 4.0);
+
+    // Every extra level of indirection adds another miss that has to be hidden before the last access.
+    double depthScale = static_cast<double>(getChainLatency(0, depth)) / getChainLatency(0, REFERENCE_CHAIN_DEPTH);
+
+    double distance = c_const * bodyScale * depthScale;
+
+    // Prefetching further ahead than the loop runs only fetches lines nobody will use.
+    if (model.tripCount)
+    {
+      distance = std::min(distance, model.tripCount / 2.0);
+    }
+
+    model.distance = std::max(static_cast<int>(distance), 1);
+
+    LLVM_DEBUG(llvm::dbgs() << "Loop " << L->getHeader()->getName() << ": trip count " << model.tripCount
+                            << ", body size " << model.bodySize << ", cycles " << model.cycles << ", depth " << model.depth
+                            << ", distance " << model.distance << "\n");
+
+    return model;
   }
 
-  double getTotalCores()
+  // Offset of one level of a chain. Each level gets the share of the distance needed to hide
+  // the latency of itself and every level that depends on it.
+  int getLevelOffset(const LoopDistanceModel& model, int level, int levels) const
   {
-    return getInfoFromSysFileWithLine("/proc/cpuinfo", "cpu", "cores", ":");
+    return (model.distance * getChainLatency(level, levels)) / getChainLatency(0, levels);
   }
 
-  double getCacheSize()
+  // How many iterations ahead of the induction variable the load at `level` of a chain looks,
+  // where `remaining` counts it and the levels after it.
+  int getLookAheadOffset(const LoopDistanceModel& model, int c_const, int level, int remaining) const
   {
-    return getInfoFromSysFileWithLine("/proc/cpuinfo", "cache", "size", ":");
+    if (options.noLoopModel)
+    {
+      return (c_const*remaining)/(remaining+level);
+    }
+    return getLevelOffset(model, level, level+remaining);
   }
 
-  double getRamSize()
+  static int countMemoryAccesses(llvm::ArrayRef<llvm::Instruction*> Slice)
   {
-    return getInfoFromSysFile("/proc/meminfo", "MemTotal:");
+    return llvm::count_if(Slice, [](llvm::Instruction* I) {
+      return llvm::isa<llvm::LoadInst>(I) || llvm::isa<llvm::StoreInst>(I) || getGatherOrScatter(I);
+    });
   }
 
-  double getPageSize()
+  // The slice is listed from the prefetched access back to the induction variable, so the load
+  // indexed by the induction variable is the last one in the list.
+  static llvm::LoadInst* getFirstLoad(llvm::ArrayRef<llvm::Instruction*> Slice)
   {
-    return getInfoFromSysFile("/proc/meminfo", "Hugepagesize:");
+    llvm::LoadInst* firstLoad = nullptr;
+    for (llvm::Instruction* I : Slice)
+    {
+      if (auto* l = llvm::dyn_cast<llvm::LoadInst>(I))
+      {
+        firstLoad = l;
+      }
+    }
+    return firstLoad;
   }
 
-  std::pair<std::string, double> readIPCValue(int lineIndex)
+  enum class SkipReason
   {
-    std::pair<std::string, double> output("", -1.0f);
+    None,
+    NoSize,     // no bound keeps the look-ahead loads of the chain inside their arrays
+    StrideOnly, // a strided access without dependent indirect accesses
+  };
 
-    std::ifstream file("../../values.txt"); // Open the file
-    double ipcValue = 0.0;                  // Variable to store the IPC value
-    int currentLine = 0;                    // Current line number
+  // Whether a candidate is prefetched. Loads limited to two on last case, to avoid needing to check
+  // bound validity on later loads. guard-chains lifts the limit by keeping the index of every later
+  // intermediate load inside its array, in which case `guarded` is set.
+  SkipReason getSkipReason(llvm::ArrayRef<llvm::Instruction*> Slice, llvm::Instruction* access, llvm::PHINode* IV,
+                           llvm::Loop* L, bool ignore, bool epilogue, bool& guarded)
+  {
+    llvm::LoadInst* firstLoad = getFirstLoad(Slice);
+    int loads = countMemoryAccesses(Slice);
 
-    if (!file.is_open())
+    guarded = false;
+
+    // Without a known direction there is no end of the loop to clamp the look-ahead loads to.
+    const llvm::SCEV* Step = getInductionStep(IV, L);
+    if (loads > 1 && !options.ignoreSize && (!Step || (!SE->isKnownPositive(Step) && !SE->isKnownNegative(Step))))
     {
-      std::cerr << "Unable to open file" << std::endl;
-      return output;
+      return SkipReason::NoSize;
     }
 
-    std::string line;
-    while (getline(file, line)) // Read lines until end of file
+    if (!epilogue && !getLastInductionSCEV(IV, L) && getCanonicalishSizeVariable(L, false) == nullptr)
     {
-      if (currentLine == lineIndex) // Check if the current line is the desired line
+      guarded = options.guardChains && loads > 2 && canGuardChain(Slice, access, firstLoad, L);
+      if (!firstLoad || !getGuardSize(firstLoad, L, false) || (loads > 2 && !guarded))
       {
-        std::istringstream iss(line);
-        
-        std::getline(iss, output.first, ':');
-        iss >> output.second;
-        
-          file.close();
-          return output;
-        
+        return SkipReason::NoSize;
       }
-      currentLine++; // Increment line counter
     }
 
-    file.close(); // Make sure to close the file if the desired line is not found
-    std::cerr << "Line index out of range" << std::endl;
-    return output;
+    if (loads < 2 && ignore)
+    {
+      return SkipReason::StrideOnly;
+    }
+    return SkipReason::None;
   }
 
-  double getAverageIPCValue()
+  // What the look-ahead index of a chain is clamped to, in the order the transform tries them.
+  const char* getBoundSource(llvm::ArrayRef<llvm::Instruction*> Slice, llvm::PHINode* IV, llvm::Loop* L)
   {
-    double average = 0.0f;
-    int line_number = 0;
-    while(true)
+    llvm::LoadInst* firstLoad = getFirstLoad(Slice);
+    if (countMemoryAccesses(Slice) < 2)
     {
-      auto temp = readIPCValue(line_number);
-      if (temp.second < 0.0f)
-      {
-        break;
-      }
+      return "none";
+    }
+    if (options.ignoreSize)
+    {
+      return "ignored";
+    }
+    if (getLastInductionSCEV(IV, L))
+    {
+      return "exit-count";
+    }
+    if (getCanonicalishSizeVariable(L, false))
+    {
+      return "exit-compare";
+    }
+    if (firstLoad && getGuardSize(firstLoad, L, false))
+    {
+      return "array-size";
+    }
+    return "missing";
+  }
 
-      average += temp.second;
-      ++line_number;
+  static std::string printValue(const llvm::Value* V, bool asOperand)
+  {
+    std::string S;
+    llvm::raw_string_ostream OS(S);
+    if (asOperand)
+    {
+      V->printAsOperand(OS, false);
     }
+    else
+    {
+      V->print(OS);
+    }
+    return llvm::StringRef(OS.str()).trim().str();
+  }
 
-    return average / static_cast<double>(line_number);
+  static void writeLine(llvm::json::OStream& J, const llvm::DebugLoc& Loc)
+  {
+    if (Loc)
+    {
+      J.attribute("line", Loc.getLine());
+    }
   }
 
-  int ComputeCConst()
+  // The analyze option: one JSON object per loop, on a line of its own, with the candidates rooted
+  // at its induction variables, the accesses in it that aren't candidates and its linked chains.
+  // Nothing is transformed, so the profile only decides whether a site would be prefetched.
+  void writeAnalysis(llvm::Function& F, llvm::LoopInfo& LI, llvm::ArrayRef<llvm::Instruction*> Loads,
+                     llvm::ArrayRef<llvm::Instruction*> Phis, llvm::ArrayRef<llvm::SmallVector<llvm::Instruction*, 8>> Insts,
+                     llvm::ArrayRef<int> Offsets, llvm::ArrayRef<int> MaxOffsets, llvm::ArrayRef<bool> Ignore,
+                     llvm::ArrayRef<std::pair<llvm::Instruction*, const char*>> Rejected,
+                     llvm::ArrayRef<ChainTraversal> Chains, const llvm::MapVector<unsigned, OuterLookAhead>& OuterStages,
+                     llvm::DenseMap<llvm::Loop*, LoopDistanceModel>& Models, int c_const)
   {
-    double cpuSpeed = getCpuClockSpeed();
-    double cores = getTotalCores();
-    double cacheSize = getCacheSize();
-    double ramSize = getRamSize();
-    double pageSize = getPageSize();
-    auto test_ipc = readIPCValue(IPC_INDEX);
-    double average_ipc = getAverageIPCValue();
+    llvm::DenseMap<llvm::Loop*, llvm::SmallVector<unsigned, 4>> Candidates, Others, Traversals;
+    for (unsigned x = 0; x < Loads.size(); x++)
+    {
+      Candidates[LI.getLoopFor(Phis[x]->getParent())].push_back(x);
+    }
+    for (unsigned r = 0; r < Rejected.size(); r++)
+    {
+      Others[LI.getLoopFor(Rejected[r].first->getParent())].push_back(r);
+    }
+    for (unsigned c = 0; c < Chains.size(); c++)
+    {
+      Traversals[LI.getLoopFor(Chains[c].IV->getParent())].push_back(c);
+    }
 
+    for (llvm::Loop* L : LI.getLoopsInPreorder())
+    {
+      llvm::json::OStream J(llvm::outs());
+      J.object([&] {
+        J.attribute("file", llvm_module->getSourceFileName());
+        J.attribute("function", F.getName());
+        J.attribute("loop", printValue(L->getHeader(), true));
+        J.attribute("depth", L->getLoopDepth());
+        writeLine(J, L->getStartLoc());
+
+        auto Model = Models.find(L);
+        if (Model != Models.end())
+        {
+          J.attribute("distance", options.noLoopModel ? c_const : Model->second.distance);
+          J.attribute("cConst", c_const);
+          J.attribute("tripCount", Model->second.tripCount);
+          J.attribute("bodySize", Model->second.bodySize);
+          if (options.loopCost)
+          {
+            J.attribute("cycles", Model->second.cycles);
+          }
+          J.attribute("chainDepth", Model->second.depth);
+        }
 
-    double c_const = K_VALUES[0] * cpuSpeed + K_VALUES[1] * cores + K_VALUES[2] * cacheSize + K_VALUES[3] * ramSize + K_VALUES[4] * pageSize;
-    c_const = c_const + 32.0d * (test_ipc.second - average_ipc);
+        J.attributeArray("candidates", [&] {
+          for (unsigned x : Candidates.lookup(L))
+          {
+            auto* IV = llvm::cast<llvm::PHINode>(Phis[x]);
+            bool guarded = false;
+            SkipReason skip = getSkipReason(Insts[x], Loads[x], IV, L, Ignore[x], false, guarded);
+            llvm::Value* address = getAccessAddress(Loads[x]);
+            auto Stage = OuterStages.find(x);
+            if (Stage != OuterStages.end() && skip == SkipReason::NoSize)
+            {
+              skip = SkipReason::None;
+            }
 
-    if (c_const <= 0.0d)
-    {
-      c_const = 32.0d;
+            J.object([&] {
+              J.attribute("access", printValue(Loads[x], false));
+              J.attribute("kind", getAccessKind(Loads[x]));
+              writeLine(J, Loads[x]->getDebugLoc());
+              J.attribute("iv", printValue(IV, true));
+              J.attribute("ivKind", IV->getType()->isPointerTy() ? "pointer" : "canonical");
+              J.attribute("bound", getBoundSource(Insts[x], IV, L));
+              J.attribute("loads", countMemoryAccesses(Insts[x]));
+              J.attribute("offset", Offsets[x]);
+              J.attribute("maxOffset", MaxOffsets[x]);
+              J.attribute("lookAhead", getLookAheadOffset(Models[L], c_const, Offsets[x], MaxOffsets[x]));
+              if (Stage != OuterStages.end())
+              {
+                int level = Stage->second.startLevels + Offsets[x];
+                J.attribute("outerLookAhead", getLookAheadOffset(Models[Stage->second.outer], c_const, level, MaxOffsets[x]));
+                J.attribute("outerIterations", std::min(Stage->second.iterations, OUTER_LOOKAHEAD_ITERATIONS));
+              }
+              J.attribute("locality", getLocality(address));
+              J.attribute("write", isWriteAccess(Loads[x]) || isWrittenAddress(address));
+              J.attribute("guarded", guarded);
+              J.attribute("skip", skip == SkipReason::NoSize       ? "no-size"
+                                  : skip == SkipReason::StrideOnly ? "stride-only"
+                                  : !isProfiledMiss(getSiteName(F, llvm::Twine(x))) ? "profiled-hit"
+                                  : "none");
+              J.attributeArray("slice", [&] {
+                for (llvm::Instruction* I : Insts[x])
+                {
+                  J.value(printValue(I, false));
+                }
+              });
+            });
+          }
+        });
+
+        J.attributeArray("rejected", [&] {
+          for (unsigned r : Others.lookup(L))
+          {
+            J.object([&] {
+              J.attribute("access", printValue(Rejected[r].first, false));
+              writeLine(J, Rejected[r].first->getDebugLoc());
+              J.attribute("reason", Rejected[r].second);
+            });
+          }
+        });
+
+        J.attributeArray("chains", [&] {
+          for (unsigned c : Traversals.lookup(L))
+          {
+            J.object([&] {
+              J.attribute("node", printValue(Chains[c].node, false));
+              J.attribute("next", printValue(Chains[c].next, false));
+              J.attribute("innerLoop", printValue(Chains[c].loop->getHeader(), true));
+              J.attribute("hops", options.chainHops);
+              J.attribute("skip", isProfiledMiss(getSiteName(F, "chain" + llvm::Twine(c))) ? "none" : "profiled-hit");
+            });
+          }
+        });
+      });
+      llvm::outs() << "\n";
     }
+  }
 
-    std::cout << "cpu speed: " << cpuSpeed << std::endl;
-    std::cout << "cores: " << cores  << std::endl;
-    std::cout << "cache size: " << cacheSize  << std::endl;
-    std::cout << "ram size: " << ramSize  << std::endl;
-    std::cout << "page size: " << pageSize  << std::endl;
-    std::cout << "IPC:" << test_ipc.second << "\n";
-    std::cout << "Average IPC: " << average_ipc << std::endl;
+  int getCConst(llvm::Function& F, llvm::FunctionAnalysisManager& FAM) const
+  {
+    if (!options.computeCConst && options.machineFile.empty())
+    {
+      return options.distance;
+    }
 
-    std::cout << "Calculated C Const Value: " << c_const << " ... will be cast to " << static_cast<int>(c_const) << std::endl;
+    // The pipelines that add the pass require the analysis at module level. A function pipeline that
+    // names the pass on its own can't, and then gets the per-process value.
+    int c_const = 0;
+    auto& MAMProxy = FAM.getResult<llvm::ModuleAnalysisManagerFunctionProxy>(F);
+    auto* CConst = MAMProxy.getCachedResult<MachineCConstAnalysis>(*F.getParent());
+    if (!CConst || !CConst->lookup(options, c_const))
+    {
+      c_const = MachineCConstAnalysis::computeCConst(options);
+    }
 
-    return static_cast<int>(c_const);
+    // An unreadable machine file without compute-c keeps the hard coded C constant.
+    return c_const > 0 ? c_const : options.distance;
   }
-#endif
 
   bool swPrefetchPassImpl(llvm::Function& F, llvm::FunctionAnalysisManager &FAM)
   {
-    // Required to call at the beginning to initialize llvm_module
-    initialize(F);
+    // Required to call at the beginning to initialize llvm_module and SE
+    initialize(F, FAM);
 
     llvm::LoopInfo& LI = FAM.getResult<llvm::LoopAnalysis>(F);
 
     bool modified = false;
 
+    // Loops an earlier run of the pass handled, see PREFETCHED_METADATA.
+    llvm::SmallPtrSet<llvm::Loop*, 4> Prefetched;
+    for(auto& BB : F)
+    {
+      llvm::Loop* L = LI.getLoopFor(&BB);
+      if(!L || Prefetched.count(L))
+      {
+        continue;
+      }
+      for(auto& I : BB)
+      {
+        if(I.getMetadata(PREFETCHED_METADATA))
+        {
+          Prefetched.insert(L);
+          break;
+        }
+      }
+    }
+
     llvm::SmallVector<llvm::Instruction*, 4> Loads;
     llvm::SmallVector<llvm::Instruction*, 4> Phis;
     llvm::SmallVector<int, 4> Offsets;
     llvm::SmallVector<int, 4> MaxOffsets;
     std::vector<llvm::SmallVector<llvm::Instruction*, 8>> Insts;
+    llvm::DenseMap<llvm::Instruction*, unsigned> LoadIndex;
+    std::vector<std::pair<llvm::Instruction*, const char*>> Rejected;
 
     for(auto& BB : F)
     {
+      if(sliceWork > options.sliceBudget)
+      {
+        LLVM_DEBUG(llvm::dbgs() << "Slice budget exhausted in " << F.getName() << "\n");
+        break;
+      }
+
       for (auto& I : BB) 
       {
-        if (llvm::LoadInst* i = llvm::dyn_cast<llvm::LoadInst>(&I)) 
+        if (llvm::isa<llvm::LoadInst>(&I) || isGather(&I) || isPrefetchableStore(&I)) 
         {
-          if(LI.getLoopFor(&BB))
+          llvm::Instruction* i = &I;
+          searchedAccesses.insert(i);
+          if(Prefetched.count(LI.getLoopFor(&BB)))
+          {
+            Rejected.emplace_back(i, "prefetched");
+          }
+          else if(LI.getLoopFor(&BB))
           {
             llvm::SmallVector<llvm::Instruction*, 8> Instrz;
             Instrz.push_back(i);
+
+            // A store is searched from its address, not from the value it writes, and gathers and
+            // scatters from their addresses, not from their masks.
+            llvm::Instruction* from = i;
+            if(!llvm::isa<llvm::LoadInst>(i))
+            {
+              from = llvm::dyn_cast<llvm::Instruction>(getAccessAddress(i));
+              if(!from)
+              {
+                continue;
+              }
+              Instrz.push_back(from);
+            }
+
             llvm::Instruction* phi = nullptr;
-            if(depthFirstSearch(i,LI,phi,Instrz,  Loads, Phis, Insts)) 
+            if(depthFirstSearch(from,LI,phi,Instrz,  LoadIndex, Phis, Insts)) 
             {
-              int loads = 0;
-              for(auto &z : Instrz)
-              {
-                if(llvm::dyn_cast<llvm::LoadInst>(z))
-                {
-                  loads++;
-                }
-              }
+              int loads = countMemoryAccesses(Instrz);
 
               if(loads < 2) 
               {
                 LLVM_DEBUG(llvm::dbgs() << "stride\n");    //don't remove the stride cases yet though. Only remove them once we know it's not in a sequence with an indirect.
-#ifdef NO_STRIDES
-                //add a continue in here to avoid generating strided prefetches. Make sure to reduce the value of C accordingly!
-                continue;
-#endif
+                if (options.noStrides)
+                {
+                  //avoid generating strided prefetches. Make sure to reduce the value of C accordingly!
+                  ORE->emit([&]() {
+                    return llvm::OptimizationRemarkMissed(DEBUG_TYPE, "StridesDisabled", i)
+                           << "strided access not prefetched (no-strides)";
+                  });
+                  Rejected.emplace_back(i, "no-strides");
+                  continue;
+                }
               }
 
               LLVM_DEBUG(llvm::dbgs() << "Can prefetch " << *i << " from PhiNode " << *phi << "\n");
@@ -980,6 +3602,7 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
                 LLVM_DEBUG(llvm::dbgs() << *z << "\n");
               }
 
+              LoadIndex[i] = Loads.size();
               Loads.push_back(i);
               Insts.push_back(Instrz);
               Phis.push_back(phi);
@@ -990,31 +3613,54 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
             else
             {
               LLVM_DEBUG(llvm::dbgs() << "Can't prefetch load" << *i << "\n");
+              ORE->emit([&]() {
+                return llvm::OptimizationRemarkMissed(DEBUG_TYPE, "NoInductionVariable", i)
+                       << "address isn't computable from an induction variable";
+              });
+              Rejected.emplace_back(i, "no-induction-variable");
             }
           }
         }
       }
     }
 
-    for(uint64_t x = 0; x < Loads.size(); x++) 
+    // A load whose slice is contained in a later load's slice is an earlier level of the same chain.
+    // Slices are compared as bit sets, and only against the slices that contain the load itself.
+    llvm::DenseMap<llvm::Instruction*, unsigned> Numbering;
+    for(auto& Slice : Insts)
     {
-      llvm::ValueMap<llvm::Instruction*, llvm::Value*> Transforms;
+      for(auto& in : Slice)
+      {
+        Numbering.try_emplace(in, Numbering.size());
+      }
+    }
 
-      bool ignore = true;
+    std::vector<llvm::BitVector> SliceSets(Loads.size(), llvm::BitVector(Numbering.size()));
+    std::vector<llvm::SmallSetVector<unsigned, 4>> Containing(Loads.size());
+    for(uint64_t y = 0; y < Loads.size(); y++) 
+    {
+      for(auto& in : Insts[y])
+      {
+        SliceSets[y].set(Numbering[in]);
 
-      llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
+        auto Known = LoadIndex.find(in);
+        if(Known != LoadIndex.end() && Known->second < y)
+        {
+          Containing[Known->second].insert(y);
+        }
+      }
+    }
 
+    llvm::SmallVector<bool, 4> Ignore;
+    for(uint64_t x = 0; x < Loads.size(); x++) 
+    {
+      bool ignore = true;
 
-      for(uint64_t y = x + 1; y < Loads.size(); y++) 
+      for(unsigned y : Containing[x]) 
       {
-        bool subset = true;
-        for(auto& in : Insts[x])
-        {
-          if(std::find(Insts[y].begin(), Insts[y].end(), in) == Insts[y].end())
-          {
-            subset = false;
-          }
-        }
+        llvm::BitVector Missing = SliceSets[x];
+        Missing.reset(SliceSets[y]);
+        bool subset = Missing.none();
         if(subset)
         {
           MaxOffsets[x]++;
@@ -1023,38 +3669,252 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
         }
       }
 
-      int loads = 0;
+      Ignore.push_back(ignore);
+    }
+
+    // Offsets[x] is the level of load x in its chain, and Offsets[x]+MaxOffsets[x] the chain's depth.
+    llvm::DenseMap<llvm::Loop*, LoopDistanceModel> Models;
+    llvm::DenseMap<llvm::Loop*, int> Depths;
+    for(uint64_t x = 0; x < Loads.size(); x++) 
+    {
+      llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
+      Depths[L] = std::max(Depths.lookup(L), Offsets[x] + MaxOffsets[x]);
+    }
+
+    std::vector<ChainTraversal> Chains;
+    if(options.chainHops > 0)
+    {
+      Chains = findChainTraversals(LI, LoadIndex, Phis, Insts);
+    }
+    for(auto& chain : Chains)
+    {
+      llvm::Loop* L = LI.getLoopFor(chain.IV->getParent());
+      Depths[L] = std::max(Depths.lookup(L), getChainStartLevels(chain) + static_cast<int>(options.chainHops));
+    }
 
-      llvm::LoadInst* firstLoad = NULL;
+    int c_const = getCConst(F, FAM);
 
-      for(auto& z : Insts[x])
+    // outer-lookahead: candidates of inner loops that run fewer iterations than they would look ahead
+    // are prefetched from the enclosing loop, which gets the loads finding the inner loop as extra levels.
+    llvm::MapVector<unsigned, OuterLookAhead> OuterStages;
+    if(options.outerLookahead && !options.profileGen)
+    {
+      for(uint64_t x = 0; x < Loads.size(); x++)
       {
-        if(llvm::dyn_cast<llvm::LoadInst>(z))
+        llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
+        OuterLookAhead stage;
+        if((Ignore[x] && countMemoryAccesses(Insts[x]) < 2)
+           || !findOuterLookAhead(Insts[x], Loads[x], llvm::cast<llvm::PHINode>(Phis[x]), L, LI, stage))
         {
-          if(!firstLoad)
-          {
-            firstLoad = llvm::dyn_cast<llvm::LoadInst>(z);
-          }
-          loads++;
+          continue;
+        }
+
+        int offset = getLookAheadOffset(computeLoopDistanceModel(L, Depths.lookup(L), c_const), c_const, Offsets[x], MaxOffsets[x]);
+        if(stage.iterations >= static_cast<unsigned>(offset))
+        {
+          continue;
+        }
+
+        LLVM_DEBUG(llvm::dbgs() << "Outer look-ahead of " << *Loads[x] << ", " << stage.iterations << " iterations\n");
+        Depths[stage.outer] = std::max(Depths.lookup(stage.outer), stage.startLevels + Offsets[x] + MaxOffsets[x]);
+        OuterStages[x] = stage;
+      }
+    }
+
+    for(auto& D : Depths)
+    {
+      LoopDistanceModel& model = Models[D.first] = computeLoopDistanceModel(D.first, D.second, c_const);
+      ORE->emit([&]() {
+        llvm::OptimizationRemarkAnalysis R(DEBUG_TYPE, "Distance", D.first->getStartLoc(), D.first->getHeader());
+        if(options.noLoopModel)
+        {
+          return R << "prefetch distance " << llvm::ore::NV("Distance", c_const) << " (C constant)";
+        }
+        R << "prefetch distance " << llvm::ore::NV("Distance", model.distance) << " from C constant "
+          << llvm::ore::NV("CConst", c_const) << ", body of " << llvm::ore::NV("BodySize", model.bodySize)
+          << " instructions";
+        if(options.loopCost)
+        {
+          R << " (" << llvm::ore::NV("Cycles", model.cycles) << " cycles)";
+        }
+        R << " and chains of " << llvm::ore::NV("Depth", model.depth) << " levels";
+        if(model.tripCount)
+        {
+          R << ", trip count " << llvm::ore::NV("TripCount", model.tripCount);
+        }
+        return R;
+      });
+    }
+
+    if(options.analyze)
+    {
+      writeAnalysis(F, LI, Loads, Phis, Insts, Offsets, MaxOffsets, Ignore, Rejected, Chains, OuterStages, Models, c_const);
+      return false;
+    }
+
+    // Loops that get a prefetch, a profile record, an epilogue or an adaptive copy, or are peeled.
+    // Their latches are tagged once they are done.
+    llvm::SmallSetVector<llvm::Loop*, 8> Handled;
+
+    // Loops whose chains would clamp their look-ahead indices are split first, at the furthest
+    // look-ahead of any of those chains. All of them have to step the same induction variable.
+    llvm::SmallPtrSet<llvm::Loop*, 8> Epilogues;
+    if(!options.noEpilogue && !options.ignoreSize && !options.profileGen && !options.adaptive && !options.distanceTable)
+    {
+      llvm::MapVector<llvm::Loop*, std::pair<llvm::PHINode*, int>> Splits;
+      for(uint64_t x = 0; x < Loads.size(); x++)
+      {
+        if(countMemoryAccesses(Insts[x]) < 2 || OuterStages.count(x) || !isProfiledMiss(getSiteName(F, llvm::Twine(x))))
+        {
+          continue;
+        }
+
+        llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
+        auto* IV = llvm::cast<llvm::PHINode>(Phis[x]);
+        int offset = getLookAheadOffset(Models[L], c_const, Offsets[x], MaxOffsets[x]);
+
+        auto Inserted = Splits.insert({L, {IV, offset}});
+        if(!Inserted.second && Inserted.first->second.first != IV)
+        {
+          Inserted.first->second.first = nullptr;
+        }
+        Inserted.first->second.second = std::max(Inserted.first->second.second, offset);
+      }
+
+      for(auto& Split : Splits)
+      {
+        if(Split.second.first && splitEpilogue(Split.first, Split.second.first, Split.second.second, LI))
+        {
+          LLVM_DEBUG(llvm::dbgs() << "Split epilogue of " << Split.first->getName() << " at " << Split.second.second << "\n");
+          ORE->emit([&]() {
+            return llvm::OptimizationRemark(DEBUG_TYPE, "EpilogueSplit", Split.first->getStartLoc(), Split.first->getHeader())
+                   << "split off an epilogue without prefetches for the last "
+                   << llvm::ore::NV("Offset", Split.second.second) << " iterations";
+          });
+          Epilogues.insert(Split.first);
+          Handled.insert(Split.first);
         }
       }
+    }
 
+    // adaptive: every loop whose sites are prefetched gets a descriptor for the runtime, with one
+    // look-ahead per site, and a copy without prefetches. Outer loops are versioned first, so the
+    // copies of inner loops made along with them stay without prefetches too.
+    llvm::DenseMap<unsigned, llvm::Value*> AdaptiveOffsets;
+    if(options.adaptive && !options.profileGen)
+    {
+      llvm::DenseMap<llvm::Loop*, llvm::SmallVector<unsigned, 4>> Sites;
+      for(uint64_t x = 0; x < Loads.size(); x++)
+      {
+        llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
+        bool guarded = false;
+        if(getSkipReason(Insts[x], Loads[x], llvm::cast<llvm::PHINode>(Phis[x]), L, Ignore[x], false, guarded) == SkipReason::None
+           && !OuterStages.count(x) && isProfiledMiss(getSiteName(F, llvm::Twine(x))))
+        {
+          Sites[L].push_back(x);
+        }
+      }
 
-      //loads limited to two on second case, to avoid needing to check bound validity on later loads.
-      if((getCanonicalishSizeVariable(L)) == nullptr) 
+      unsigned adaptiveLoops = 0;
+      for(llvm::Loop* L : LI.getLoopsInPreorder())
       {
-        if(!getArrayOrAllocSize(firstLoad) || loads > 2)
+        auto It = Sites.find(L);
+        if(It == Sites.end())
         {
           continue;
         }
+
+        llvm::SmallVector<int, 4> initial;
+        for(unsigned x : It->second)
+        {
+          initial.push_back(getLookAheadOffset(Models[L], c_const, Offsets[x], MaxOffsets[x]));
+        }
+
+        // Versioning gives L a preheader and dedicated exits first, even when it then can't be versioned.
+        modified |= !L->getLoopPreheader() || !L->hasDedicatedExits();
+        std::vector<llvm::Value*> Loaded = createAdaptiveLoop(L, getSiteName(F, "loop" + llvm::Twine(adaptiveLoops)), initial, LI);
+        for(unsigned k = 0; k < Loaded.size(); k++)
+        {
+          AdaptiveOffsets[It->second[k]] = Loaded[k];
+        }
+        adaptiveLoops += !Loaded.empty();
+        if(!Loaded.empty())
+        {
+          Handled.insert(L);
+        }
+      }
+    }
+
+    for(uint64_t x = 0; x < Loads.size(); x++) 
+    {
+      llvm::ValueMap<llvm::Instruction*, llvm::Value*> Transforms;
+
+      bool ignore = Ignore[x];
+
+      llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
+
+      int loads = countMemoryAccesses(Insts[x]);
+      llvm::LoadInst* firstLoad = getFirstLoad(Insts[x]);
+
+      llvm::PHINode* IV = llvm::cast<llvm::PHINode>(Phis[x]);
+
+      bool guarded = false;
+      SkipReason skip = getSkipReason(Insts[x], Loads[x], IV, L, ignore, Epilogues.count(L), guarded);
+      if(skip == SkipReason::NoSize && !OuterStages.count(x))
+      {
+        ORE->emit([&]() {
+          return llvm::OptimizationRemarkMissed(DEBUG_TYPE, "NoSize", Loads[x])
+                 << "no loop bound or array size to keep the look-ahead loads of a chain of "
+                 << llvm::ore::NV("Depth", loads) << " in range";
+        });
+        continue;
       }
 
-      if(loads < 2 && ignore)
+      if(skip == SkipReason::StrideOnly)
       {
         LLVM_DEBUG(llvm::dbgs() << "Ignoring" << *(Loads[x]) << "\n");
+        ORE->emit([&]() {
+          return llvm::OptimizationRemarkMissed(DEBUG_TYPE, "StrideOnly", Loads[x])
+                 << "strided access without dependent indirect accesses left to the hardware prefetcher";
+        });
         continue; //remove strides with no dependent indirects.
       }
 
+      // profile-gen only records where the sites go, profile-use drops the sites that didn't miss.
+      std::string site = getSiteName(F, llvm::Twine(x));
+      if(options.profileGen)
+      {
+        createProfileRecord(site, Loads[x], getAccessAddress(Loads[x]));
+        Handled.insert(L);
+        continue;
+      }
+      if(!isProfiledMiss(site))
+      {
+        ORE->emit([&]() {
+          return llvm::OptimizationRemarkMissed(DEBUG_TYPE, "ProfiledHit", Loads[x])
+                 << "site " << llvm::ore::NV("Site", site) << " doesn't miss often enough in the profile";
+        });
+        continue;
+      }
+
+      auto Stage = OuterStages.find(x);
+      if(Stage != OuterStages.end())
+      {
+        llvm::Loop* Outer = Stage->second.outer;
+        int level = Stage->second.startLevels + Offsets[x];
+        int offset = std::max(getLookAheadOffset(Models[Outer], c_const, level, MaxOffsets[x]), 1);
+        prefetchOuterLookAhead(Stage->second, Insts[x], Loads[x], IV, L, offset, LI);
+        Handled.insert(Outer);
+        ORE->emit([&]() {
+          return llvm::OptimizationRemark(DEBUG_TYPE, "OuterLookAhead", Loads[x])
+                 << "prefetched " << getAccessKind(Loads[x]) << " for the first "
+                 << llvm::ore::NV("Iterations", std::min(Stage->second.iterations, OUTER_LOOKAHEAD_ITERATIONS))
+                 << " iterations of the inner loop " << llvm::ore::NV("Distance", offset)
+                 << " iterations of the enclosing loop ahead, level " << llvm::ore::NV("Level", level) << " of a chain of "
+                 << llvm::ore::NV("Depth", level + MaxOffsets[x]);
+        });
+        continue;
+      }
 
       llvm::IRBuilder<> Builder(Loads[x]);
 
@@ -1088,108 +3948,90 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
 
           llvm::Loop* L = LI.getLoopFor(Phis[x]->getParent());
 
-          int c_const = 0;
-
-#ifdef COMPUTE_C_CONST
-          c_const = ComputeCConst();
-#else
-          c_const = C_CONSTANT;
-#endif
+          int offset = getLookAheadOffset(Models[L], c_const, Offsets[x], MaxOffsets[x]);
 
-          int offset = (c_const*MaxOffsets[x])/(MaxOffsets[x]+Offsets[x]);
+          llvm::Value* runtimeOffset = AdaptiveOffsets.lookup(x);
+          if(!runtimeOffset && options.distanceTable)
+          {
+            runtimeOffset = createTableOffset(site, offset, L, LI);
+          }
 
-          if(z == getCanonicalishInductionVariable(L))
+          if(runtimeOffset)
+          {
+            n = llvm::dyn_cast<llvm::Instruction>(createLookAhead(Builder, IV, L, runtimeOffset));
+          }
+          else
           {
-            n = llvm::dyn_cast<llvm::Instruction>(Builder.CreateAdd(Phis[x],
-                                                                    Phis[x]->getType()->isIntegerTy(64) ? llvm::ConstantInt::get(llvm::Type::getInt64Ty(llvm_module->getContext()), offset) 
-                                                                                                        : llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), offset)));
+            n = llvm::dyn_cast<llvm::Instruction>(createLookAhead(Builder, IV, L, offset));
+          }
+          weird = IV->getType()->isPointerTy();
 #ifdef BROKEN
-            n = llvm::dyn_cast<llvm::Instruction>(Builder.CreateAnd(n, 1));
+          n = llvm::dyn_cast<llvm::Instruction>(Builder.CreateAnd(n, 1));
 #endif
-          }
-          else if (z == getWeirdCanonicalishInductionVariable(L))
+
+          for(bool changed = true; LI.getLoopFor(Phis[x]->getParent()) != LI.getLoopFor(n->getParent()) && changed;)
           {
-            //This covers code where a pointer is incremented, instead of a canonical induction variable.
+            llvm::Loop* ol = LI.getLoopFor(n->getParent());
 
-            n = getWeirdCanonicalishInductionVariableGep(L)->clone();
-            Builder.Insert(n);
-            n->setOperand(n->getNumOperands()-1, llvm::ConstantInt::get(llvm::Type::getInt64Ty(llvm_module->getContext()), offset));
-            weird = true;
+            makeLoopInvariantSpec(n, changed, LI.getLoopFor(n->getParent()));
 
-            bool changed = true;
-            while(LI.getLoopFor(Phis[x]->getParent()) != LI.getLoopFor(n->getParent()) && changed)
+            if(ol && ol == LI.getLoopFor(n->getParent()))
             {
-              llvm::Loop* ol = LI.getLoopFor(n->getParent());
-
-              makeLoopInvariantSpec(n, changed, LI.getLoopFor(n->getParent()));
-
-              if(ol && ol == LI.getLoopFor(n->getParent()))
-              {
-                break;
-              }
+              break;
             }
           }
 
           assert(L);
           assert(n);
 
-          llvm::Value* size = getCanonicalishSizeVariable(L);
-          if(!size) 
-          {
-            size = getArrayOrAllocSize(firstLoad);
-          }
-          assert(size);
-          std::string type_str;
-          llvm::raw_string_ostream rso(type_str);
-          size->getType()->print(rso);
-          rso.flush();
-        
-          if(loads< 2 || !size || !size->getType()->isIntegerTy() || IGNORE_SIZE)
+          // Without a known direction there is no way to tell which end of the loop to clamp to.
+          const llvm::SCEV* Step = getInductionStep(IV, L);
+          bool countsDown = SE->isKnownNegative(Step);
+          bool countsUp = SE->isKnownPositive(Step);
+
+          if(loads < 2 || options.ignoreSize || (!countsUp && !countsDown) || Epilogues.count(L))
           {
             Transforms.insert(std::pair<llvm::Instruction*, llvm::Instruction*>(z,n));
             continue;
           }
 
-          llvm::Instruction* mod;
+          llvm::Instruction* mod = nullptr;
 
-          if(weird)
+          if(llvm::Value* last = getLastInductionValue(IV, L))
           {
-            //This covers code where a pointer is incremented, instead of a canonical induction variable.
-
-            llvm::Instruction* endcast = llvm::dyn_cast<llvm::Instruction>(Builder.CreatePtrToInt(size, llvm::Type::getInt64Ty(llvm_module->getContext())));
-
-            llvm::Instruction* startcast = llvm::dyn_cast<llvm::Instruction>(Builder.CreatePtrToInt(getWeirdCanonicalishInductionVariableFirst(L), llvm::Type::getInt64Ty(llvm_module->getContext())));
-
-            llvm::Instruction* valcast =  llvm::dyn_cast<llvm::Instruction>(Builder.CreatePtrToInt(n, llvm::Type::getInt64Ty(llvm_module->getContext())));
-
-
-            llvm::Instruction* sub1 = llvm::dyn_cast<llvm::Instruction>(Builder.CreateSub(valcast, startcast));
-            llvm::Instruction* sub2 = llvm::dyn_cast<llvm::Instruction>(Builder.CreateSub(endcast, startcast));
+            mod = createClampToLast(Builder, n, last, countsDown);
+          }
+          else
+          {
+            // Fall back to the bound of the exit comparison, or the size of the indexed array. Counting
+            // down, the array bounds the look-ahead index from below instead, at its first element.
+            llvm::Value* size = getCanonicalishSizeVariable(L);
+            if(!size && firstLoad && countsDown)
+            {
+              size = getGuardSize(firstLoad, L, false) ? llvm::ConstantInt::get(n->getType(), 0) : nullptr;
+            }
+            else if(!size && firstLoad)
+            {
+              size = getGuardSize(firstLoad, L);
+            }
 
-            llvm::Value* cmp = Builder.CreateICmp(llvm::CmpInst::ICMP_SLT, sub1, sub2);
-            llvm::Instruction* rem = llvm::dyn_cast<llvm::Instruction>(Builder.CreateSelect(cmp, sub1, sub2));
+            if(!size || !size->getType()->isIntegerTy() || weird)
+            {
+              Transforms.insert(std::pair<llvm::Instruction*, llvm::Instruction*>(z,n));
+              continue;
+            }
 
-            llvm::Instruction* add = llvm::dyn_cast<llvm::Instruction>(Builder.CreateAdd(rem, startcast));
+            if(size->getType() != n->getType())
+            {
+              llvm::Instruction* cast = llvm::CastInst::CreateIntegerCast(size, n->getType(), true);
+              assert(cast);
+              Builder.Insert(cast);
+              size = cast;
+            }
 
-            mod = llvm::dyn_cast<llvm::Instruction>(Builder.CreateIntToPtr(add, n->getType()));
-          }
-          else if(size->getType() != n->getType())
-          {
-            llvm::Instruction* cast = llvm::CastInst::CreateIntegerCast(size, n->getType(), true);
-            assert(cast);
-            Builder.Insert(cast);
-            llvm::Value* sub = Builder.CreateSub(cast, llvm::ConstantInt::get(llvm::Type::getInt64Ty(llvm_module->getContext()), 1));
-            llvm::Value* cmp = Builder.CreateICmp(llvm::CmpInst::ICMP_SLT, sub, n);
-            mod = llvm::dyn_cast<llvm::Instruction>(Builder.CreateSelect(cmp, sub, n));
-          } 
-          else 
-          {
-            llvm::Value* sub = Builder.CreateSub(size, llvm::ConstantInt::get(n->getType(), 1));
-            llvm::Value* cmp = Builder.CreateICmp(llvm::CmpInst::ICMP_SLT, sub, n);
-            mod = llvm::dyn_cast<llvm::Instruction>(Builder.CreateSelect(cmp, sub, n));
+            mod = createClamp(Builder, n, size, countsDown);
           }
 
-
           bool changed = true;
           while(LI.getLoopFor(Phis[x]->getParent()) != LI.getLoopFor(mod->getParent()) && changed)
           {
@@ -1202,49 +4044,43 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
           }
 
           Transforms.insert(std::pair<llvm::Instruction*, llvm::Instruction*>(z, mod));
-          modified = true;
         } 
         else if (z == Loads[x])
         {
-          assert(Loads[x]->getOperand(0));
+          llvm::Value* address = getAccessAddress(Loads[x]);
+          assert(address);
 
-          llvm::Instruction* oldGep = llvm::dyn_cast<llvm::Instruction>(Loads[x]->getOperand(0));
+          llvm::Instruction* oldGep = llvm::dyn_cast<llvm::Instruction>(address);
           assert(oldGep);
 
           assert(Transforms.lookup(oldGep));
           llvm::Instruction* gep = llvm::dyn_cast<llvm::Instruction>(Transforms.lookup(oldGep));
           assert(gep);
-          modified = true;
-
+          Handled.insert(L);
 
-          llvm::Instruction* cast = llvm::dyn_cast<llvm::Instruction>(Builder.CreateBitCast (gep, llvm::Type::getInt8PtrTy(llvm_module->getContext())));
-
-          bool changed = true;
-          while(LI.getLoopFor(Phis[x]->getParent()) != LI.getLoopFor(cast->getParent()) && changed) 
+          bool write = isWriteAccess(Loads[x]) || isWrittenAddress(address);
+          for(llvm::Instruction* cast : createLineAddresses(Builder, gep, Loads[x]))
           {
-            llvm::Loop* ol = LI.getLoopFor(cast->getParent());
-            makeLoopInvariantSpec(cast,changed,ol);
-            if(ol && ol == LI.getLoopFor(cast->getParent()))
+            bool changed = true;
+            while(LI.getLoopFor(Phis[x]->getParent()) != LI.getLoopFor(cast->getParent()) && changed) 
             {
-              break;
+              llvm::Loop* ol = LI.getLoopFor(cast->getParent());
+              makeLoopInvariantSpec(cast,changed,ol);
+              if(ol && ol == LI.getLoopFor(cast->getParent()))
+              {
+                break;
+              }
             }
-          }
-
-
-          llvm::Value* ar[] = { cast,
-                                llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), 0),
-                                llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), 3),
-                                llvm::ConstantInt::get(llvm::Type::getInt32Ty(llvm_module->getContext()), 1) };
-          
-          llvm::ArrayRef<llvm::Type*> art = { llvm::Type::getInt8PtrTy(llvm_module->getContext()) };
-          
-          llvm::Function* fun = llvm::Intrinsic::getDeclaration(llvm_module, llvm::Intrinsic::prefetch, art);
-
-          assert(fun);
-
-          llvm::CallInst* call = llvm::CallInst::Create(fun,ar);
 
-          call->insertBefore(cast->getParent()->getTerminator());
+            createPrefetch(cast, cast->getParent()->getTerminator(), write, getLocality(address), Loads[x]->getDebugLoc());
+          }
+          ORE->emit([&]() {
+            return llvm::OptimizationRemark(DEBUG_TYPE, "Prefetched", Loads[x])
+                   << "prefetched " << getAccessKind(Loads[x]) << " "
+                   << llvm::ore::NV("Distance", getLookAheadOffset(Models[L], c_const, Offsets[x], MaxOffsets[x]))
+                   << " iterations ahead, level " << llvm::ore::NV("Level", Offsets[x]) << " of a chain of "
+                   << llvm::ore::NV("Depth", Offsets[x] + MaxOffsets[x]) << (write ? " with write intent" : "");
+          });
 
         } 
         else if(llvm::PHINode* pn = llvm::dyn_cast<llvm::PHINode>(z)) 
@@ -1285,6 +4121,16 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
             }
           }
 
+          llvm::LoadInst* l = llvm::dyn_cast<llvm::LoadInst>(z);
+          if(guarded && l && l != firstLoad)
+          {
+            auto* gep = llvm::dyn_cast<llvm::GetElementPtrInst>(llvm::cast<llvm::LoadInst>(n)->getPointerOperand());
+            if(gep && gep != l->getPointerOperand())
+            {
+              createChainGuard(gep, getGuardSize(l, L));
+            }
+          }
+
           n->insertBefore(Loads[x]);
 
           bool changed = true;
@@ -1304,47 +4150,270 @@ struct SwPrefetchPass : public llvm::PassInfoMixin<SwPrefetchPass> {
           }
 
           Transforms.insert(std::pair<llvm::Instruction*, llvm::Instruction*>(z,n));
-          modified = true;
         }
       }
     }
 
-    return modified;
+    // Elements of linked chains beyond the first. The first element is prefetched like any other
+    // indirect access, and the walk to the later ones starts a hop's share of its distance closer.
+    // Chains are profiled as a site of their own: the loads of their later elements.
+    for(unsigned c = 0; c < Chains.size(); c++)
+    {
+      auto& chain = Chains[c];
+      std::string site = getSiteName(F, "chain" + llvm::Twine(c));
+      if(options.profileGen)
+      {
+        createProfileRecord(site, chain.next, chain.next->getPointerOperand());
+        Handled.insert(chain.loop);
+        continue;
+      }
+      if(!isProfiledMiss(site))
+      {
+        ORE->emit([&]() {
+          return llvm::OptimizationRemarkMissed(DEBUG_TYPE, "ProfiledHit", chain.next)
+                 << "site " << llvm::ore::NV("Site", site) << " doesn't miss often enough in the profile";
+        });
+        continue;
+      }
+
+      llvm::Loop* L = LI.getLoopFor(chain.IV->getParent());
+      int first = getChainStartLevels(chain);
+      int element = options.noLoopModel ? c_const/first : getLevelOffset(Models[L], first-1, first);
+
+      int offset = (element*options.chainHops)/(options.chainHops+1);
+      prefetchChainHops(chain, options.chainHops, std::max(offset, 1), LI);
+      Handled.insert(L);
+      ORE->emit([&]() {
+        return llvm::OptimizationRemark(DEBUG_TYPE, "ChainPrefetched", chain.next)
+               << "prefetched " << llvm::ore::NV("Hops", options.chainHops) << " more elements of the chain for a later "
+               << "iteration of the enclosing loop";
+      });
+    }
+
+    Handled.insert(peeled.begin(), peeled.end());
+    for(llvm::Loop* L : Handled)
+    {
+      if(llvm::BasicBlock* Latch = L->getLoopLatch())
+      {
+        markPrefetched(Latch);
+      }
+    }
+    if(!Handled.empty())
+    {
+      F.addFnAttr(PREFETCHED_ATTRIBUTE);
+    }
+
+    return modified || !Handled.empty();
   }
 
   llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM) 
   {
-    std::cout << "Hello function: " << F.getName().str() << std::endl;
+    // See PREFETCHED_ATTRIBUTE.
+    if (!options.analyze && F.hasFnAttribute(PREFETCHED_ATTRIBUTE))
+    {
+      return llvm::PreservedAnalyses::all();
+    }
 
     bool modified = swPrefetchPassImpl(F, FAM);
-
-    std::cout << "Modified: " << modified << std::endl;
-
     auto ret = modified ? llvm::PreservedAnalyses::none() : llvm::PreservedAnalyses::all();
     return ret;
   }
 
+  SwPrefetchPass(SwPrefetchOptions Options = SwPrefetchOptions()) : options(std::move(Options))
+  {
+  }
+
   // members
+  SwPrefetchOptions options;
   llvm::Module* llvm_module = nullptr;
+  llvm::ScalarEvolution* SE = nullptr;
+  llvm::DominatorTree* DT = nullptr;
+  llvm::LoopInfo* Loops = nullptr;
+  llvm::OptimizationRemarkEmitter* ORE = nullptr;
+  llvm::TargetTransformInfo* TTI = nullptr;
+  llvm::DenseMap<llvm::PHINode*, llvm::Value*> lastValues;
+  llvm::DenseMap<llvm::Value*, llvm::Value*> firstValues;
+  llvm::SmallPtrSet<llvm::Loop*, 4> peeled;
+  llvm::DenseMap<llvm::Instruction*, SliceInfo> slices;
+  llvm::SmallPtrSet<llvm::Instruction*, 32> searchedAccesses;  // accesses that are candidates, or never will be
+  unsigned sliceWork = 0;
 };
 }
 
+// Matches "sw-prefetch", "sw-prefetch<params>" and the original "func-name", and parses the options.
+// Names are offered to the module and the function callbacks, so only one of them reports errors.
+bool parseSwPrefetchPassName(llvm::StringRef Name, SwPrefetchOptions& Options, bool ReportErrors)
+{
+  if (Name == "func-name" || Name == "sw-prefetch")
+  {
+    Options = SwPrefetchOptions();
+    return true;
+  }
+
+  if (!Name.consume_front("sw-prefetch<") || !Name.consume_back(">"))
+  {
+    return false;
+  }
+
+  auto Parsed = parseSwPrefetchOptions(Name);
+  if (!Parsed)
+  {
+    std::string Message = llvm::toString(Parsed.takeError());
+    if (ReportErrors)
+    {
+      llvm::errs() << Message << "\n";
+    }
+    return false;
+  }
+
+  Options = *Parsed;
+  return true;
+}
+
+// Settings of the runs the default pipelines add: the -sw-prefetch-* flags, overridden by pipeline
+// parameters in SWPF_PASS_OPTIONS. Linkers load pass plugins after they have parsed their -mllvm
+// flags, so that is the only way to configure the run of an LTO link.
+SwPrefetchOptions getPipelineOptions()
+{
+  const char* Params = std::getenv("SWPF_PASS_OPTIONS");
+  if (!Params || !*Params)
+  {
+    return SwPrefetchOptions();
+  }
+
+  auto Parsed = parseSwPrefetchOptions(Params);
+  if (!Parsed)
+  {
+    llvm::report_fatal_error(llvm::Twine("SWPF_PASS_OPTIONS: ") + llvm::toString(Parsed.takeError()), false);
+  }
+  return *Parsed;
+}
+
+// Builds with assertions verify the IR after every run of the pass. Release builds leave that to the
+// verifier at the end of the pipeline.
+void addSwPrefetchPass(llvm::FunctionPassManager& FPM, const SwPrefetchOptions& Options)
+{
+  FPM.addPass(SwPrefetchPass(Options));
+#ifndef NDEBUG
+  FPM.addPass(llvm::VerifierPass());
+#endif
+}
+
 extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK llvmGetPassPluginInfo() {
   return {
     LLVM_PLUGIN_API_VERSION, "SwPrefetchPass", "v0.1",
     [](llvm::PassBuilder &PB) {
+      auto Requests = std::make_shared<MachineCConstAnalysis::Requests::element_type>();
+      PB.registerAnalysisRegistrationCallback(
+        [Requests](llvm::ModuleAnalysisManager &MAM) {
+          MAM.registerPass([Requests] { return MachineCConstAnalysis(Requests); });
+        }
+      );
+      PB.registerPipelineParsingCallback(
+        [Requests](llvm::StringRef Name, llvm::ModulePassManager &MPM,
+        llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+          SwPrefetchOptions Options;
+          if(parseSwPrefetchPassName(Name, Options, false)){
+            if (Options.computeCConst || !Options.machineFile.empty())
+            {
+              MachineCConstAnalysis::request(Requests, Options);
+              MPM.addPass(llvm::RequireAnalysisPass<MachineCConstAnalysis, llvm::Module>());
+            }
+            llvm::FunctionPassManager FPM;
+            addSwPrefetchPass(FPM, Options);
+            MPM.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(FPM)));
+            return true;
+          }
+          return false;
+        }
+      );
       PB.registerPipelineParsingCallback(
-        [](llvm::StringRef Name, llvm::FunctionPassManager &FPM,
+        [Requests](llvm::StringRef Name, llvm::FunctionPassManager &FPM,
         llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
-          if(Name == "func-name"){
+          SwPrefetchOptions Options;
+          if(parseSwPrefetchPassName(Name, Options, true)){
+            MachineCConstAnalysis::request(Requests, Options);
             // FPM.addPass(llvm::LoopUnrollPass());
-            FPM.addPass(SwPrefetchPass());
-            FPM.addPass(llvm::VerifierPass());
+            addSwPrefetchPass(FPM, Options);
             return true;
           }
           return false;
         }
       );
+
+      // The default pipelines run the pass with the settings of getPipelineOptions, at the position
+      // -sw-prefetch-position selects. Prefetches only cost size, so -O0, -Os and -Oz are left alone.
+      auto Enabled = [](llvm::OptimizationLevel Level, SwPrefetchPosition Position) {
+        return ClPosition == Position && Level.getSpeedupLevel() > 0 && Level.getSizeLevel() == 0;
+      };
+
+      // The function pipelines the pass joins can't require the C constant, so the module pipeline
+      // requires it when it starts. ThinLTO backends don't call the pipeline start callbacks, and from
+      // LLVM 15 require it at the start of the optimization pipeline instead, before vectorizer-start.
+      auto RequireCConst = [Requests](llvm::ModulePassManager &MPM) {
+        SwPrefetchOptions Options = getPipelineOptions();
+        if (Options.computeCConst || !Options.machineFile.empty())
+        {
+          MachineCConstAnalysis::request(Requests, Options);
+          MPM.addPass(llvm::RequireAnalysisPass<MachineCConstAnalysis, llvm::Module>());
+        }
+      };
+      PB.registerPipelineStartEPCallback(
+        [Enabled, RequireCConst](llvm::ModulePassManager &MPM, llvm::OptimizationLevel Level) {
+          if(Enabled(Level, SwPrefetchPosition::ScalarOptimizerLate) || Enabled(Level, SwPrefetchPosition::VectorizerStart)){
+            RequireCConst(MPM);
+          }
+        }
+      );
+#if LLVM_VERSION_MAJOR >= 15
+      PB.registerOptimizerEarlyEPCallback(
+        [Enabled, RequireCConst](llvm::ModulePassManager &MPM, llvm::OptimizationLevel Level) {
+          if(Enabled(Level, SwPrefetchPosition::VectorizerStart)){
+            RequireCConst(MPM);
+          }
+        }
+      );
+#endif
+      PB.registerScalarOptimizerLateEPCallback(
+        [Enabled](llvm::FunctionPassManager &FPM, llvm::OptimizationLevel Level) {
+          if(Enabled(Level, SwPrefetchPosition::ScalarOptimizerLate)){
+            addSwPrefetchPass(FPM, getPipelineOptions());
+          }
+        }
+      );
+      PB.registerVectorizerStartEPCallback(
+        [Enabled](llvm::FunctionPassManager &FPM, llvm::OptimizationLevel Level) {
+          if(Enabled(Level, SwPrefetchPosition::VectorizerStart)){
+            addSwPrefetchPass(FPM, getPipelineOptions());
+          }
+        }
+      );
+      PB.registerOptimizerLastEPCallback(
+        [Enabled, RequireCConst](llvm::ModulePassManager &MPM, llvm::OptimizationLevel Level) {
+          if(Enabled(Level, SwPrefetchPosition::OptimizerLast)){
+            RequireCConst(MPM);
+            llvm::FunctionPassManager FPM;
+            addSwPrefetchPass(FPM, getPipelineOptions());
+            MPM.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(FPM)));
+          }
+        }
+      );
+
+      // ThinLTO backends run the optimization pipeline, and the positions above with it. The full LTO
+      // pipeline doesn't, so it runs the pass at its end, on the merged program with callees from other
+      // translation units inlined and their allocation sizes and bounds propagated.
+#if LLVM_VERSION_MAJOR >= 15
+      PB.registerFullLinkTimeOptimizationLastEPCallback(
+        [RequireCConst](llvm::ModulePassManager &MPM, llvm::OptimizationLevel Level) {
+          if(ClPosition != SwPrefetchPosition::None && Level.getSpeedupLevel() > 0 && Level.getSizeLevel() == 0){
+            RequireCConst(MPM);
+            llvm::FunctionPassManager FPM;
+            addSwPrefetchPass(FPM, getPipelineOptions());
+            MPM.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(FPM)));
+          }
+        }
+      );
+#endif
     }
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+; adaptive versions a loop on the prefetch flag of its descriptor. The preheader tells the runtime
+; the loop was entered and how many iterations it runs, the prefetching version reads its
+; look-aheads from the descriptor's offsets, and both versions leave through a call to the runtime.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<adaptive>' -S %s | %FileCheck %s
+
+; CHECK: @swpf.offsets = internal global [2 x i32] [i32 [[OFF0:[0-9]+]], i32 [[OFF1:[0-9]+]]]
+; CHECK: @swpf.initial = private constant [2 x i32] [i32 [[OFF0]], i32 [[OFF1]]]
+; CHECK: @swpf.name = private constant [{{[0-9]+}} x i8] c"{{.*}}:gather:loop0\00"
+; CHECK: @swpf.loop = internal global { i32, i32, i8*, i8*, i8*, i8* } { i32 1, i32 2,
+
+; CHECK-LABEL: @gather(
+; CHECK: ph:
+; CHECK-NEXT: call void @__swpf_loop_enter(i8* bitcast ({{.*}} @swpf.loop to i8*), i64 %n)
+; CHECK-NEXT: %swpf.prefetch = load i32, i32* getelementptr inbounds ({{.*}} @swpf.loop, i32 0, i32 0)
+; CHECK-NEXT: %[[ON:[0-9]+]] = icmp ne i32 %swpf.prefetch, 0
+; CHECK-NEXT: br i1 %[[ON]], label %ph.split, label %ph.split.noprefetch
+; CHECK: loop.noprefetch:
+; CHECK-NOT: call void @llvm.prefetch
+; CHECK: br i1 %done.noprefetch, label %exit.loopexit, label %loop.noprefetch
+; CHECK: ph.split:
+; CHECK-NEXT: %swpf.offset = load i32, i32* getelementptr inbounds ([2 x i32], [2 x i32]* @swpf.offsets, i32 0, i32 0)
+; CHECK-NEXT: %[[AHEAD:[0-9]+]] = sext i32 %swpf.offset to i64
+; CHECK: loop:
+; CHECK: add i64 %i, %[[AHEAD]]
+; CHECK: call void @llvm.prefetch
+; CHECK: exit.loopexit:
+; CHECK-NEXT: %sum.next.lcssa = phi i64 [ %sum.next, %loop ], [ %sum.next.noprefetch, %loop.noprefetch ]
+; CHECK-NEXT: call void @__swpf_loop_exit(i8* bitcast ({{.*}} @swpf.loop to i8*))
+; CHECK: declare void @__swpf_loop_exit(i8*)
+; CHECK: declare void @__swpf_loop_enter(i8*, i64)
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @gather(i32* %a, i64* %b, i64 %n) {
+entry:
+  %enter = icmp sgt i64 %n, 0
+  br i1 %enter, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %sum = phi i64 [ 0, %ph ], [ %sum.next, %loop ]
+  %pa = getelementptr inbounds i32, i32* %a, i64 %i
+  %v = load i32, i32* %pa, align 4
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds i64, i64* %b, i64 %idx
+  %w = load i64, i64* %pb, align 8
+  %sum.next = add i64 %sum, %w
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit.loopexit, label %loop
+
+exit.loopexit:
+  br label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %sum.next, %exit.loopexit ]
+  ret i64 %r
+}
@@ -0,0 +1,65 @@
+; Loops without a bound clamp the look-ahead index of a chain to the size of the array it reads.
+; An `alloca [1000 x i32]` has an array size of 1, so the count comes from the allocated type, and
+; for a dynamic alloca from its bytes in elements of the indexed type.
+; RUN: %opt -opaque-pointers -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s
+
+; CHECK-LABEL: @stack(
+; CHECK: %[[CMP:[0-9]+]] = icmp slt i64 999, %[[AHEAD:[0-9]+]]
+; CHECK-NEXT: %[[IDX:[0-9]+]] = select i1 %[[CMP]], i64 999, i64 %[[AHEAD]]
+; CHECK-NEXT: getelementptr inbounds i32, ptr %a, i64 %[[IDX]]
+
+; CHECK-LABEL: @dynamic(
+; CHECK: %[[BYTES:[0-9]+]] = mul i64 %n, 64
+; CHECK-NEXT: %[[COUNT:[0-9]+]] = udiv i64 %[[BYTES]], 4
+; CHECK: %[[LAST:[0-9]+]] = sub i64 %[[COUNT]], 1
+; CHECK-NEXT: %[[DCMP:[0-9]+]] = icmp slt i64 %[[LAST]], %[[DAHEAD:[0-9]+]]
+; CHECK-NEXT: %[[DIDX:[0-9]+]] = select i1 %[[DCMP]], i64 %[[LAST]], i64 %[[DAHEAD]]
+; CHECK-NEXT: getelementptr inbounds i32, ptr %a, i64 %[[DIDX]]
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@b = global [4096 x i32] zeroinitializer
+
+declare void @fill(ptr)
+
+define i32 @stack() {
+entry:
+  %a = alloca [1000 x i32], align 16
+  call void @fill(ptr %a)
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr inbounds i32, ptr %a, i64 %i
+  %v = load i32, ptr %pa, align 4
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds [4096 x i32], ptr @b, i64 0, i64 %idx
+  %w = load i32, ptr %pb, align 4
+  %found = icmp eq i32 %w, 42
+  %i.next = add nuw nsw i64 %i, 1
+  br i1 %found, label %exit, label %loop
+
+exit:
+  ret i32 %v
+}
+
+define i32 @dynamic(i64 %n) {
+entry:
+  %a = alloca [16 x i32], i64 %n, align 16
+  call void @fill(ptr %a)
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr inbounds i32, ptr %a, i64 %i
+  %v = load i32, ptr %pa, align 4
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds [4096 x i32], ptr @b, i64 0, i64 %idx
+  %w = load i32, ptr %pb, align 4
+  %found = icmp eq i32 %w, 42
+  %i.next = add nuw nsw i64 %i, 1
+  br i1 %found, label %exit, label %loop
+
+exit:
+  ret i32 %v
+}
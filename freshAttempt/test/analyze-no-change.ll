@@ -0,0 +1,36 @@
+; The bound of the loop is loaded in the loop. Analyze mode reports it as the exit-compare bound of
+; the chain but must not hoist the load while finding it, or any other instruction.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<analyze>' -S %s | %FileCheck %s
+
+; CHECK: "bound":"exit-compare"
+; CHECK-LABEL: @loaded_bound(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: br label %loop
+; CHECK: %i.next = add nuw nsw i64 %i, 1
+; CHECK-NEXT: %n = load i64, i64* %np
+; CHECK-NEXT: %cont = icmp slt i64 %i.next, %n
+; CHECK-NOT: call void @llvm.prefetch
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @loaded_bound(i32* %a, i64* %b, i64* %np) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %sum = phi i64 [ 0, %entry ], [ %sum.next, %loop ]
+  %pa = getelementptr inbounds i32, i32* %a, i64 %i
+  %v = load i32, i32* %pa
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds i64, i64* %b, i64 %idx
+  %w = load i64, i64* %pb
+  %sum.next = add i64 %sum, %w
+  %i.next = add nuw nsw i64 %i, 1
+  %n = load i64, i64* %np
+  %cont = icmp slt i64 %i.next, %n
+  br i1 %cont, label %loop, label %exit
+
+exit:
+  ret i64 %sum.next
+}
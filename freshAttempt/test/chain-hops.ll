@@ -0,0 +1,88 @@
+; Three hops of the bucket chain are prefetched by one walk from the first element of a later
+; iteration: the first element is recomputed once, and every hop loads the next element from the
+; one before it behind one test of the loop's end condition, then prefetches the fields the loop
+; reads from it.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<chain-hops=3>' -S %s | %FileCheck %s
+
+; CHECK-LABEL: @probe(
+; CHECK: %[[T0:[0-9]+]] = icmp ne %bucket* %[[B0:[0-9]+]], null
+; CHECK-NEXT: br i1 %[[T0]], label %[[HOP1:[0-9]+]], label %[[END:[0-9]+]]
+; CHECK: [[HOP1]]:
+; CHECK-NEXT: %[[N1:[0-9]+]] = getelementptr inbounds %bucket, %bucket* %[[B0]], i64 0, i32 3
+; CHECK-NEXT: %[[B1:[0-9]+]] = load %bucket*, %bucket** %[[N1]]
+; CHECK-NEXT: %[[T1:[0-9]+]] = icmp ne %bucket* %[[B1]], null
+; CHECK-NEXT: br i1 %[[T1]], label %[[HOP2:[0-9]+]], label
+; CHECK: [[HOP2]]:
+; CHECK-NEXT: getelementptr inbounds %bucket, %bucket* %[[B1]], i64 0, i32 1
+; CHECK-NEXT: bitcast
+; CHECK-NEXT: call void @llvm.prefetch
+; CHECK-NEXT: getelementptr inbounds %bucket, %bucket* %[[B1]], i64 0, i32 3
+; CHECK-NEXT: bitcast
+; CHECK-NEXT: call void @llvm.prefetch
+; CHECK-NEXT: %[[N2:[0-9]+]] = getelementptr inbounds %bucket, %bucket* %[[B1]], i64 0, i32 3
+; CHECK-NEXT: %[[B2:[0-9]+]] = load %bucket*, %bucket** %[[N2]]
+; CHECK-NEXT: %[[T2:[0-9]+]] = icmp ne %bucket* %[[B2]], null
+; CHECK-NEXT: br i1 %[[T2]], label %[[HOP3:[0-9]+]], label
+; CHECK: [[HOP3]]:
+; CHECK-NEXT: getelementptr inbounds %bucket, %bucket* %[[B2]], i64 0, i32 1
+; CHECK-NEXT: bitcast
+; CHECK-NEXT: call void @llvm.prefetch
+; CHECK-NEXT: getelementptr inbounds %bucket, %bucket* %[[B2]], i64 0, i32 3
+; CHECK-NEXT: bitcast
+; CHECK-NEXT: call void @llvm.prefetch
+; CHECK-NEXT: %[[N3:[0-9]+]] = getelementptr inbounds %bucket, %bucket* %[[B2]], i64 0, i32 3
+; CHECK-NEXT: %[[B3:[0-9]+]] = load %bucket*, %bucket** %[[N3]]
+; CHECK-NEXT: %[[T3:[0-9]+]] = icmp ne %bucket* %[[B3]], null
+; CHECK-NEXT: br i1 %[[T3]], label %[[LAST:[0-9]+]], label
+; CHECK: [[LAST]]:
+; CHECK-NEXT: getelementptr inbounds %bucket, %bucket* %[[B3]], i64 0, i32 1
+; CHECK-NEXT: bitcast
+; CHECK-NEXT: call void @llvm.prefetch
+; CHECK-NEXT: getelementptr inbounds %bucket, %bucket* %[[B3]], i64 0, i32 3
+; CHECK-NEXT: bitcast
+; CHECK-NEXT: call void @llvm.prefetch
+; CHECK-NOT: load %bucket*
+; CHECK: [[END]]:
+; CHECK-NEXT: br label %inner
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%bucket = type { i32, i32, [2 x i64], %bucket* }
+
+; for (i = 0; i < n; i++) { b = buckets + (keys[i] & mask); do { m += b->count; b = b->next; } while (b); }
+define i64 @probe(i32* %keys, %bucket* %buckets, i32 %mask, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %m = phi i64 [ 0, %entry ], [ %m.inner, %outer.latch ]
+  %pk = getelementptr inbounds i32, i32* %keys, i64 %i
+  %key = load i32, i32* %pk, align 4
+  %h = and i32 %key, %mask
+  %hx = zext i32 %h to i64
+  %b0 = getelementptr inbounds %bucket, %bucket* %buckets, i64 %hx
+  br label %inner
+
+inner:
+  %b = phi %bucket* [ %b0, %outer ], [ %bn, %inner ]
+  %mi = phi i64 [ %m, %outer ], [ %m.inner, %inner ]
+  %pc = getelementptr inbounds %bucket, %bucket* %b, i64 0, i32 1
+  %c = load i32, i32* %pc, align 4
+  %cx = zext i32 %c to i64
+  %m.inner = add i64 %mi, %cx
+  %pn = getelementptr inbounds %bucket, %bucket* %b, i64 0, i32 3
+  %bn = load %bucket*, %bucket** %pn, align 8
+  %more = icmp ne %bucket* %bn, null
+  br i1 %more, label %inner, label %outer.latch
+
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %cmp = icmp slt i64 %i.next, %n
+  br i1 %cmp, label %outer, label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %m.inner, %outer.latch ]
+  ret i64 %r
+}
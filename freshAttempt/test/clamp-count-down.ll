@@ -0,0 +1,41 @@
+; A count-down loop with a data-dependent second exit has neither a trip count nor a single exit
+; comparison, so the look-ahead load is clamped with the size of @a. Counting down, that clamp has
+; to keep the index at or above the first element, never push it up to the size.
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<no-epilogue>' -S %s | %FileCheck %s
+
+; CHECK-LABEL: @countdown(
+; CHECK: %[[CMP:[0-9]+]] = icmp sgt i64 0, %[[AHEAD:[0-9]+]]
+; CHECK-NEXT: %[[IDX:[0-9]+]] = select i1 %[[CMP]], i64 0, i64 %[[AHEAD]]
+; CHECK-NEXT: getelementptr inbounds [1000 x i32], [1000 x i32]* @a, i64 0, i64 %[[IDX]]
+; CHECK-NOT: i64 1000
+; CHECK: call void @llvm.prefetch
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@a = global [1000 x i32] zeroinitializer
+@b = global [1000 x i32] zeroinitializer
+
+define i32 @countdown() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 999, %entry ], [ %i.next, %latch ]
+  %pa = getelementptr inbounds [1000 x i32], [1000 x i32]* @a, i64 0, i64 %i
+  %v = load i32, i32* %pa
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds [1000 x i32], [1000 x i32]* @b, i64 0, i64 %idx
+  %w = load i32, i32* %pb
+  %found = icmp eq i32 %w, 42
+  br i1 %found, label %exit, label %latch
+
+latch:
+  %i.next = add nsw i64 %i, -1
+  %done = icmp eq i64 %i, 0
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %r = phi i32 [ 1, %loop ], [ 0, %latch ]
+  ret i32 %r
+}
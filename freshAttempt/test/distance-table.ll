@@ -0,0 +1,54 @@
+; distance-table gives the look-ahead of every site a global of its own, listed with the site's name
+; in the swpf_sites section, and the loop loads it in the preheader instead of using a constant.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<distance-table>' -S %s | %FileCheck %s
+
+; CHECK: @swpf.distance = internal global i32 [[D0:[0-9]+]]
+; CHECK: @swpf.name = private constant [{{[0-9]+}} x i8] c"{{.*}}:gather:0\00"
+; CHECK: @swpf.site = private constant { i8*, i8* } { {{.*}} @swpf.name, {{.*}} @swpf.distance {{.*}}, section "swpf_sites"
+; CHECK: @llvm.global_ctors = appending global {{.*}} @__swpf_distances_init
+; CHECK: @swpf.distance.1 = internal global i32 [[D1:[0-9]+]]
+; CHECK: @swpf.name.2 = private constant [{{[0-9]+}} x i8] c"{{.*}}:gather:1\00"
+; CHECK: @llvm.compiler.used = appending global [2 x i8*] [{{.*}} @swpf.site {{.*}} @swpf.site.3
+
+; CHECK-LABEL: @gather(
+; CHECK: ph:
+; CHECK-NEXT: %swpf.distance = load i32, i32* @swpf.distance
+; CHECK-NEXT: %[[AHEAD0:[0-9]+]] = sext i32 %swpf.distance to i64
+; CHECK-NEXT: %swpf.distance1 = load i32, i32* @swpf.distance.1
+; CHECK-NEXT: %[[AHEAD1:[0-9]+]] = sext i32 %swpf.distance1 to i64
+; CHECK: loop:
+; CHECK-NOT: add i64 %i, [[D0]]
+; CHECK: add i64 %i, %[[AHEAD0]]
+; CHECK: add i64 %i, %[[AHEAD1]]
+; CHECK: declare void @__swpf_distances_init()
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @gather(i32* %a, i64* %b, i64 %n) {
+entry:
+  %enter = icmp sgt i64 %n, 0
+  br i1 %enter, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %sum = phi i64 [ 0, %ph ], [ %sum.next, %loop ]
+  %pa = getelementptr inbounds i32, i32* %a, i64 %i
+  %v = load i32, i32* %pa, align 4
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds i64, i64* %b, i64 %idx
+  %w = load i64, i64* %pb, align 8
+  %sum.next = add i64 %sum, %w
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit.loopexit, label %loop
+
+exit.loopexit:
+  br label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %sum.next, %exit.loopexit ]
+  ret i64 %r
+}
@@ -0,0 +1,72 @@
+; A rotated loop with a known last value is split at the furthest look-ahead of its chain: the
+; prefetching loop needs no clamp and leaves for a copy without prefetches that runs the last
+; iterations, and loops too short to reach the split go straight to the copy. `no-epilogue` keeps
+; one loop and clamps the look-ahead index instead.
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<no-epilogue>' -S %s \
+; RUN:   | %FileCheck %s --check-prefix=CLAMP
+
+; CHECK-LABEL: @gather(
+; CHECK: ph:
+; CHECK-NEXT: %[[LAST:[0-9]+]] = add i64 %n, -1
+; CHECK-NEXT: %[[SPLIT:[0-9]+]] = add i64 %n, -249
+; CHECK-NEXT: %[[START:[0-9]+]] = icmp sle i64 0, %[[SPLIT]]
+; CHECK-NEXT: %[[WRAP:[0-9]+]] = icmp sle i64 %[[SPLIT]], %[[LAST]]
+; CHECK-NEXT: %[[ENTER:[0-9]+]] = and i1 %[[WRAP]], %[[START]]
+; CHECK-NEXT: br i1 %[[ENTER]], label %ph.split, label %ph.split.epilogue
+; CHECK: loop:
+; CHECK-NOT: select
+; CHECK: %[[AHEAD:[0-9]+]] = add i64 %i, 248
+; CHECK-NEXT: getelementptr inbounds i32, i32* %a, i64 %[[AHEAD]]
+; CHECK: call void @llvm.prefetch
+; CHECK: br i1 %done, label %exit.loopexit, label %loop.loop_crit_edge
+; CHECK: loop.loop_crit_edge:
+; CHECK-NEXT: %[[CONT:[0-9]+]] = icmp sle i64 %i.next, %[[SPLIT]]
+; CHECK-NEXT: br i1 %[[CONT]], label %loop, label %ph.split.epilogue
+; CHECK: ph.split.epilogue:
+; CHECK-NEXT: %i.resume = phi i64 [ 0, %ph ], [ %i.next, %loop.loop_crit_edge ]
+; CHECK-NEXT: %sum.resume = phi i64 [ 0, %ph ], [ %sum.next, %loop.loop_crit_edge ]
+; CHECK: loop.epilogue:
+; CHECK-NEXT: %i.epilogue = phi i64 [ %i.resume, %ph.split.epilogue ], [ %i.next.epilogue, %loop.epilogue ]
+; CHECK-NOT: call void @llvm.prefetch
+; CHECK: br i1 %done.epilogue, label %exit.loopexit, label %loop.epilogue
+; CHECK: exit.loopexit:
+; CHECK-NEXT: %sum.next.lcssa = phi i64 [ %sum.next, %loop ], [ %sum.next.epilogue, %loop.epilogue ]
+
+; CLAMP-LABEL: @gather(
+; CLAMP-NOT: epilogue
+; CLAMP: %[[AHEAD:[0-9]+]] = add i64 %i, 248
+; CLAMP-NEXT: %[[CMP:[0-9]+]] = icmp slt i64 %[[LAST:[0-9]+]], %[[AHEAD]]
+; CLAMP-NEXT: select i1 %[[CMP]], i64 %[[LAST]], i64 %[[AHEAD]]
+; CLAMP-NOT: epilogue
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @gather(i32* %a, i64* %b, i64 %n) {
+entry:
+  %enter = icmp sgt i64 %n, 0
+  br i1 %enter, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %sum = phi i64 [ 0, %ph ], [ %sum.next, %loop ]
+  %pa = getelementptr inbounds i32, i32* %a, i64 %i
+  %v = load i32, i32* %pa, align 4
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds i64, i64* %b, i64 %idx
+  %w = load i64, i64* %pb, align 8
+  %sum.next = add i64 %sum, %w
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit.loopexit, label %loop
+
+exit.loopexit:
+  br label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %sum.next, %exit.loopexit ]
+  ret i64 %r
+}
@@ -0,0 +1,55 @@
+; Without a loop bound only the index of the first load can be clamped, so chains normally stop at
+; two loads. guard-chains keeps the index of every later load inside its array with a select to
+; element 0: @b's size is known, the size of %c is only known from guard-bound.
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s --check-prefix=NOGUARD
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<guard-chains>' -S %s \
+; RUN:   | %FileCheck %s --check-prefixes=CHECK,SIZED
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<guard-chains;guard-bound=1000>' -S %s \
+; RUN:   | %FileCheck %s --check-prefixes=CHECK,BOUND
+
+; NOGUARD-LABEL: @search(
+; NOGUARD-NOT: icmp ult
+; NOGUARD-NOT: getelementptr inbounds i32, i32* %c, i64 %{{[0-9]+}}
+
+; CHECK-LABEL: @search(
+; CHECK: %[[BIN:[0-9]+]] = icmp ult i64 %[[B:[0-9]+]], 500
+; CHECK-NEXT: %[[BIDX:[0-9]+]] = select i1 %[[BIN]], i64 %[[B]], i64 0
+; CHECK-NEXT: getelementptr inbounds [500 x i32], [500 x i32]* @b, i64 0, i64 %[[BIDX]]
+; CHECK: %[[C:[0-9]+]] = getelementptr inbounds i32, i32* %c, i64 %{{[0-9]+}}
+; CHECK-NEXT: bitcast i32* %[[C]] to i8*
+; SIZED-NOT: getelementptr inbounds i32, i32* %d, i64 %{{[0-9]+}}
+; BOUND: %[[CIN:[0-9]+]] = icmp ult i64 %[[CV:[0-9]+]], 1000
+; BOUND-NEXT: %[[CIDX:[0-9]+]] = select i1 %[[CIN]], i64 %[[CV]], i64 0
+; BOUND-NEXT: getelementptr inbounds i32, i32* %c, i64 %[[CIDX]]
+; BOUND: %[[D:[0-9]+]] = getelementptr inbounds i32, i32* %d, i64 %{{[0-9]+}}
+; BOUND-NEXT: bitcast i32* %[[D]] to i8*
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@a = global [1000 x i32] zeroinitializer
+@b = global [500 x i32] zeroinitializer
+
+define i32 @search(i32* %c, i32* %d) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr inbounds [1000 x i32], [1000 x i32]* @a, i64 0, i64 %i
+  %va = load i32, i32* %pa
+  %ia = sext i32 %va to i64
+  %pb = getelementptr inbounds [500 x i32], [500 x i32]* @b, i64 0, i64 %ia
+  %vb = load i32, i32* %pb
+  %ib = sext i32 %vb to i64
+  %pc = getelementptr inbounds i32, i32* %c, i64 %ib
+  %vc = load i32, i32* %pc
+  %ic = sext i32 %vc to i64
+  %pd = getelementptr inbounds i32, i32* %d, i64 %ic
+  %vd = load i32, i32* %pd
+  %found = icmp eq i32 %vd, 42
+  %i.next = add nuw nsw i64 %i, 1
+  br i1 %found, label %exit, label %loop
+
+exit:
+  ret i32 %vd
+}
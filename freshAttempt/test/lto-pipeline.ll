@@ -0,0 +1,43 @@
+; Before LLVM 15 the full LTO pipeline has no extension point at its end, and a link runs the pass
+; with --lto-newpm-passes=lto<O3>,function(sw-prefetch<...>) instead. This is the pipeline the linker
+; parses: the pass runs on the optimized merged module, with the settings of its parameters.
+; RUN: %opt -load-pass-plugin=%plugin -passes='lto<O3>,function(sw-prefetch<distance=64;no-epilogue>)' -S %s \
+; RUN:   | %FileCheck %s
+
+; CHECK-LABEL: @gather(
+; CHECK: %[[AHEAD:[0-9]+]] = add i64 %i, 62
+; CHECK-NEXT: %[[CMP:[0-9]+]] = icmp slt i64 %[[LAST:[0-9]+]], %[[AHEAD]]
+; CHECK-NEXT: select i1 %[[CMP]], i64 %[[LAST]], i64 %[[AHEAD]]
+; CHECK: call void @llvm.prefetch.p0i8({{.*}}, i32 0, i32 3, i32 1)
+; CHECK: attributes #{{[0-9]+}} = { {{.*}}"sw-prefetched"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @gather(i32* %a, i64* %b, i64 %n) {
+entry:
+  %enter = icmp sgt i64 %n, 0
+  br i1 %enter, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %sum = phi i64 [ 0, %ph ], [ %sum.next, %loop ]
+  %pa = getelementptr inbounds i32, i32* %a, i64 %i
+  %v = load i32, i32* %pa, align 4
+  %idx = sext i32 %v to i64
+  %pb = getelementptr inbounds i64, i64* %b, i64 %idx
+  %w = load i64, i64* %pb, align 8
+  %sum.next = add i64 %sum, %w
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit.loopexit, label %loop
+
+exit.loopexit:
+  br label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %sum.next, %exit.loopexit ]
+  ret i64 %r
+}
@@ -0,0 +1,38 @@
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<machine-file=%S/Inputs/machine.json>' \
+; RUN:   -debug-pass-manager -pass-remarks-analysis=SwPrefetchPass -disable-output %s 2>&1 | %FileCheck %s
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<machine-file=%S/Inputs/machine.json>' \
+; RUN:   -disable-output %s | %FileCheck %s --check-prefix=QUIET --allow-empty
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<machine-file=%S/Inputs/machine.json;print-c>' \
+; RUN:   -disable-output %s | %FileCheck %s --check-prefix=PRINT
+
+; The C constant of the machine descriptor is computed by the module analysis before the pass runs,
+; and the pass takes it from there.
+; CHECK: Running analysis: {{.*}}MachineCConstAnalysis on [module]
+; CHECK: Running pass: {{.*}}SwPrefetchPass on sum
+; CHECK-NOT: Running analysis: {{.*}}MachineCConstAnalysis
+; CHECK: remark: {{.*}} prefetch distance {{[0-9]+}} from C constant 41,
+
+; The inputs and the result of the computation are only printed with print-c.
+; QUIET-NOT: Calculated C Const Value
+; PRINT: memory latency: 162.82 ns
+; PRINT: Calculated C Const Value: 41.5954 ... will be cast to 41
+define i64 @sum(i64* %a, i32* %idx, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %s1, %loop ]
+  %pi = getelementptr inbounds i32, i32* %idx, i64 %i
+  %k = load i32, i32* %pi
+  %kx = sext i32 %k to i64
+  %pa = getelementptr inbounds i64, i64* %a, i64 %kx
+  %v = load i64, i64* %pa
+  %s1 = add i64 %s, %v
+  %i1 = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i1, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i64 %s1
+}
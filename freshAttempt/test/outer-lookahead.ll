@@ -0,0 +1,95 @@
+; outer-lookahead prefetches a short inner loop from the block that enters it, for a later iteration
+; of the enclosing loop: it reloads that iteration's bounds from %xadj, prefetches the line of %adj it
+; starts at, and prefetches %val for its first eight edges. Edges the later loop doesn't have fall
+; back to the current loop's first one. Without the option the inner loop prefetches for itself.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<outer-lookahead>' -S %s | %FileCheck %s
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s --check-prefix=INNER
+
+; CHECK-LABEL: @csr(
+; CHECK: inner.ph:
+; CHECK-NEXT: %[[AHEAD:[0-9]+]] = add i64 %v, {{[0-9]+}}
+; CHECK-NEXT: %[[CMP:[0-9]+]] = icmp slt i64 %[[LAST:[0-9]+]], %[[AHEAD]]
+; CHECK-NEXT: %[[V:[0-9]+]] = select i1 %[[CMP]], i64 %[[LAST]], i64 %[[AHEAD]]
+; CHECK-NEXT: %[[PS:[0-9]+]] = getelementptr inbounds i64, i64* %xadj, i64 %[[V]]
+; CHECK-NEXT: %[[S:[0-9]+]] = load i64, i64* %[[PS]]
+; CHECK-NEXT: %[[V1:[0-9]+]] = add nuw nsw i64 %[[V]], 1
+; CHECK-NEXT: %[[PE:[0-9]+]] = getelementptr inbounds i64, i64* %xadj, i64 %[[V1]]
+; CHECK-NEXT: %[[E:[0-9]+]] = load i64, i64* %[[PE]]
+; CHECK: %[[RUNS:[0-9]+]] = icmp slt i64 %[[S]], %[[E]]
+; CHECK-NEXT: %[[FIRST:[0-9]+]] = select i1 %[[RUNS]], i64 %[[S]], i64 %start
+; CHECK-NEXT: %[[PA:[0-9]+]] = getelementptr inbounds i32, i32* %adj, i64 %[[FIRST]]
+; CHECK-NEXT: %[[PA8:[0-9]+]] = bitcast i32* %[[PA]] to i8*
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %[[PA8]], i32 0, i32 0, i32 1)
+; CHECK: getelementptr inbounds i64, i64* %val
+; CHECK: call void @llvm.prefetch.p0i8({{.*}}, i32 0, i32 3, i32 1)
+; CHECK: %[[LATER:[0-9]+]] = add i64 %{{[0-9]+}}, 7
+; CHECK-NEXT: %[[HAS:[0-9]+]] = icmp ule i64 7, %{{[0-9]+}}
+; CHECK-NEXT: %[[BOTH:[0-9]+]] = and i1 %{{[0-9]+}}, %[[HAS]]
+; CHECK-NEXT: %[[EDGE:[0-9]+]] = select i1 %[[BOTH]], i64 %[[LATER]], i64 %start
+; CHECK-NEXT: getelementptr inbounds i32, i32* %adj, i64 %[[EDGE]]
+; CHECK: call void @llvm.prefetch.p0i8({{.*}}, i32 0, i32 3, i32 1)
+; CHECK-NEXT: br label %inner
+; CHECK-NOT: add i64 %{{[0-9]+}}, 8
+; CHECK: inner:
+; CHECK-NOT: call void @llvm.prefetch
+; CHECK: inner.exit:
+
+; INNER-LABEL: @csr(
+; INNER: inner.ph:
+; INNER-NOT: call void @llvm.prefetch
+; INNER: inner:
+; INNER: call void @llvm.prefetch
+; INNER: inner.exit:
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @csr(i64* %xadj, i32* %adj, i64* %val, i64 %n) {
+entry:
+  %any = icmp sgt i64 %n, 0
+  br i1 %any, label %outer.ph, label %exit
+
+outer.ph:
+  br label %outer
+
+outer:
+  %v = phi i64 [ 0, %outer.ph ], [ %v.next, %outer.latch ]
+  %sum = phi i64 [ 0, %outer.ph ], [ %sum.out, %outer.latch ]
+  %px = getelementptr inbounds i64, i64* %xadj, i64 %v
+  %start = load i64, i64* %px
+  %v.next = add nuw nsw i64 %v, 1
+  %px.next = getelementptr inbounds i64, i64* %xadj, i64 %v.next
+  %end = load i64, i64* %px.next
+  %nonempty = icmp slt i64 %start, %end
+  br i1 %nonempty, label %inner.ph, label %outer.latch
+
+inner.ph:
+  br label %inner
+
+inner:
+  %e = phi i64 [ %start, %inner.ph ], [ %e.next, %inner ]
+  %s = phi i64 [ %sum, %inner.ph ], [ %s.next, %inner ]
+  %pa = getelementptr inbounds i32, i32* %adj, i64 %e
+  %u = load i32, i32* %pa
+  %idx = sext i32 %u to i64
+  %pv = getelementptr inbounds i64, i64* %val, i64 %idx
+  %w = load i64, i64* %pv
+  %s.next = add i64 %s, %w
+  %e.next = add nsw i64 %e, 1
+  %inner.done = icmp eq i64 %e.next, %end
+  br i1 %inner.done, label %inner.exit, label %inner
+
+inner.exit:
+  br label %outer.latch
+
+outer.latch:
+  %sum.out = phi i64 [ %sum, %outer ], [ %s.next, %inner.exit ]
+  %outer.done = icmp eq i64 %v.next, %n
+  br i1 %outer.done, label %outer.exit, label %outer
+
+outer.exit:
+  br label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %sum.out, %outer.exit ]
+  ret i64 %r
+}
@@ -0,0 +1,51 @@
+; The sum leaves the loop without an LCSSA phi, as InstCombine leaves it. The bound is loaded in the
+; latch, so the first iteration is peeled off for it, which must keep the use in %exit valid.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<peel>' -S %s | %FileCheck %s
+
+; CHECK-LABEL: @latch(
+; CHECK: loop.peel:
+; CHECK: loop:
+; CHECK: call void @llvm.prefetch
+; CHECK: %sum1.lcssa = phi i64 [ %sum1.peel, %latch.peel ], [ %sum1,
+; CHECK: %res = phi i64 [ 0, %entry ], [ %sum1.lcssa, %exit.loopexit ]
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%rel = type { i32*, i64 }
+
+define i64 @latch(%rel* %r, i64* %table, i64* %out) {
+entry:
+  %n0 = getelementptr inbounds %rel, %rel* %r, i64 0, i32 1
+  %num0 = load i64, i64* %n0
+  %g = icmp sgt i64 %num0, 0
+  br i1 %g, label %pre, label %exit
+pre:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %pre ], [ %i1, %latch ]
+  %sum = phi i64 [ 0, %pre ], [ %sum1, %latch ]
+  %tp = getelementptr inbounds %rel, %rel* %r, i64 0, i32 0
+  %t = load i32*, i32** %tp
+  %pk = getelementptr inbounds i32, i32* %t, i64 %i
+  %k = load i32, i32* %pk
+  %kx = sext i32 %k to i64
+  %pv = getelementptr inbounds i64, i64* %table, i64 %kx
+  %v = load i64, i64* %pv
+  %sum1 = add i64 %sum, %v
+  %odd = icmp slt i64 %v, 0
+  br i1 %odd, label %neg, label %latch
+neg:
+  store i64 %sum1, i64* %out
+  br label %latch
+latch:
+  %i1 = add nuw nsw i64 %i, 1
+  %np = getelementptr inbounds %rel, %rel* %r, i64 0, i32 1
+  %num = load i64, i64* %np
+  %c = icmp slt i64 %i1, %num
+  br i1 %c, label %loop, label %exit.loopexit
+exit.loopexit:
+  br label %exit
+exit:
+  %res = phi i64 [ 0, %entry ], [ %sum1, %exit.loopexit ]
+  ret i64 %res
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Runs the RUN: lines of an IR test the way lit does, with %opt, %llc, %FileCheck, %plugin, %s and %S replaced
+# by the tools, the pass plugin, the test file and its directory. A RUN: line ending in a backslash continues on the next.
+#
+# Usage: run-test.sh OPT LLC FILECHECK PLUGIN TEST
+set -o pipefail
+
+opt=$1
+llc=$2
+filecheck=$3
+plugin=$4
+test=$5
+
+command=""
+while IFS= read -r line; do
+  case "$line" in
+    *"RUN: "*) ;;
+    *) continue ;;
+  esac
+  command="$command${line#*RUN: }"
+  if [ "${command%\\}" != "$command" ]; then
+    command="${command%\\}"
+    continue
+  fi
+
+  command=${command//%opt/$opt}
+  command=${command//%llc/$llc}
+  command=${command//%FileCheck/$filecheck}
+  command=${command//%plugin/$plugin}
+  command=${command//%s/$test}
+  command=${command//%S/$(dirname "$test")}
+  echo "$command"
+  if ! bash -o pipefail -c "$command"; then
+    exit 1
+  fi
+  command=""
+done < "$test"
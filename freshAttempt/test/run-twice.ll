@@ -0,0 +1,35 @@
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s \
+; RUN:   | %FileCheck %s --check-prefix=FIRST
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s \
+; RUN:   | %opt -load-pass-plugin=%plugin -passes='sw-prefetch<guard-chains;guard-bound=1000>' -S \
+; RUN:   | %FileCheck %s --check-prefix=SECOND
+
+; A compile that doesn't prefetch the loop, as it has no bound, leaves no marks on it, so the link
+; of an LTO build can still prefetch it with other settings.
+define i32 @find(i32* %a, i32* %idx) {
+; FIRST-LABEL: @find(
+; FIRST-NOT: sw.prefetch
+; FIRST: ret i32
+; FIRST-NOT: "sw-prefetched"
+;
+; SECOND-LABEL: @find(
+; SECOND: call void @llvm.prefetch
+; SECOND: br i1 %c, label %loop, label %exit, !sw.prefetch
+; SECOND: attributes #{{[0-9]+}} = { "sw-prefetched" }
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pi = getelementptr inbounds i32, i32* %idx, i64 %i
+  %v = load i32, i32* %pi
+  %ve = sext i32 %v to i64
+  %pa = getelementptr inbounds i32, i32* %a, i64 %ve
+  %x = load i32, i32* %pa
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp ne i32 %x, 0
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %x
+}
@@ -0,0 +1,28 @@
+; RUN: awk '/; XORS$/ { for (k = 1; k <= 20000; k++) printf "  %%x%d = xor i64 %%x%d, %d\n", k, k - 1, k; next } \
+; RUN:      { print }' %s | (ulimit -s 8192 && %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S) \
+; RUN:   | %FileCheck %s
+
+; The address of %v is 20000 instructions away from the induction variable. Searching it must not
+; overflow an 8 MB stack, and gives up once the slice budget runs out.
+define void @deep(i64* %a, i64* %b, i64 %n) {
+; CHECK-LABEL: @deep(
+; CHECK-NOT: call void @llvm.prefetch
+; CHECK: ret void
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %x0 = add i64 %i, 0
+; XORS
+  %p = getelementptr inbounds i64, i64* %a, i64 %x20000
+  %v = load i64, i64* %p
+  %q = getelementptr inbounds i64, i64* %b, i64 %v
+  store i64 0, i64* %q
+  %i1 = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i1, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,42 @@
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s
+
+; The blocks are laid out before the load they depend on, so %x is first searched while %v isn't a
+; candidate yet. The search from %w2 has to see %v once it is one.
+define void @order(i64* %a, i64* %c, i64* %d, i64 %n) {
+; CHECK-LABEL: @order(
+; CHECK: useb:
+; CHECK: [[IDX:%.*]] = load i64
+; CHECK-NEXT: [[X:%.*]] = add i64 [[IDX]], 1
+; CHECK-NEXT: [[P:%.*]] = getelementptr inbounds i64, i64* %d, i64 [[X]]
+; CHECK: %w2 = load i64
+; CHECK: call void @llvm.prefetch
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %useb ]
+  br label %def
+
+usea:
+  %x = add i64 %v, 1
+  %pc = getelementptr inbounds i64, i64* %c, i64 %x
+  %w1 = load i64, i64* %pc
+  store i64 %w1, i64* %a
+  br label %useb
+
+def:
+  %pa = getelementptr inbounds i64, i64* %a, i64 %i
+  %v = load i64, i64* %pa
+  br label %usea
+
+useb:
+  %pd = getelementptr inbounds i64, i64* %d, i64 %x
+  %w2 = load i64, i64* %pd
+  store i64 %w2, i64* %c
+  %i1 = add nuw nsw i64 %i, 1
+  %cmp = icmp slt i64 %i1, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,50 @@
+; The lanes of the first gather read a field of consecutive 16 byte structures, so the four lanes of
+; its look-ahead addresses span less than a line and get two prefetches, of the first and the last
+; lane. The indices the second gather reads are only known at run time, so each of its lanes gets
+; a prefetch of its own.
+; RUN: %opt -load-pass-plugin=%plugin -passes=sw-prefetch -S %s | %FileCheck %s
+
+; CHECK-LABEL: @strided(
+; CHECK: %[[AHEAD:[0-9]+]] = getelementptr inbounds %node, %node* %s, <4 x i64> %{{[0-9]+}}, i32 1
+; CHECK-NEXT: %[[FIRST:[0-9]+]] = extractelement <4 x i64*> %[[AHEAD]], i64 0
+; CHECK-NEXT: %[[FIRSTCAST:[0-9]+]] = bitcast i64* %[[FIRST]] to i8*
+; CHECK-NEXT: %[[LAST:[0-9]+]] = extractelement <4 x i64*> %[[AHEAD]], i64 3
+; CHECK-NEXT: %[[LASTCAST:[0-9]+]] = bitcast i64* %[[LAST]] to i8*
+; CHECK: %pb = getelementptr
+; CHECK: call void @llvm.prefetch.p0i8(i8* %[[FIRSTCAST]], i32 0, i32 3, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %[[LASTCAST]], i32 0, i32 3, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %{{[0-9]+}}, i32 1, i32 3, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %{{[0-9]+}}, i32 1, i32 3, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %{{[0-9]+}}, i32 1, i32 3, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %{{[0-9]+}}, i32 1, i32 3, i32 1)
+; CHECK-NEXT: br i1
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%node = type { i64, i64 }
+
+define void @strided(%node* noalias %s, i64* noalias %b, i64 %n, <4 x i1> %mask) {
+entry:
+  br label %vector.body
+
+vector.body:
+  %index = phi i64 [ 0, %entry ], [ %index.next, %vector.body ]
+  %ins = insertelement <4 x i64> poison, i64 %index, i64 0
+  %splat = shufflevector <4 x i64> %ins, <4 x i64> poison, <4 x i32> zeroinitializer
+  %vec.ind = add <4 x i64> %splat, <i64 0, i64 1, i64 2, i64 3>
+  %ps = getelementptr inbounds %node, %node* %s, <4 x i64> %vec.ind, i32 1
+  %k = call <4 x i64> @llvm.masked.gather.v4i64.v4p0i64(<4 x i64*> %ps, i32 8, <4 x i1> %mask, <4 x i64> undef)
+  %pb = getelementptr inbounds i64, i64* %b, <4 x i64> %k
+  %v = call <4 x i64> @llvm.masked.gather.v4i64.v4p0i64(<4 x i64*> %pb, i32 8, <4 x i1> %mask, <4 x i64> undef)
+  %inc = add <4 x i64> %v, <i64 1, i64 1, i64 1, i64 1>
+  call void @llvm.masked.scatter.v4i64.v4p0i64(<4 x i64> %inc, <4 x i64*> %pb, i32 8, <4 x i1> %mask)
+  %index.next = add nuw i64 %index, 4
+  %c = icmp eq i64 %index.next, %n
+  br i1 %c, label %exit, label %vector.body
+
+exit:
+  ret void
+}
+
+declare <4 x i64> @llvm.masked.gather.v4i64.v4p0i64(<4 x i64*>, i32, <4 x i1>, <4 x i64>)
+declare void @llvm.masked.scatter.v4i64.v4p0i64(<4 x i64>, <4 x i64*>, i32, <4 x i1>)
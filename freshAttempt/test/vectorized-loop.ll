@@ -0,0 +1,48 @@
+; At the default optimizer-last position the pass runs after the loop vectorizer, so -O3 still
+; vectorizes the loop and the pass prefetches the gathers of the vector body. At vectorizer-start
+; the prefetches come first and the loop stays scalar.
+; RUN: %opt -load-pass-plugin=%plugin -passes='default<O3>' -S %s | %FileCheck %s
+; RUN: %opt -load-pass-plugin=%plugin -load=%plugin -sw-prefetch-position=vectorizer-start \
+; RUN:   -passes='default<O3>' -S %s | %FileCheck %s --check-prefix=SCALAR
+
+; CHECK-LABEL: @gather(
+; CHECK: vector.body:
+; CHECK: %[[IDX:[0-9]+]] = shufflevector <12 x i64> %{{[0-9]+}}, <12 x i64> poison, <4 x i32> <i32 0, i32 3, i32 6, i32 9>
+; CHECK-NEXT: %[[ADDR:[0-9]+]] = getelementptr inbounds i64, i64* %b, <4 x i64> %[[IDX]]
+; CHECK-NEXT: %[[LANE:[0-9]+]] = extractelement <4 x i64*> %[[ADDR]], i64 0
+; CHECK-NEXT: %[[CAST:[0-9]+]] = bitcast i64* %[[LANE]] to i8*
+; CHECK: @llvm.masked.gather.v4i64.v4p0i64
+; CHECK: call void @llvm.prefetch.p0i8(i8* %[[CAST]], i32 0, i32 3, i32 1)
+; CHECK: middle.block:
+
+; SCALAR-LABEL: @gather(
+; SCALAR-NOT: masked.gather
+; SCALAR: call void @llvm.prefetch
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%node = type { i64, i64, i64 }
+
+define i64 @gather(%node* noalias %s, i64* noalias %b, i64 %n) #0 {
+entry:
+  %g = icmp sgt i64 %n, 0
+  br i1 %g, label %loop, label %exit
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %sum = phi i64 [ 0, %entry ], [ %sum.next, %loop ]
+  %ps = getelementptr inbounds %node, %node* %s, i64 %i, i32 1
+  %k = load i64, i64* %ps
+  %pb = getelementptr inbounds i64, i64* %b, i64 %k
+  %v = load i64, i64* %pb
+  %sum.next = add i64 %sum, %v
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %r = phi i64 [ 0, %entry ], [ %sum.next, %loop ]
+  ret i64 %r
+}
+
+attributes #0 = { "target-cpu"="skylake-avx512" }
@@ -0,0 +1,97 @@
+; Addresses the loop stores to are prefetched with write intent (rw=1): the read-modify-write of a
+; histogram, and the scatter of @scatter, whose address is never loaded and is a candidate only
+; because of its store. The index loads stay read prefetches. x86 lowers rw=1 to PREFETCHW only with
+; the prfchw feature, and to PREFETCHT0 without it.
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<no-epilogue>' -S %s | %FileCheck %s
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<no-epilogue>' %s \
+; RUN:   | %llc -mattr=+prfchw | %FileCheck %s --check-prefix=PRFCHW
+; RUN: %opt -load-pass-plugin=%plugin -passes='sw-prefetch<no-epilogue>' %s \
+; RUN:   | %llc | %FileCheck %s --check-prefix=NOPRFCHW
+
+; CHECK-LABEL: @histogram(
+; CHECK: %[[IDX:[0-9]+]] = bitcast i32* %{{[0-9]+}} to i8*
+; CHECK: %[[HIST:[0-9]+]] = getelementptr inbounds i32, i32* %hist, i64 %{{[0-9]+}}
+; CHECK-NEXT: %[[HIST8:[0-9]+]] = bitcast i32* %[[HIST]] to i8*
+; CHECK: store i32 %c.next, i32* %ph.k
+; CHECK: call void @llvm.prefetch.p0i8(i8* %[[IDX]], i32 0, i32 0, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %[[HIST8]], i32 1, i32 3, i32 1)
+
+; CHECK-LABEL: @scatter(
+; CHECK: %[[SIDX:[0-9]+]] = bitcast i32* %{{[0-9]+}} to i8*
+; CHECK: %[[DST:[0-9]+]] = getelementptr inbounds i64, i64* %dst, i64 %{{[0-9]+}}
+; CHECK-NEXT: %[[DST8:[0-9]+]] = bitcast i64* %[[DST]] to i8*
+; CHECK: store i64 %x, i64* %pd
+; CHECK: call void @llvm.prefetch.p0i8(i8* %[[SIDX]], i32 0, i32 0, i32 1)
+; CHECK-NEXT: call void @llvm.prefetch.p0i8(i8* %[[DST8]], i32 1, i32 3, i32 1)
+; CHECK-NOT: call void @llvm.prefetch
+
+; PRFCHW-LABEL: histogram:
+; PRFCHW: prefetchw
+; PRFCHW-LABEL: scatter:
+; PRFCHW: prefetchw
+
+; NOPRFCHW-LABEL: histogram:
+; NOPRFCHW-NOT: prefetchw
+; NOPRFCHW: prefetcht0
+; NOPRFCHW-LABEL: scatter:
+; NOPRFCHW-NOT: prefetchw
+; NOPRFCHW: prefetcht0
+; NOPRFCHW-NOT: prefetchw
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @histogram(i32* %idx, i32* %hist, i64 %n) {
+entry:
+  %any = icmp sgt i64 %n, 0
+  br i1 %any, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %pi = getelementptr inbounds i32, i32* %idx, i64 %i
+  %k = load i32, i32* %pi
+  %kx = sext i32 %k to i64
+  %ph.k = getelementptr inbounds i32, i32* %hist, i64 %kx
+  %c = load i32, i32* %ph.k
+  %c.next = add i32 %c, 1
+  store i32 %c.next, i32* %ph.k
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %loop.exit, label %loop
+
+loop.exit:
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @scatter(i32* %idx, i64* %src, i64* %dst, i64 %n) {
+entry:
+  %any = icmp sgt i64 %n, 0
+  br i1 %any, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %pi = getelementptr inbounds i32, i32* %idx, i64 %i
+  %k = load i32, i32* %pi
+  %kx = sext i32 %k to i64
+  %ps = getelementptr inbounds i64, i64* %src, i64 %i
+  %x = load i64, i64* %ps
+  %pd = getelementptr inbounds i64, i64* %dst, i64 %kx
+  store i64 %x, i64* %pd
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %loop.exit, label %loop
+
+loop.exit:
+  br label %exit
+
+exit:
+  ret void
+}
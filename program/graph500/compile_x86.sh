@@ -1,13 +1,34 @@
+# C constant of the -auto binary, overridden by the C value sweep in test_and_benchmark.py
+SWPF_DISTANCE=${SWPF_DISTANCE:-256}
+
 [ ! -d "./bin" ] && mkdir ./bin
 [ ! -d "./bin/x86" ] && mkdir ./bin/x86
 
-clang -O3 seq-csr/seq-csr.c -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -c -S -emit-llvm 
-clang -O3 seq-csr.ll -c 
+clang -O3 seq-csr/seq-csr.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -c -S -emit-llvm 
+clang -O3 -mprfchw seq-csr.ll -c 
 gcc -flto -g -std=c99 -Wall -O3 -I./generator   seq-csr.o graph500.c options.c rmat.c kronecker.c verify.c prng.c xalloc.c timer.c generator/splittable_mrg.c generator/graph_generator.c generator/make_graph.c generator/utils.c  -lm -lrt -o bin/x86/g500-auto
 
-clang -O3 seq-csr/seq-csr.c -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass_g500.so -c -S -emit-llvm 
-clang -O3 seq-csr.ll -c 
+clang -O3 seq-csr/seq-csr.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-compute-c -mllvm -sw-prefetch-ipc-index=0 -c -S -emit-llvm 
+clang -O3 -mprfchw seq-csr.ll -c 
 gcc -flto -g -std=c99 -Wall -O3 -I./generator   seq-csr.o graph500.c options.c rmat.c kronecker.c verify.c prng.c xalloc.c timer.c generator/splittable_mrg.c generator/graph_generator.c generator/make_graph.c generator/utils.c  -lm -lrt -o bin/x86/g500-auto-new
 
+clang -O3 seq-csr/seq-csr.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -mllvm -sw-prefetch-distance-table -c -S -emit-llvm 
+clang -O3 -mprfchw seq-csr.ll -c 
+gcc -flto -g -std=c99 -Wall -O3 -I./generator   seq-csr.o graph500.c options.c rmat.c kronecker.c verify.c prng.c xalloc.c timer.c generator/splittable_mrg.c generator/graph_generator.c generator/make_graph.c generator/utils.c ../../freshAttempt/build/distanceRuntime/libSwPrefetchDistances.a -lm -lrt -o bin/x86/g500-table
+
+# Prefetches the first edges of a vertex from the loop over the frontier, as the hand-written seq-csrswpfio.c does
+clang -O3 seq-csr/seq-csr.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -mllvm -sw-prefetch-outer-lookahead -c -S -emit-llvm 
+clang -O3 -mprfchw seq-csr.ll -c 
+gcc -flto -g -std=c99 -Wall -O3 -I./generator   seq-csr.o graph500.c options.c rmat.c kronecker.c verify.c prng.c xalloc.c timer.c generator/splittable_mrg.c generator/graph_generator.c generator/make_graph.c generator/utils.c  -lm -lrt -o bin/x86/g500-outer
+
+# LLVM 15 and later run the pass at the end of the full LTO pipeline. Older linkers only run it when
+# they are given the whole LTO pipeline.
+SWPF_LTO_PIPELINE=""
+if [ "$(clang -dumpversion | cut -d. -f1)" -lt 15 ]; then
+  SWPF_LTO_PIPELINE="--lto-newpm-passes=lto<O3>,function(sw-prefetch<distance=$SWPF_DISTANCE>)"
+fi
+# Full LTO with clang instead of gcc, so the pass runs at the link and sees the graph built in the other files
+SWPF_PASS_OPTIONS="distance=$SWPF_DISTANCE" clang -flto -fuse-ld=lld -Wl,--load-pass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so ${SWPF_LTO_PIPELINE:+-Xlinker "$SWPF_LTO_PIPELINE"} -g -std=c99 -Wall -O3 -mprfchw -I./generator   seq-csr/seq-csr.c graph500.c options.c rmat.c kronecker.c verify.c prng.c xalloc.c timer.c generator/splittable_mrg.c generator/graph_generator.c generator/make_graph.c generator/utils.c  -lm -lrt -o bin/x86/g500-lto
+
 clang -O3 seq-csr/seq-csr.c -c 
 gcc -flto -g -std=c99 -Wall -O3 -I./generator   seq-csr.o graph500.c options.c rmat.c kronecker.c verify.c prng.c xalloc.c timer.c generator/splittable_mrg.c generator/graph_generator.c generator/make_graph.c generator/utils.c  -lm -lrt -o bin/x86/g500-no
\ No newline at end of file
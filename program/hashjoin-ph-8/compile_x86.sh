@@ -1,15 +1,31 @@
 cd src
 
+# C constant of the -auto binary, overridden by the C value sweep in test_and_benchmark.py
+SWPF_DISTANCE=${SWPF_DISTANCE:-256}
+
 [ ! -d "./bin" ] && mkdir ./bin
 [ ! -d "./bin/x86" ] && mkdir ./bin/x86
 
-clang -O3 npj2epb.c -Xclang -load -Xclang ../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -c -S -emit-llvm 
-clang -O3 npj2epb.ll -c 
+clang -O3 npj2epb.c -fpass-plugin=../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -c -S -emit-llvm 
+clang -O3 -mprfchw npj2epb.ll -c 
 clang -O3 npj2epb.o main.c generator.c genzipf.c perf_counters.c cpu_mapping.c parallel_radix_join.c -lpthread -lm -std=c99  -o bin/x86/hj2-auto
 
-clang -O3 npj2epb.c -Xclang -load -Xclang ../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass_hj8.so -c -S -emit-llvm 
-clang -O3 npj2epb.ll -c 
+clang -O3 npj2epb.c -fpass-plugin=../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-compute-c -mllvm -sw-prefetch-ipc-index=2 -c -S -emit-llvm 
+clang -O3 -mprfchw npj2epb.ll -c 
 clang -O3 npj2epb.o main.c generator.c genzipf.c perf_counters.c cpu_mapping.c parallel_radix_join.c -lpthread -lm -std=c99  -o bin/x86/hj2-auto-new
 
+clang -O3 npj2epb.c -fpass-plugin=../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -mllvm -sw-prefetch-distance-table -c -S -emit-llvm 
+clang -O3 -mprfchw npj2epb.ll -c 
+clang -O3 npj2epb.o main.c generator.c genzipf.c perf_counters.c cpu_mapping.c parallel_radix_join.c ../../../freshAttempt/build/distanceRuntime/libSwPrefetchDistances.a -lpthread -lm -std=c99  -o bin/x86/hj2-table
+
+# LLVM 15 and later run the pass at the end of the full LTO pipeline. Older linkers only run it when
+# they are given the whole LTO pipeline.
+SWPF_LTO_PIPELINE=""
+if [ "$(clang -dumpversion | cut -d. -f1)" -lt 15 ]; then
+  SWPF_LTO_PIPELINE="--lto-newpm-passes=lto<O3>,function(sw-prefetch<distance=$SWPF_DISTANCE>)"
+fi
+# Full LTO: the pass runs at the link, where the relations allocated in main.c and generator.c are visible
+SWPF_PASS_OPTIONS="distance=$SWPF_DISTANCE" clang -O3 -mprfchw -flto -fuse-ld=lld -Wl,--load-pass-plugin=../../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so ${SWPF_LTO_PIPELINE:+-Xlinker "$SWPF_LTO_PIPELINE"} npj2epb.c main.c generator.c genzipf.c perf_counters.c cpu_mapping.c parallel_radix_join.c -lpthread -lm -std=c99  -o bin/x86/hj2-lto
+
 clang -O3 npj2epb.c -c 
 clang -O3 npj2epb.o main.c generator.c genzipf.c perf_counters.c cpu_mapping.c parallel_radix_join.c -lpthread -lm -std=c99  -o bin/x86/hj2-no
\ No newline at end of file
@@ -1,11 +1,17 @@
+# C constant of the -auto binary, overridden by the C value sweep in test_and_benchmark.py
+SWPF_DISTANCE=${SWPF_DISTANCE:-256}
+
 [ ! -d "./bin" ] && mkdir ./bin
 [ ! -d "./bin/x86" ] && mkdir ./bin/x86
 
 clang -O3 cg.c -c
 clang -O3 cg.o ../nas-common/c_print_results.c ../nas-common/c_timers.c ../nas-common/wtime.c -lm ../nas-common/c_randdp.c -o bin/x86/cg-no
-clang -O3 cg.c -S -emit-llvm  -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so
-clang -O3 cg.ll -c
+clang -O3 cg.c -S -emit-llvm  -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE
+clang -O3 -mprfchw cg.ll -c
 clang -O3 cg.o ../nas-common/c_print_results.c ../nas-common/c_timers.c ../nas-common/wtime.c -lm ../nas-common/c_randdp.c -o bin/x86/cg-auto
-clang -O3 cg.c -S -emit-llvm  -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass_cg.so
-clang -O3 cg.ll -c
-clang -O3 cg.o ../nas-common/c_print_results.c ../nas-common/c_timers.c ../nas-common/wtime.c -lm ../nas-common/c_randdp.c -o bin/x86/cg-auto-new
\ No newline at end of file
+clang -O3 cg.c -S -emit-llvm  -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-compute-c -mllvm -sw-prefetch-ipc-index=3
+clang -O3 -mprfchw cg.ll -c
+clang -O3 cg.o ../nas-common/c_print_results.c ../nas-common/c_timers.c ../nas-common/wtime.c -lm ../nas-common/c_randdp.c -o bin/x86/cg-auto-new
+clang -O3 cg.c -S -emit-llvm  -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -mllvm -sw-prefetch-distance-table
+clang -O3 -mprfchw cg.ll -c
+clang -O3 cg.o ../nas-common/c_print_results.c ../nas-common/c_timers.c ../nas-common/wtime.c -lm ../nas-common/c_randdp.c ../../freshAttempt/build/distanceRuntime/libSwPrefetchDistances.a -o bin/x86/cg-table
\ No newline at end of file
@@ -1,10 +1,16 @@
+# C constant of the -auto binary, overridden by the C value sweep in test_and_benchmark.py
+SWPF_DISTANCE=${SWPF_DISTANCE:-256}
+
 [ ! -d "./bin" ] && mkdir ./bin
 [ ! -d "./bin/x86" ] && mkdir ./bin/x86
 
-clang -O3 randacc.c -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -c -S -emit-llvm
-clang -O3 randacc.ll -o bin/x86/randacc-auto
+clang -O3 randacc.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -c -S -emit-llvm
+clang -O3 -mprfchw randacc.ll -o bin/x86/randacc-auto
+
+clang -O3 randacc.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-compute-c -mllvm -sw-prefetch-ipc-index=4 -c -S -emit-llvm
+clang -O3 -mprfchw randacc.ll -o bin/x86/randacc-auto-new
 
-clang -O3 randacc.c -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass_rand.so -c -S -emit-llvm
-clang -O3 randacc.ll -o bin/x86/randacc-auto-new
+clang -O3 randacc.c -fpass-plugin=../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -Xclang -load -Xclang ../../freshAttempt/build/swPrefetchPass/SwPrefetchPass.so -mllvm -sw-prefetch-distance=$SWPF_DISTANCE -mllvm -sw-prefetch-distance-table -c -S -emit-llvm
+clang -O3 -mprfchw randacc.ll ../../freshAttempt/build/distanceRuntime/libSwPrefetchDistances.a -o bin/x86/randacc-table
 
 clang -O3 randacc.c -o bin/x86/randacc-no
\ No newline at end of file
@@ -20,16 +20,21 @@ def parse_args():
     parser.add_argument("-s", "--save", help="Save benchmark output in benchmark_output/", action="store_true")
     return parser.parse_args()
 
-def do_cmd(command, dir, use_shell=True):
-    p = subprocess.Popen(command, cwd=dir, shell=use_shell)
+def do_cmd(command, dir, use_shell=True, env=None):
+    p = subprocess.Popen(command, cwd=dir, shell=use_shell, env=env)
     p.wait()
 
-def build_benchmarks():
-    do_cmd(["./compile_x86.sh"], "./program/graph500")
-    do_cmd(["./compile_x86.sh"], "./program/hashjoin-ph-2")
-    do_cmd(["./compile_x86.sh"], "./program/hashjoin-ph-8")
-    do_cmd(["./compile_x86.sh"], "./program/nas-cg")
-    do_cmd(["./compile_x86.sh"], "./program/randacc")
+def build_benchmarks(c_value=None):
+    # the -auto binaries pick up the C constant from SWPF_DISTANCE, so a sweep doesn't rebuild the pass
+    env = None
+    if c_value is not None:
+        env = dict(os.environ, SWPF_DISTANCE=str(c_value))
+
+    do_cmd(["./compile_x86.sh"], "./program/graph500", env=env)
+    do_cmd(["./compile_x86.sh"], "./program/hashjoin-ph-2", env=env)
+    do_cmd(["./compile_x86.sh"], "./program/hashjoin-ph-8", env=env)
+    do_cmd(["./compile_x86.sh"], "./program/nas-cg", env=env)
+    do_cmd(["./compile_x86.sh"], "./program/randacc", env=env)
 
 def generate_output_dir(workdir):
     global timestamp
@@ -84,6 +89,8 @@ def create_pretty_print_text(benchmark, times):
         s +=  'Normal:       ' + str(times[0]) + '\n'
         s +=  'Prefetch:     ' + str(times[1]) + '\n'
         s +=  'New Prefetch: ' + str(times[2]) + '\n'
+        if (len(times) > 3):
+            s +=  'LTO Prefetch: ' + str(times[3]) + '\n'
         s += '*********************************************************\n'
         s += '\n'
 
@@ -129,7 +136,7 @@ def run_graph500_benchmark(run_only_standard_prefetch = False):
     if run_only_standard_prefetch:
         commands = [["bin/x86/g500-auto"]]
     else:
-        commands = [["bin/x86/g500-no"], ["bin/x86/g500-auto"], ["bin/x86/g500-auto-new"]]
+        commands = [["bin/x86/g500-no"], ["bin/x86/g500-auto"], ["bin/x86/g500-auto-new"], ["bin/x86/g500-lto"]]
 
     workdir = "./program/graph500"
 
@@ -139,7 +146,7 @@ def run_hj2_benchmark(run_only_standard_prefetch = False):
     if run_only_standard_prefetch:
         commands = [["src/bin/x86/hj2-auto"]]
     else:
-        commands = [["src/bin/x86/hj2-no"], ["src/bin/x86/hj2-auto"], ["src/bin/x86/hj2-auto-new"]]
+        commands = [["src/bin/x86/hj2-no"], ["src/bin/x86/hj2-auto"], ["src/bin/x86/hj2-auto-new"], ["src/bin/x86/hj2-lto"]]
     
     workdir = "./program/hashjoin-ph-2"
     
@@ -149,7 +156,7 @@ def run_hj8_benchmark(run_only_standard_prefetch = False):
     if run_only_standard_prefetch:
         commands = [["src/bin/x86/hj2-auto"]]
     else:
-        commands = [["src/bin/x86/hj2-no"], ["src/bin/x86/hj2-auto"], ["src/bin/x86/hj2-auto-new"]]
+        commands = [["src/bin/x86/hj2-no"], ["src/bin/x86/hj2-auto"], ["src/bin/x86/hj2-auto-new"], ["src/bin/x86/hj2-lto"]]
 
     workdir = "./program/hashjoin-ph-8"
     
@@ -175,25 +182,6 @@ def run_randacc_benchmark(run_only_standard_prefetch = False):
     
     return repeat_benchmark(commands, workdir, r"Time in milliseconds:\s*(\d+\.\d+)")
 
-def modify_cpp_constant(new_value):
-
-    pattern = re.compile(r'^#define C_CONSTANT \(\d+\)$')
-
-    file_path = "./freshAttempt/swPrefetchPass/swPrefetchPass.cpp" 
-
-    lines = []
-
-    with open(file_path, 'r') as file:
-        lines = file.readlines()
-
-    
-    with open(file_path, 'w') as file:
-        for line in lines:
-            if pattern.match(line.strip()):
-                # Replace the existing value with the new value
-                line = f'#define C_CONSTANT ({new_value})\n'
-            file.write(line)
-
 def plot_optimal_c_value_data(file_path):
     with open(file_path, 'r') as file:
         csv_reader = csv.reader(file)
@@ -219,7 +207,7 @@ def plot_optimal_c_value_data(file_path):
         plt.savefig('optimal_c_const_value.png')
 
 def find_optimal_c_value():
-    current = 0
+    current = 32
 
     g500 = []
     hj2  = []
@@ -228,9 +216,7 @@ def find_optimal_c_value():
     rand = []
 
     for i in range(8): 
-        modify_cpp_constant(current)
-        rebuild_pass()
-        build_benchmarks()
+        build_benchmarks(current)
         ignore, times = run_all_benchmarks(True)
 
         g500.append(times[0][0])
@@ -259,12 +245,26 @@ def find_optimal_c_value():
         temp = rand
         writer.writerow(['rand', temp[0], temp[1], temp[2], temp[3], temp[4], temp[5], temp[6], temp[7]])
 
-    # restore original value in cpp file, pass, and benchmarks
-    modify_cpp_constant(256)
-    build_everything()
+    # restore the benchmarks built with the default C value
+    build_benchmarks()
 
     plot_optimal_c_value_data(out_file)
 
+def sweep_site_distances():
+    # every -table binary reads its per-site distances at start up, so the sweep runs without rebuilding
+    sweeps = [
+        ("./program/graph500",      ["bin/x86/g500-table"],            r"median_time: (\d+\.\d+e[+-]\d+)"),
+        ("./program/hashjoin-ph-2", ["src/bin/x86/hj2-table"],         r"TOTAL-TIME-USECS, TOTAL-TUPLES, CYCLES-PER-TUPLE:\s+(\d+\.\d+)\s+"),
+        ("./program/hashjoin-ph-8", ["src/bin/x86/hj2-table"],         r"TOTAL-TIME-USECS, TOTAL-TUPLES, CYCLES-PER-TUPLE:\s+(\d+\.\d+)\s+"),
+        ("./program/nas-cg",        ["bin/x86/cg-table"],              r"Time in seconds\s*=\s*(\d+\.\d+)"),
+        ("./program/randacc",       ["bin/x86/randacc-table", "100000000"], r"Time in milliseconds:\s*(\d+\.\d+)"),
+    ]
+
+    sweep = pathlib.Path("./freshAttempt/benchmark/sweep_sites.py").resolve()
+    for workdir, command, regex in sweeps:
+        # the best distances land next to the benchmark, ready for SWPF_DISTANCES_FILE=swpf.distances
+        do_cmd([str(sweep), "-x", regex, "-o", "swpf.distances", "--"] + command, workdir, False)
+
 def rebuild_pass():
     do_cmd(['rm', '-rf', 'build'], "./freshAttempt", False)
     do_cmd(['mkdir', 'build'], "./freshAttempt", False)
@@ -344,6 +344,7 @@ if __name__ == "__main__":
         print("a - run all benchmarks")
         print("b - rebuild the pass and all benchmarks")
         print("f - find optimal c value")
+        print("d - sweep the prefetch distance of every site")
         print("c - print computed c values for benchmarks")
         print("1 - run graph500  benchmark")
         print("2 - run hashjoin2 benchmark")
@@ -365,6 +366,8 @@ if __name__ == "__main__":
                 build_everything()
             case 'f':
                 find_optimal_c_value()
+            case 'd':
+                sweep_site_distances()
             case 'c':
                 results = print_computed_c_vals()
             case '1':